@@ -37,33 +37,59 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 #include "elf_util.h"
 #include "dwarfy.h"
+#include "valve_util.h"
 
 #ifdef FREEBSD
 #define DW_LNE_set_discriminator 4
 #endif
+#ifndef DW_TAG_skeleton_unit
+#define DW_TAG_skeleton_unit 0x4a
+#endif
+#ifndef DW_IDX_compile_unit
+#define DW_IDX_compile_unit 1
+#define DW_IDX_type_unit 2
+#define DW_IDX_die_offset 3
+#endif
+#ifndef DW_LANG_C11
+#define DW_LANG_C11 0x001d
+#endif
+#ifndef DW_LANG_C17
+#define DW_LANG_C17 0x002c
+#endif
+#if defined(__x86_64__) && !defined(signature_HYGON_ebx)
+#define signature_HYGON_ebx 0x6f677948
+#define signature_HYGON_edx 0x6e65476e
+#define signature_HYGON_ecx 0x656e6975
+#endif
 
-int DWARFY_FORMAT;
-unsigned long int DEBUG_INFO_SIZE;
-unsigned long int COMPILATION_UNIT_OFFSET;
-unsigned long int COMPILATION_UNIT_LENGTH;
-unsigned int LINE_NUMBER_PROGRAM_OFFSET;
-
-unsigned char *DEBUG_INFO,*DEBUG_ABBREV,*DEBUG_LINE,*DEBUG_STR,*DEBUG_ARANGES;
-
-unsigned long int DWARFY_ELF_BASE_ADDRESS;
-unsigned long int DWARFY_ELF_RUNTIME_ADDRESS;
+/* held shared while any object parses a unit on demand, and exclusively across fork(), so that a snapshot child never
+   inherits an object's lazy_lock locked */
+pthread_rwlock_t DWARFY_FORK_LOCK = PTHREAD_RWLOCK_INITIALIZER;
+pthread_once_t DWARFY_FORK_HANDLERS_ONCE = PTHREAD_ONCE_INIT;
 
-int dwarfy_compare_object_records_by_address(DwarfyObjectRecord *dlr1,DwarfyObjectRecord *dlr2)
-{
-  return dlr2->address - dlr1->address;
-}
+/* the source files reports have shown, by resolved path */
+DwarfySourceCodeTree_t DWARFY_SOURCE_CODE = RB_INITIALIZER(&DWARFY_SOURCE_CODE);
+/* the same files by the names line tables give them, so that realpath() runs once per name rather than per lookup */
+DwarfySourceCodeNameTree_t DWARFY_SOURCE_CODE_NAMES = RB_INITIALIZER(&DWARFY_SOURCE_CODE_NAMES);
+pthread_mutex_t DWARFY_SOURCE_CODE_LOCK = PTHREAD_MUTEX_INITIALIZER;
 
-int dwarfy_compare_abbreviations(DwarfyAbbreviation *a1,DwarfyAbbreviation *a2)
-{
-  return a2->code - a1->code;
-}
+/* names given inline in .debug_info and .debug_line, interned across every object */
+InternTable DWARFY_STRINGS;
+pthread_mutex_t DWARFY_STRINGS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t DWARFY_STRINGS_ONCE = PTHREAD_ONCE_INIT;
 
 int dwarfy_compare_functions(DwarfyFunction *df1,DwarfyFunction *df2)
 {
@@ -75,55 +101,178 @@ int dwarfy_compare_source_code(DwarfySourceCode *dsc1,DwarfySourceCode *dsc2)
   return strcmp(dsc2->file_name,dsc1->file_name);
 }
 
-RB_GENERATE(DwarfyObjectRecordTree,DwarfyObjectRecord,DwarfyObjectRecordLinks,dwarfy_compare_object_records_by_address)
+int dwarfy_compare_source_code_names(DwarfySourceCodeName *dscn1,DwarfySourceCodeName *dscn2)
+{
+  if(dscn1->directory != dscn2->directory)
+    return (dscn1->directory > dscn2->directory) - (dscn1->directory < dscn2->directory);
+  return (dscn1->file_name > dscn2->file_name) - (dscn1->file_name < dscn2->file_name);
+}
+
 RB_GENERATE(DwarfyFunctionTree,DwarfyFunction,DwarfyFunctionLinks,dwarfy_compare_functions)
-RB_GENERATE(DwarfyAbbreviationTree,DwarfyAbbreviation,DwarfyAbbreviationLinks,dwarfy_compare_abbreviations)
 RB_GENERATE(DwarfySourceCodeTree,DwarfySourceCode,DwarfySourceCodeLinks,dwarfy_compare_source_code);
+RB_GENERATE(DwarfySourceCodeNameTree,DwarfySourceCodeName,DwarfySourceCodeNameLinks,dwarfy_compare_source_code_names);
 
 DWARF_DATA *load_dwarf(char *file_name,unsigned long int runtime_address)
+{
+  return dwarfy_load(file_name,runtime_address,1);
+}
+
+/* as load_dwarf, parsing the object's compilation units on num_threads threads */
+
+DWARF_DATA *dwarfy_load(char *file_name,unsigned long int runtime_address,int num_threads)
 {
   char debug_file_name[256];
   unsigned char *elf;
   unsigned char *elf_standalone_debug;
+  unsigned long int elf_size;
+  unsigned long int elf_standalone_debug_size;
   DWARF_DATA *debug_info;
+  DwarfyContext context;
   
   elf = 0;
   elf_standalone_debug = 0;
   
-  if(0 == (elf = load_elf(file_name)))
+  if(0 == (elf = map_elf(file_name,&elf_size)))
     return 0;
   
-  DWARFY_ELF_BASE_ADDRESS = get_elf_base_address(elf);
-  DWARFY_ELF_RUNTIME_ADDRESS = runtime_address;
+  memset(&context,0,sizeof(DwarfyContext));
+  context.elf_base_address = get_elf_base_address(elf);
+  context.elf_runtime_address = runtime_address;
+  context.num_threads = num_threads;
 
-  if(0 == (debug_info = dwarfy_load_debug_info(elf)))
+  if(0 == (debug_info = dwarfy_load_debug_info(&context,elf)))
   {
     strcpy(debug_file_name,file_name);
     strcat(debug_file_name,".debug");
     
-    if(0 == (elf_standalone_debug = load_elf(debug_file_name)))
+    if(0 == (elf_standalone_debug = map_elf(debug_file_name,&elf_standalone_debug_size)))
     {
       debug_info = 0;
       goto cleanup;
     }
     
-    debug_info = dwarfy_load_debug_info(elf_standalone_debug);
+    debug_info = dwarfy_load_debug_info(&context,elf_standalone_debug);
 
   }
 
   cleanup:
   
-  if(elf)
-    free(elf);
+  if(debug_info)
+    debug_info->elf_size = debug_info->elf == elf ? elf_size : elf_standalone_debug_size;
+  
+  /* once every unit is parsed only .debug_str is read again, by whoever prints a function name; let the rest of
+     the mapping go back to the page cache */
+  if(debug_info && !debug_info->num_ranges)
+    madvise(debug_info->elf,debug_info->elf_size,MADV_DONTNEED);
   
-  if(elf_standalone_debug)
-    free(elf_standalone_debug);
+  if(elf && !(debug_info && debug_info->elf == elf))
+    unmap_elf(elf,elf_size);
+  
+  if(elf_standalone_debug && !(debug_info && debug_info->elf == elf_standalone_debug))
+    unmap_elf(elf_standalone_debug,elf_standalone_debug_size);
   
   return debug_info;
 }
 
-DWARF_DATA *dwarfy_load_debug_info(unsigned char *elf)
+typedef struct
+{
+  int request;
+  long int size;
+} DwarfyLoadOrder;
+
+typedef struct
+{
+  DwarfyLoadRequest *requests;
+  DwarfyLoadOrder *order;
+  int num_requests;
+  int next_request;
+  int num_unit_threads; /* for the compilation units of each object */
+} DwarfyLoadQueue;
+
+int dwarfy_compare_load_order(const void *o1,const void *o2)
+{
+  long int s1 = ((DwarfyLoadOrder*)o1)->size;
+  long int s2 = ((DwarfyLoadOrder*)o2)->size;
+  
+  return (s1 < s2) - (s1 > s2);
+}
+
+void *dwarfy_load_thread(void *arg)
+{
+  DwarfyLoadQueue *queue = arg;
+  DwarfyLoadRequest *request;
+  int i;
+  
+  while((i = __atomic_fetch_add(&queue->next_request,1,__ATOMIC_RELAXED)) < queue->num_requests)
+  {
+    request = &queue->requests[queue->order[i].request];
+    request->dwarf = request->file_name ? dwarfy_load(request->file_name,request->runtime_address,queue->num_unit_threads) : 0;
+  }
+  
+  return 0;
+}
+
+/* load several objects at once: every load has its own DwarfyContext, so the workers share nothing but the queue.
+   the largest object bounds the time taken, so the largest objects are started first; threads beyond one
+   per object parse the objects' compilation units */
+
+void load_dwarf_parallel(DwarfyLoadRequest *requests,int num_requests,int num_threads)
+{
+  DwarfyLoadQueue queue;
+  pthread_t threads[DWARFY_MAX_NUM_LOAD_THREADS];
+  struct stat info;
+  int num_files;
+  int num_started;
+  int i;
+  
+  queue.requests = requests;
+  queue.order = malloc((num_requests + 1) * sizeof(DwarfyLoadOrder));
+  queue.num_requests = num_requests;
+  queue.next_request = 0;
+  
+  num_files = 0;
+  for(i = 0; i < num_requests; i++)
+  {
+    queue.order[i].request = i;
+    queue.order[i].size = (requests[i].file_name && stat(requests[i].file_name,&info) == 0) ? info.st_size : 0;
+    if(queue.order[i].size)
+      num_files++;
+  }
+  qsort(queue.order,num_requests,sizeof(DwarfyLoadOrder),dwarfy_compare_load_order);
+  
+  if(num_threads > DWARFY_MAX_NUM_LOAD_THREADS)
+    num_threads = DWARFY_MAX_NUM_LOAD_THREADS;
+  queue.num_unit_threads = num_files ? num_threads / num_files : 1;
+  if(queue.num_unit_threads < 1)
+    queue.num_unit_threads = 1;
+  if(num_threads > num_files)
+    num_threads = num_files ? num_files : 1;
+  
+  /* the calling thread is the first worker */
+  for(num_started = 0; num_started < num_threads - 1; num_started++)
+  {
+    if(pthread_create(&threads[num_started],0,dwarfy_load_thread,&queue))
+      break;
+  }
+  dwarfy_load_thread(&queue);
+  
+  for(i = 0; i < num_started; i++)
+    pthread_join(threads[i],0);
+  
+  free(queue.order);
+}
+
+int dwarfy_num_cpus()
+{
+  long int num_cpus;
+  
+  num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return num_cpus > 0 ? num_cpus : 1;
+}
+
+DWARF_DATA *dwarfy_load_debug_info(DwarfyContext *context,unsigned char *elf)
 {
+  DWARF_DATA *dwarf;
   int result;
   char *section_name;
   char debug_file_name[256];
@@ -135,12 +284,16 @@ DWARF_DATA *dwarfy_load_debug_info(unsigned char *elf)
   unsigned int section_header_size;
   unsigned int section_names_index;
   
-  DEBUG_INFO = DEBUG_ABBREV = DEBUG_LINE = DEBUG_STR = 0;
+  context->debug_info = context->debug_abbrev = context->debug_line = context->debug_str = 0;
+  context->debug_aranges = context->debug_ranges = 0;
+  context->debug_str_offsets = context->debug_addr = context->debug_rnglists = context->debug_line_str = 0;
+  context->debug_str_offsets_size = context->debug_addr_size = context->debug_rnglists_size = 0;
+  context->debug_names = context->gdb_index = 0;
+  context->debug_names_size = context->gdb_index_size = 0;
 
-  DEBUG_INFO_SIZE = 0;
-  COMPILATION_UNIT_OFFSET = 0;
-  COMPILATION_UNIT_LENGTH = 0;
-  LINE_NUMBER_PROGRAM_OFFSET = 0;
+  context->debug_info_size = context->debug_aranges_size = context->debug_ranges_size = 0;
+  context->compilation_unit_end = 0;
+  context->line_number_program_offset = 0;
 
   elf_header = (Elf64_Ehdr*)elf;
   program_header = (Elf64_Phdr*)(elf + elf_header->e_phoff);
@@ -160,21 +313,60 @@ DWARF_DATA *dwarfy_load_debug_info(unsigned char *elf)
     
     if(!strcmp(section_name,".debug_info"))
     {
-      DEBUG_INFO = elf + section_header[i].sh_offset;
-      DEBUG_INFO_SIZE = (unsigned long int)section_header[i].sh_size;
+      context->debug_info = elf + section_header[i].sh_offset;
+      context->debug_info_size = (unsigned long int)section_header[i].sh_size;
     }
     if(!strcmp(section_name,".debug_abbrev"))
-      DEBUG_ABBREV = elf + section_header[i].sh_offset;
+      context->debug_abbrev = elf + section_header[i].sh_offset;
     if(!strcmp(section_name,".debug_line"))
-      DEBUG_LINE = elf + section_header[i].sh_offset;
+      context->debug_line = elf + section_header[i].sh_offset;
     if(!strcmp(section_name,".debug_str"))
-      DEBUG_STR = elf + section_header[i].sh_offset;
+      context->debug_str = elf + section_header[i].sh_offset;
+    if(!strcmp(section_name,".debug_aranges"))
+    {
+      context->debug_aranges = elf + section_header[i].sh_offset;
+      context->debug_aranges_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".debug_ranges"))
+    {
+      context->debug_ranges = elf + section_header[i].sh_offset;
+      context->debug_ranges_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".debug_str_offsets"))
+    {
+      context->debug_str_offsets = elf + section_header[i].sh_offset;
+      context->debug_str_offsets_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".debug_addr"))
+    {
+      context->debug_addr = elf + section_header[i].sh_offset;
+      context->debug_addr_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".debug_rnglists"))
+    {
+      context->debug_rnglists = elf + section_header[i].sh_offset;
+      context->debug_rnglists_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".debug_line_str"))
+      context->debug_line_str = elf + section_header[i].sh_offset;
+    if(!strcmp(section_name,".debug_names"))
+    {
+      context->debug_names = elf + section_header[i].sh_offset;
+      context->debug_names_size = (unsigned long int)section_header[i].sh_size;
+    }
+    if(!strcmp(section_name,".gdb_index"))
+    {
+      context->gdb_index = elf + section_header[i].sh_offset;
+      context->gdb_index_size = (unsigned long int)section_header[i].sh_size;
+    }
   }
   
-  if(0 == (DEBUG_INFO && DEBUG_ABBREV && DEBUG_LINE && DEBUG_STR))
+  if(0 == (context->debug_info && context->debug_abbrev && context->debug_line && context->debug_str))
     return 0;
   
-  return dwarfy_main();
+  if((dwarf = dwarfy_main(context)))
+    dwarf->elf = elf;
+  return dwarf;
 }
 
 DwarfyCompilationUnit *create_compilation_unit()
@@ -183,407 +375,1577 @@ DwarfyCompilationUnit *create_compilation_unit()
   
   compilation_unit = malloc(sizeof(DwarfyCompilationUnit));
   
-  RB_INIT(&compilation_unit->line_numbers);
-  RB_INIT(&compilation_unit->addresses);
+  compilation_unit->sequences = 0;
+  compilation_unit->num_sequences = 0;
+  compilation_unit->max_num_sequences = 0;
+  compilation_unit->num_line_rows = 0;
   RB_INIT(&compilation_unit->functions);
   
-  compilation_unit->num_include_paths = 1;
-  compilation_unit->include_paths[0] = "";
+  compilation_unit->include_paths = 0;
+  compilation_unit->num_include_paths = 0;
+  compilation_unit->max_num_include_paths = 0;
+  compilation_unit->file_names = 0;
+  compilation_unit->first_file = 1;
+  compilation_unit->directory_indices = 0;
   compilation_unit->num_file_names = 0;
+  compilation_unit->max_num_file_names = 0;
   
-  //compilation_unit->abbreviations = malloc(sizeof(DwarfyAbbreviationTree_t));
-  RB_INIT(&compilation_unit->abbreviations);
-  LIST_INIT(&compilation_unit->DIE_list);
-  RB_INIT(&compilation_unit->source_code);
+  compilation_unit->abbreviations = 0;
+  compilation_unit->num_DIEs = 0;
+  compilation_unit->DIE_seconds = 0;
   
   return compilation_unit;
 } 
   
-DWARF_DATA *dwarfy_main()
+/* units whose addresses the range index covers are left to be parsed when an address in them is first symbolized;
+   the rest are parsed now */
+
+DWARF_DATA *dwarfy_main(DwarfyContext *context)
 {
   DWARF_DATA *elf;
-  unsigned char *address;
   
-  elf = malloc(sizeof(DWARF_DATA));
+  elf = calloc(1,sizeof(DWARF_DATA));
 
   LIST_INIT(&elf->compilation_units);
-  dwarfy_consume_compilation_units(&elf->compilation_units,&address);
+  pthread_mutex_init(&elf->lazy_lock,0);
+  elf->context = *context;
+  elf->num_units = dwarfy_find_compilation_units(context,&elf->units);
+  if(context->debug_names)
+    dwarfy_index_debug_names(context,elf);
+  dwarfy_index_compilation_units(context,elf);
+  dwarfy_consume_compilation_units(context,elf);
+  
+  if(elf->num_ranges)
+    pthread_once(&DWARFY_FORK_HANDLERS_ONCE,dwarfy_register_fork_handlers);
+  
   return elf;
 
 }
 
-void dwarfy_consume_compilation_units(DwarfyCompilationUnitList_t *compilation_units,unsigned char **address)
+/* the first, serial, pass: only the unit headers are read, to find where each compilation unit starts and ends,
+   and the abbreviation sets the units use are parsed */
+
+unsigned long int dwarfy_find_compilation_units(DwarfyContext *context,DwarfyUnitSpan **spans)
 {
   DwarfyCompilationUnitHeader *compilation_unit_header;
-  DwarfyCompilationUnit *compilation_unit;
-  unsigned char *line_number_program_ptr; 
-  unsigned char *abbreviations_ptr;
-  unsigned int unit_length;
-  short unsigned int version;
-  unsigned int debug_abbrev_offset;
-  unsigned char architecture_address_size;
-
-  *address = DEBUG_INFO;// + COMPILATION_UNIT_OFFSET;
+  DwarfyAbbreviationSet **sets;
+  unsigned long int num_sets;
+  unsigned long int num_spans,max_num_spans;
+  unsigned long int offset;
+  unsigned long int abbreviations_offset;
+  unsigned long int header_size;
+  unsigned char unit_type;
+  
+  sets = 0;
+  num_sets = 0;
+  num_spans = 0;
+  max_num_spans = 64;
+  *spans = malloc(max_num_spans * sizeof(DwarfyUnitSpan));
   
-  while((*address = DEBUG_INFO +  COMPILATION_UNIT_LENGTH) < DEBUG_INFO + DEBUG_INFO_SIZE)
+  for(offset = 0; offset + sizeof(DwarfyCompilationUnitHeader) <= context->debug_info_size; offset += compilation_unit_header->unit_length + 4)
   {
-	compilation_unit = create_compilation_unit();
+    compilation_unit_header = (DwarfyCompilationUnitHeader*)(context->debug_info + offset);
     
-	compilation_unit_header = (DwarfyCompilationUnitHeader*)(*address);
-        
-    abbreviations_ptr = DEBUG_ABBREV + compilation_unit_header->abbreviations_offset;
-	dwarfy_consume_abbreviations(compilation_unit,&abbreviations_ptr);
-
-	COMPILATION_UNIT_LENGTH += compilation_unit_header->unit_length + 4;
-	*address += sizeof(DwarfyCompilationUnitHeader);
-
-	dwarfy_consume_DIEs(&compilation_unit->DIE_list,compilation_unit,address);
-	line_number_program_ptr = DEBUG_LINE + LINE_NUMBER_PROGRAM_OFFSET;
-	dwarfy_consume_line_numbers(compilation_unit,&line_number_program_ptr);    
-    dwarfy_load_source_code(compilation_unit);
-    LIST_INSERT_HEAD(compilation_units,compilation_unit,linkage);
+    if(num_spans == max_num_spans)
+    {
+      max_num_spans *= 2;
+      *spans = realloc(*spans,max_num_spans * sizeof(DwarfyUnitSpan));
+    }
+    
+    /* DWARF 5 puts the unit type and address size before the abbreviations offset, and some unit types carry an id
+       or a type signature after it */
+    if(compilation_unit_header->version >= 5)
+    {
+      unit_type = context->debug_info[offset + 6];
+      abbreviations_offset = *((unsigned int*)(context->debug_info + offset + 8));
+      header_size = 12;
+      if(unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile)
+        header_size += 8;
+      else if(unit_type == DW_UT_type || unit_type == DW_UT_split_type)
+        header_size += 12;
+    }
+    else
+    {
+      abbreviations_offset = compilation_unit_header->abbreviations_offset;
+      header_size = sizeof(DwarfyCompilationUnitHeader);
+    }
+    
+    (*spans)[num_spans].offset = offset;
+    (*spans)[num_spans].first_DIE = offset + header_size;
+    (*spans)[num_spans].end = offset + compilation_unit_header->unit_length + 4;
+    (*spans)[num_spans].version = compilation_unit_header->version;
+    (*spans)[num_spans].abbreviations = dwarfy_abbreviation_set(context,&sets,&num_sets,abbreviations_offset);
+    (*spans)[num_spans].compilation_unit = 0;
+    (*spans)[num_spans].indexed = 0;
+    (*spans)[num_spans].named = 0;
+    (*spans)[num_spans].function_DIEs = 0;
+    (*spans)[num_spans].num_function_DIEs = 0;
+    (*spans)[num_spans].unreadable = 0;
+    
+    /* checked here, before anything runs, rather than when the unit is parsed, which may be long after the target started */
+    if(!dwarfy_unit_is_C(context,&(*spans)[num_spans]))
+    {
+      fprintf(stderr,"[valve] DWARF error: module was not written in C.\n");
+      exit(1);
+    }
+    num_spans++;
   }
-
+  
+  free(sets);
+  return num_spans;
 }
 
+/* whether a compile (or skeleton) unit's DW_AT_language is a dialect of C; type units and units that do not say pass */
 
-void dwarfy_consume_DIEs(DwarfyDIEList_t *DIE_list,DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+int dwarfy_unit_is_C(DwarfyContext *context,DwarfyUnitSpan *span)
 {
-  DwarfyDIE *DIE;
+  DwarfyAbbreviationSet *set;
   DwarfyAbbreviation *abbreviation;
-  DwarfyAbbreviation match;
-  DwarfyAttributeSpecList_t *attribute_spec_list;
   DwarfyAttributeSpec *spec;
-  DwarfyFunction *function;
+  unsigned char *address;
   unsigned long int abbreviation_code;
-  unsigned long int size;
-  int z = 1;
-  function = 0;
-  unsigned long int function_address;
-  int DIE_is_function;
-  char function_name[256];
-  unsigned short language_code;
+  unsigned long int language_code;
   
-  for(;;)
+  set = span->abbreviations;
+  address = context->debug_info + span->first_DIE;
+  abbreviation_code = dwarfy_consume_unsigned_LEB128(&address);
+  if(abbreviation_code == 0 || abbreviation_code >= set->num_codes || set->abbreviations[abbreviation_code].code == 0)
+    return 1;
+  
+  abbreviation = &set->abbreviations[abbreviation_code];
+  if(abbreviation->tag != DW_TAG_compile_unit && abbreviation->tag != DW_TAG_skeleton_unit)
+    return 1;
+  
+  for(spec = abbreviation->specs; spec < abbreviation->specs + abbreviation->num_items; spec++)
   {
-    if(0 == (abbreviation_code = dwarfy_consume_unsigned_LEB128(address)))
-      return;
-    
-    if(*address - DEBUG_INFO >= COMPILATION_UNIT_LENGTH)
-      return;
-      
-    DIE = malloc(sizeof(DwarfyDIE));
-    DIE->abbreviation_code = abbreviation_code;
-    LIST_INIT(&DIE->children);
-    match.code = abbreviation_code;
-
-    abbreviation = RB_FIND(DwarfyAbbreviationTree,&compilation_unit->abbreviations,&match);
-    spec = LIST_FIRST(&abbreviation->specs);
-    DIE_is_function = 0;
-    
-    while(spec)
-    {
-      if(abbreviation->tag == DW_TAG_subprogram)
-      {
-          
-        DIE_is_function = 1;
-        if(spec->name == DW_AT_low_pc)
-          function_address = (**((unsigned long int**)address)) - DWARFY_ELF_BASE_ADDRESS + DWARFY_ELF_RUNTIME_ADDRESS;
-        else if(spec->name == DW_AT_name)
-          strcpy(function_name,((char*)DEBUG_STR) + **((unsigned int**)address));
-      
-          
-      }
-      else if(abbreviation->tag == DW_TAG_compile_unit)
-      {
-        if(spec->name == DW_AT_stmt_list)
-        {
-          LINE_NUMBER_PROGRAM_OFFSET = **((unsigned int**)address);
-        }
-        else if(spec->name == DW_AT_language)
-        {
-          language_code = **((unsigned char**)address);
-          if(language_code != DW_LANG_C99 && language_code != DW_LANG_C89 && language_code != DW_LANG_C)
-          {
-             fprintf(stderr,"[valve] DWARF error: module was not written in C99, C89, or C.\n");
-             exit(1);
-          }
-        }
-        
-      }
-      
-      switch(spec->form)
-      {
-        case DW_FORM_data1:
-        {
-          (*address)++;
-          break;
-        }
-        case DW_FORM_data2:
-        {
-          (*address) += 2;
-          break;
-        }
-        case DW_FORM_data4:
-        {
-          (*address) += 4;
-          break;
-        }
-        case DW_FORM_data8:
-        {
-          (*address) += 8;
-          break;
-        }
-        case DW_FORM_sdata:
-        {
-          dwarfy_consume_signed_LEB128((unsigned char**)address);
-          break;
-        }
-        case DW_FORM_udata:
-        {
-          dwarfy_consume_unsigned_LEB128(address);
-          break;
-        }
-        case DW_FORM_ref1:
-        {
-          (*address)++;
-          break;
-        }
-        case DW_FORM_ref2:
-        {
-          (*address) += 2;
-          break;
-        }
-        case DW_FORM_ref4:
-        {
-          (*address) += 4;
-          break;
-        }
-        case DW_FORM_ref8:
-        {
-          (*address) += 8;
-          break;
-        }
-        case DW_FORM_flag:
-        {
-          (*address)++;
-          break;
-        }
-        case DW_FORM_flag_present:
-        {
-          break;
-        }
-        case DW_FORM_addr:
-        {
-          (*address) += 8;
-          break;
-        }
-        case DW_FORM_sec_offset:
-        {
-          (*address) += 4;
-          break;
-        }
-        case DW_FORM_strp:
-        {
-          (*address) += 4;
-          break;
-        }
-        case DW_FORM_string:
-        {
-          (*address) += strlen((char*)*address) + 1;
-          break;
-        }
-        case DW_FORM_exprloc:
-        {
-          size = dwarfy_consume_unsigned_LEB128(address);
-          (*address) += size;
-          break;
-        }
-	case DW_FORM_block1:
-	{
-	  size = **address;
-	  (*address) += size + 1;
-	  break;
-	}
-	default:
-	{
-	  exit(1);
-	}
-      }
-      spec = LIST_NEXT(spec,linkage);
-    }
-    
-    if(DIE_is_function)
+    if(spec->name != DW_AT_language)
     {
-          function = malloc(sizeof(DwarfyFunction));
-          function->address = function_address;
-          function->name = malloc(256);
-          strcpy(function->name,function_name);
-          RB_INSERT(DwarfyFunctionTree,&compilation_unit->functions,function);
+      if(dwarfy_skip_form(&address,spec->form))
+        return 1;
+      continue;
     }
-    
-    function = 0;
-    DIE_is_function = 0;
-    function_name[0] = 0;
-    
-    if(abbreviation->has_children)
-      dwarfy_consume_DIEs(&DIE->children,compilation_unit,address);
-    
-    LIST_INSERT_HEAD(DIE_list,DIE,linkage);
-    
+  
+    language_code = spec->form == DW_FORM_implicit_const ? spec->implicit_const : dwarfy_consume_form_value(&address,spec->form);
+    return language_code == DW_LANG_C89 || language_code == DW_LANG_C || language_code == DW_LANG_C99 ||
+           language_code == DW_LANG_C11 || language_code == DW_LANG_C17;
   }
+  
+  return 1;
 }
 
-void dwarfy_consume_abbreviations(DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+/* free a unit whose DIEs could not be parsed; nothing but its functions has been allocated yet */
+
+void dwarfy_free_compilation_unit(DwarfyCompilationUnit *compilation_unit)
 {
-  DwarfyAbbreviation *abbreviation;
+  DwarfyFunction *function,*next_function;
   
-  while((abbreviation = dwarfy_consume_abbreviation_header(address)))
+  RB_FOREACH_SAFE(function,DwarfyFunctionTree,&compilation_unit->functions,next_function)
   {
-    dwarfy_consume_abbreviation_attribute_specs(abbreviation,address);
-    RB_INSERT(DwarfyAbbreviationTree,&compilation_unit->abbreviations,abbreviation);
-    
+    RB_REMOVE(DwarfyFunctionTree,&compilation_unit->functions,function);
+    free(function);
   }
+  free(compilation_unit);
 }
 
-DwarfyAbbreviation *dwarfy_consume_abbreviation_header(unsigned char **address)
+/* parse one compilation unit; it writes only to its own copy of the context and its own DwarfyCompilationUnit,
+   so units can be parsed on any thread in any order. a unit whose DIEs cannot be parsed gives 0, and is left
+   unsymbolized rather than ending the target */
+
+DwarfyCompilationUnit *dwarfy_consume_compilation_unit(DwarfyContext *context,DwarfyUnitSpan *span)
 {
-  DwarfyAbbreviation *abbreviation;
-  unsigned long int abbreviation_code;
-  unsigned long int tag;
- 
-  abbreviation_code = dwarfy_consume_unsigned_LEB128(address);
+  DwarfyContext unit_context;
+  DwarfyCompilationUnit *compilation_unit;
+  struct timespec start,end;
+  unsigned char *line_number_program_ptr; 
+  unsigned char *address;
+  int result;
   
-  if(abbreviation_code == 0)
-    return 0;
+  unit_context = *context;
+  unit_context.compilation_unit_end = span->end;
+  unit_context.line_number_program_offset = -1;
   
-  abbreviation = malloc(sizeof(DwarfyAbbreviation));
-  abbreviation->code = abbreviation_code;
-   
-  tag = dwarfy_consume_unsigned_LEB128(address);
-  abbreviation->tag = tag;
+  /* where the first contributions start, for units that do not say */
+  unit_context.str_offsets_base = 8;
+  unit_context.addr_base = 8;
+  unit_context.rnglists_base = 12;
   
-  if(**address == DW_CHILDREN_yes)
+  compilation_unit = create_compilation_unit();
+  compilation_unit->abbreviations = span->abbreviations;
+  
+  address = context->debug_info + span->first_DIE;
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  if(span->named)
+    result = dwarfy_consume_named_DIEs(&unit_context,compilation_unit,span);
+  else
+    result = dwarfy_consume_DIEs(&unit_context,compilation_unit,&address);
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  if(result)
   {
-    abbreviation->has_children = 1;
+    fprintf(stderr,"[valve] DWARF error: the unit at offset 0x%lx could not be parsed, and is left unsymbolized.\n",span->offset);
+    dwarfy_free_compilation_unit(compilation_unit);
+    return 0;
   }
-  else if(**address == DW_CHILDREN_no)
+  compilation_unit->DIE_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+  if(unit_context.line_number_program_offset != -1)
   {
-    abbreviation->has_children = 0;
+    line_number_program_ptr = context->debug_line + unit_context.line_number_program_offset;
+    dwarfy_consume_line_numbers(&unit_context,compilation_unit,&line_number_program_ptr);
   }
   
-  abbreviation->num_items = 0;
-  
-  (*address)++;
-  
-  return abbreviation;
+  return compilation_unit;
 }
 
-void dwarfy_consume_abbreviation_attribute_specs(DwarfyAbbreviation *abbreviation,unsigned char **address)
+typedef struct
 {
-  unsigned long int attribute_name, attribute_form;
-  DwarfyAttributeSpec *spec;
-  DwarfyAttributeSpec *tail;
-  tail = 0;
-  LIST_INIT(&abbreviation->specs);
-  for(;;)
-  {
-    attribute_name = dwarfy_consume_unsigned_LEB128(address);
-    attribute_form = dwarfy_consume_unsigned_LEB128(address);
-    if(attribute_name == 0 && attribute_form == 0)
-      return;
- 
-    spec = malloc(sizeof(DwarfyAttributeSpec));
-    spec->name = attribute_name;
-    spec->form = attribute_form;
-    
-    if(LIST_EMPTY(&abbreviation->specs))
-      LIST_INSERT_HEAD(&abbreviation->specs,spec,linkage);
-    else
-      LIST_INSERT_AFTER(tail,spec,linkage);
-    tail = spec;
-    
-    abbreviation->num_items++;
-  }
-}
+  DwarfyContext *context;
+  DwarfyUnitSpan *spans;
+  unsigned long int num_spans;
+  unsigned long int next_span;
+} DwarfyUnitQueue;
 
-void dwarfy_consume_line_numbers(DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+void *dwarfy_unit_thread(void *arg)
 {
-  DwarfyLineNumberHeader *line_number_header;
-  char is_stmt;
-
-  line_number_header = dwarfy_consume_line_number_header(compilation_unit,address);
-  dwarfy_execute_line_number_program(compilation_unit,line_number_header,address);
+  DwarfyUnitQueue *queue = arg;
+  unsigned long int i;
   
-  return;
+  while((i = __atomic_fetch_add(&queue->next_span,1,__ATOMIC_RELAXED)) < queue->num_spans)
+  {
+    if(!queue->spans[i].indexed)
+      queue->spans[i].unreadable = 0 == (queue->spans[i].compilation_unit = dwarfy_consume_compilation_unit(queue->context,&queue->spans[i]));
+  }
+  
+  return 0;
 }
 
-DwarfyLineNumberHeader *dwarfy_consume_line_number_header(DwarfyCompilationUnit *compilation_unit,unsigned char **address)
-{
-  DwarfyLineNumberHeader *line_number_header, *result;
-  char *string;
-  unsigned char *instruction_pointer;
-  unsigned long int index,modification,length;
+/* the second pass parses the DIEs and line number programs of the units the range index does not cover, on
+   context->num_threads threads; the units are then listed in the order the serial loader always used (last unit first) */
 
-  line_number_header = (DwarfyLineNumberHeader*)*address;
+void dwarfy_consume_compilation_units(DwarfyContext *context,DWARF_DATA *dwarf)
+{
+  DwarfyUnitQueue queue;
+  pthread_t threads[DWARFY_MAX_NUM_LOAD_THREADS];
+  unsigned long int num_unindexed;
+  int num_threads;
+  int num_started;
+  unsigned long int i;
   
-  *address = ((unsigned char*)(line_number_header + 1)) + 12;
-  while(**address != '\0')
+  queue.context = context;
+  queue.spans = dwarf->units;
+  queue.num_spans = dwarf->num_units;
+  queue.next_span = 0;
+  
+  num_unindexed = 0;
+  for(i = 0; i < dwarf->num_units; i++)
+    num_unindexed += !dwarf->units[i].indexed;
+  
+  num_threads = context->num_threads;
+  if(num_threads > num_unindexed)
+    num_threads = num_unindexed;
+  if(num_threads > DWARFY_MAX_NUM_LOAD_THREADS)
+    num_threads = DWARFY_MAX_NUM_LOAD_THREADS;
+  
+  for(num_started = 0; num_started < num_threads - 1; num_started++)
   {
-    compilation_unit->num_include_paths++;
-    compilation_unit->include_paths[compilation_unit->num_include_paths - 1] = malloc(strlen((char*)(*address)) + 1);
-    strcpy(compilation_unit->include_paths[compilation_unit->num_include_paths - 1],(char*)(*address));
-    *address += strlen((char*)(*address)) + 1;
+    if(pthread_create(&threads[num_started],0,dwarfy_unit_thread,&queue))
+      break;
   }
-  (*address)++;
+  dwarfy_unit_thread(&queue);
+  for(i = 0; i < num_started; i++)
+    pthread_join(threads[i],0);
   
-  while(**address != '\0')
+  for(i = 0; i < dwarf->num_units; i++)
   {
-    compilation_unit->num_file_names++;
-    compilation_unit->file_names[compilation_unit->num_file_names - 1] = malloc(strlen((char*)(*address)) + 1);
-    strcpy(compilation_unit->file_names[compilation_unit->num_file_names - 1],(char*)(*address));
-    *address += strlen((char*)(*address)) + 1;
-    index = dwarfy_consume_unsigned_LEB128(address);
-    compilation_unit->directory_indices[compilation_unit->num_file_names - 1] = index;
-    modification = dwarfy_consume_unsigned_LEB128(address);
-    length = dwarfy_consume_unsigned_LEB128(address);
+    if(!dwarf->units[i].indexed && dwarf->units[i].compilation_unit)
+      LIST_INSERT_HEAD(&dwarf->compilation_units,dwarf->units[i].compilation_unit,linkage);
   }
-  (*address)++;
+}
 
+/* a unit the range index covers, parsed the first time it is needed */
 
-  instruction_pointer = ((unsigned char*)(&line_number_header->minimum_instruction_length)) + line_number_header->header_length;
-  result = malloc(sizeof(DwarfyLineNumberHeader));// (DwarfyLineNumberHeader*)*address;
-  memcpy(result,line_number_header,sizeof(DwarfyLineNumberHeader));
-  
-  return result;
-  
+void dwarfy_lock_lazy()
+{
+  pthread_rwlock_wrlock(&DWARFY_FORK_LOCK);
+  pthread_mutex_lock(&DWARFY_SOURCE_CODE_LOCK);
+  pthread_mutex_lock(&DWARFY_STRINGS_LOCK);
 }
 
-void dwarfy_init_line_number_state_machine(DwarfyLineNumberStateMachine *state_machine,DwarfyLineNumberHeader* line_number_header)
+void dwarfy_unlock_lazy()
 {
-  state_machine->address = 0;
-  state_machine->file = 1;
-  state_machine->line = 1;
-  state_machine->column = 0;
-  state_machine->is_stmt = line_number_header->default_is_stmt;
+  pthread_mutex_unlock(&DWARFY_STRINGS_LOCK);
+  pthread_mutex_unlock(&DWARFY_SOURCE_CODE_LOCK);
+  pthread_rwlock_unlock(&DWARFY_FORK_LOCK);
+}
+
+void dwarfy_register_fork_handlers()
+{
+  pthread_atfork(dwarfy_lock_lazy,dwarfy_unlock_lazy,dwarfy_unlock_lazy);
+}
+
+DwarfyCompilationUnit *dwarfy_compilation_unit(DWARF_DATA *dwarf,unsigned long int unit)
+{
+  DwarfyCompilationUnit *compilation_unit;
+  
+  if((compilation_unit = __atomic_load_n(&dwarf->units[unit].compilation_unit,__ATOMIC_ACQUIRE)) ||
+     __atomic_load_n(&dwarf->units[unit].unreadable,__ATOMIC_RELAXED))
+    return compilation_unit;
+  
+  /* units of different objects are parsed concurrently; those of one object one at a time */
+  pthread_rwlock_rdlock(&DWARFY_FORK_LOCK);
+  pthread_mutex_lock(&dwarf->lazy_lock);
+  if(0 == (compilation_unit = dwarf->units[unit].compilation_unit) && !dwarf->units[unit].unreadable)
+  {
+    if((compilation_unit = dwarfy_consume_compilation_unit(&dwarf->context,&dwarf->units[unit])))
+      __atomic_store_n(&dwarf->units[unit].compilation_unit,compilation_unit,__ATOMIC_RELEASE);
+    else
+      __atomic_store_n(&dwarf->units[unit].unreadable,1,__ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&dwarf->lazy_lock);
+  pthread_rwlock_unlock(&DWARFY_FORK_LOCK);
+  
+  return compilation_unit;
+}
+
+int dwarfy_compare_address_ranges(const void *r1,const void *r2)
+{
+  unsigned long int l1 = ((DwarfyAddressRange*)r1)->low;
+  unsigned long int l2 = ((DwarfyAddressRange*)r2)->low;
+  
+  return (l1 > l2) - (l1 < l2);
+}
+
+/* the unit that starts at a .debug_info offset, or -1 */
+
+long int dwarfy_find_unit(DWARF_DATA *dwarf,unsigned long int offset)
+{
+  unsigned long int low,high,middle;
+  
+  low = 0;
+  high = dwarf->num_units;
+  while(low < high)
+  {
+    middle = (low + high) / 2;
+    if(dwarf->units[middle].offset < offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  
+  return (low < dwarf->num_units && dwarf->units[low].offset == offset) ? low : -1;
+}
+
+void dwarfy_add_address_range(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges,unsigned long int low,unsigned long int high,unsigned long int unit)
+{
+  if(high <= low)
+    return;
+  
+  if(dwarf->num_ranges == *max_num_ranges)
+  {
+    *max_num_ranges = *max_num_ranges ? *max_num_ranges * 2 : 64;
+    dwarf->ranges = realloc(dwarf->ranges,*max_num_ranges * sizeof(DwarfyAddressRange));
+  }
+  dwarf->ranges[dwarf->num_ranges].low = low - context->elf_base_address + context->elf_runtime_address;
+  dwarf->ranges[dwarf->num_ranges].high = high - context->elf_base_address + context->elf_runtime_address;
+  dwarf->ranges[dwarf->num_ranges].unit = unit;
+  dwarf->num_ranges++;
+  dwarf->units[unit].indexed = 1;
+}
+
+/* .debug_aranges: per unit, a set of (address,length) tuples aligned to twice the address size */
+
+void dwarfy_index_aranges(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges)
+{
+  unsigned char *address;
+  unsigned char *end;
+  unsigned char *set_end;
+  unsigned char *tuple;
+  unsigned int unit_length;
+  unsigned int debug_info_offset;
+  unsigned char address_size;
+  unsigned long int start,length;
+  long int unit;
+  
+  address = context->debug_aranges;
+  end = context->debug_aranges + context->debug_aranges_size;
+  
+  while(address + 12 <= end)
+  {
+    unit_length = *((unsigned int*)address);
+    if(unit_length == 0xffffffff) /* 64-bit DWARF */
+      return;
+    set_end = address + 4 + unit_length;
+    if(set_end > end)
+      return;
+    debug_info_offset = *((unsigned int*)(address + 6));
+    address_size = address[10];
+    
+    if(address_size == DWARFY_ARCHITECTURE_ADDRESS_SIZE && (unit = dwarfy_find_unit(dwarf,debug_info_offset)) != -1)
+    {
+      for(tuple = address + 16; tuple + 16 <= set_end; tuple += 16)
+      {
+        start = *((unsigned long int*)tuple);
+        length = *((unsigned long int*)(tuple + 8));
+        if(start == 0 && length == 0)
+          break;
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,start,start + length,unit);
+      }
+    }
+    
+    address = set_end;
+  }
+}
+
+/* for a unit .debug_aranges leaves out, the unit DIE's DW_AT_low_pc/DW_AT_high_pc or DW_AT_ranges. the DIE is read
+   whole before any value is used, as DWARF 5's indexed forms depend on base attributes that may come after them */
+
+void dwarfy_index_unit_DIE(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges,unsigned long int unit)
+{
+  DwarfyContext unit_context;
+  DwarfyAbbreviationSet *set;
+  DwarfyAttributeSpec *spec;
+  unsigned char *address;
+  unsigned char *entry;
+  unsigned long int abbreviation_code;
+  unsigned long int form;
+  unsigned long int value;
+  unsigned long int low_pc,high_pc,ranges_offset,base,begin,end;
+  unsigned long int low_pc_form,high_pc_form,ranges_form;
+  int has_low_pc,has_high_pc,has_ranges;
+  
+  unit_context = *context;
+  unit_context.addr_base = 8;
+  unit_context.rnglists_base = 12;
+  
+  set = dwarf->units[unit].abbreviations;
+  address = context->debug_info + dwarf->units[unit].first_DIE;
+  abbreviation_code = dwarfy_consume_unsigned_LEB128(&address);
+  if(abbreviation_code == 0 || abbreviation_code >= set->num_codes || set->abbreviations[abbreviation_code].code == 0)
+    return;
+  
+  has_low_pc = has_high_pc = has_ranges = 0;
+  low_pc = high_pc = ranges_offset = 0;
+  low_pc_form = high_pc_form = ranges_form = 0;
+  for(spec = set->abbreviations[abbreviation_code].specs; spec < set->abbreviations[abbreviation_code].specs + set->abbreviations[abbreviation_code].num_items; spec++)
+  {
+    form = spec->form;
+    if(spec->name != DW_AT_low_pc && spec->name != DW_AT_high_pc && spec->name != DW_AT_ranges && spec->name != DW_AT_addr_base && spec->name != DW_AT_rnglists_base)
+    {
+      if(dwarfy_skip_form(&address,form))
+        return;
+      continue;
+    }
+    
+    if(form == DW_FORM_addr) /* all other forms dwarfy_consume_form_value() reads; the indexed ones give the index */
+    {
+      value = *((unsigned long int*)address);
+      address += DWARFY_ARCHITECTURE_ADDRESS_SIZE;
+    }
+    else
+      value = form == DW_FORM_implicit_const ? spec->implicit_const : dwarfy_consume_form_value(&address,form);
+    
+    switch(spec->name)
+    {
+      case DW_AT_low_pc:
+        low_pc = value;
+        low_pc_form = form;
+        has_low_pc = 1;
+        break;
+      case DW_AT_high_pc:
+        high_pc = value;
+        high_pc_form = form;
+        has_high_pc = 1;
+        break;
+      case DW_AT_ranges:
+        ranges_offset = value;
+        ranges_form = form;
+        has_ranges = 1;
+        break;
+      case DW_AT_addr_base:
+        unit_context.addr_base = value;
+        break;
+      case DW_AT_rnglists_base:
+        unit_context.rnglists_base = value;
+        break;
+    }
+  }
+  
+  if(has_low_pc && dwarfy_form_is_address_index(low_pc_form))
+    low_pc = dwarfy_indexed_address(&unit_context,low_pc);
+  
+  if(has_ranges && dwarf->units[unit].version >= 5)
+  {
+    /* DW_FORM_rnglistx indexes the offsets that follow the unit's .debug_rnglists header; they count from there */
+    if(ranges_form == DW_FORM_rnglistx)
+    {
+      if(!context->debug_rnglists || unit_context.rnglists_base + (ranges_offset + 1) * 4 > context->debug_rnglists_size)
+        return;
+      ranges_offset = unit_context.rnglists_base + *((unsigned int*)(context->debug_rnglists + unit_context.rnglists_base + ranges_offset * 4));
+    }
+    dwarfy_index_rnglist(&unit_context,dwarf,max_num_ranges,ranges_offset,low_pc,unit);
+  }
+  else if(has_ranges && context->debug_ranges && ranges_offset < context->debug_ranges_size)
+  {
+    /* pairs of offsets from the base address (the unit's low_pc unless a base address selection entry says otherwise) */
+    base = low_pc;
+    for(entry = context->debug_ranges + ranges_offset; entry + 16 <= context->debug_ranges + context->debug_ranges_size; entry += 16)
+    {
+      begin = *((unsigned long int*)entry);
+      end = *((unsigned long int*)(entry + 8));
+      if(begin == 0 && end == 0)
+        break;
+      if(begin == 0xffffffffffffffff)
+        base = end;
+      else
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,base + begin,base + end,unit);
+    }
+  }
+  else if(has_low_pc && has_high_pc)
+  {
+    if(dwarfy_form_is_address_index(high_pc_form))
+      high_pc = dwarfy_indexed_address(&unit_context,high_pc);
+    else if(high_pc_form != DW_FORM_addr) /* a constant: the length */
+      high_pc += low_pc;
+    dwarfy_add_address_range(context,dwarf,max_num_ranges,low_pc,high_pc,unit);
+  }
+}
+
+/* a DWARF 5 range list in .debug_rnglists: entries of a kind byte and operands, some of them indexes into .debug_addr */
+
+void dwarfy_index_rnglist(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges,unsigned long int offset,unsigned long int base,unsigned long int unit)
+{
+  unsigned char *entry;
+  unsigned char *end;
+  unsigned long int begin,length;
+  
+  if(!context->debug_rnglists || offset >= context->debug_rnglists_size)
+    return;
+  
+  end = context->debug_rnglists + context->debug_rnglists_size;
+  for(entry = context->debug_rnglists + offset; entry < end;)
+  {
+    switch(*entry++)
+    {
+      case DW_RLE_end_of_list:
+        return;
+      case DW_RLE_base_addressx:
+        base = dwarfy_indexed_address(context,dwarfy_consume_unsigned_LEB128(&entry));
+        break;
+      case DW_RLE_startx_endx:
+        begin = dwarfy_indexed_address(context,dwarfy_consume_unsigned_LEB128(&entry));
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,begin,dwarfy_indexed_address(context,dwarfy_consume_unsigned_LEB128(&entry)),unit);
+        break;
+      case DW_RLE_startx_length:
+        begin = dwarfy_indexed_address(context,dwarfy_consume_unsigned_LEB128(&entry));
+        length = dwarfy_consume_unsigned_LEB128(&entry);
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,begin,begin + length,unit);
+        break;
+      case DW_RLE_offset_pair:
+        begin = dwarfy_consume_unsigned_LEB128(&entry);
+        length = dwarfy_consume_unsigned_LEB128(&entry); /* the end offset */
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,base + begin,base + length,unit);
+        break;
+      case DW_RLE_base_address:
+        base = *((unsigned long int*)entry);
+        entry += 8;
+        break;
+      case DW_RLE_start_end:
+        begin = *((unsigned long int*)entry);
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,begin,*((unsigned long int*)(entry + 8)),unit);
+        entry += 16;
+        break;
+      case DW_RLE_start_length:
+        begin = *((unsigned long int*)entry);
+        entry += 8;
+        length = dwarfy_consume_unsigned_LEB128(&entry);
+        dwarfy_add_address_range(context,dwarf,max_num_ranges,begin,begin + length,unit);
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+/* .gdb_index (version 7 and on): its address area maps ranges of addresses straight to units in its CU list */
+
+void dwarfy_index_gdb_index(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges)
+{
+  unsigned char *compilation_units;
+  unsigned char *entry;
+  unsigned char *end;
+  unsigned int *header;
+  unsigned long int num_compilation_units;
+  unsigned int compilation_unit_index;
+  long int unit;
+  
+  header = (unsigned int*)context->gdb_index;
+  if(context->gdb_index_size < 24 || header[0] < 7 || header[4] > context->gdb_index_size || header[1] > header[2] || header[3] > header[4])
+    return;
+  
+  compilation_units = context->gdb_index + header[1];
+  num_compilation_units = (header[2] - header[1]) / 16; /* (offset,length) pairs */
+  end = context->gdb_index + header[4];
+  
+  for(entry = context->gdb_index + header[3]; entry + 20 <= end; entry += 20) /* low, high, CU index */
+  {
+    compilation_unit_index = *((unsigned int*)(entry + 16));
+    if(compilation_unit_index < num_compilation_units && (unit = dwarfy_find_unit(dwarf,*((unsigned long int*)(compilation_units + compilation_unit_index * 16)))) != -1)
+      dwarfy_add_address_range(context,dwarf,max_num_ranges,*((unsigned long int*)entry),*((unsigned long int*)(entry + 8)),unit);
+  }
+}
+
+/* .debug_names: every name table in the section (one per object when the linker does not merge them) lists the DIEs
+   of the units it covers; the subprograms' are collected, sorted by unit and offset, and handed to the units */
+
+void dwarfy_index_debug_names(DwarfyContext *context,DWARF_DATA *dwarf)
+{
+  unsigned long int *function_DIEs;
+  unsigned long int num_function_DIEs,max_num_function_DIEs;
+  unsigned long int i,j;
+  unsigned char *address;
+  
+  function_DIEs = 0;
+  num_function_DIEs = max_num_function_DIEs = 0;
+  
+  for(address = context->debug_names; address && address + 36 <= context->debug_names + context->debug_names_size;)
+    address = dwarfy_index_name_table(context,dwarf,address,&function_DIEs,&num_function_DIEs,&max_num_function_DIEs);
+  
+  /* pairs of (unit, offset); a DIE listed under several names is kept once */
+  qsort(function_DIEs,num_function_DIEs,2 * sizeof(unsigned long int),dwarfy_compare_function_DIEs);
+  for(i = 0, j = 0; i < num_function_DIEs; i++)
+  {
+    if(j && function_DIEs[2 * (j - 1)] == function_DIEs[2 * i] && function_DIEs[2 * (j - 1) + 1] == function_DIEs[2 * i + 1])
+      continue;
+    function_DIEs[2 * j] = function_DIEs[2 * i];
+    function_DIEs[2 * j + 1] = function_DIEs[2 * i + 1];
+    j++;
+  }
+  num_function_DIEs = j;
+  
+  /* the offsets move to the front, each unit's run of them in order */
+  for(i = 0; i < num_function_DIEs; i++)
+  {
+    if(dwarf->units[function_DIEs[2 * i]].num_function_DIEs++ == 0)
+      dwarf->units[function_DIEs[2 * i]].function_DIEs = function_DIEs + i;
+    function_DIEs[i] = function_DIEs[2 * i + 1];
+  }
+}
+
+/* one name table; returns where the next one starts, or 0 if this one cannot be read */
+
+unsigned char *dwarfy_index_name_table(DwarfyContext *context,DWARF_DATA *dwarf,unsigned char *address,unsigned long int **function_DIEs,unsigned long int *num_function_DIEs,unsigned long int *max_num_function_DIEs)
+{
+  DwarfyAbbreviation *abbreviations;
+  DwarfyAbbreviation abbreviation;
+  DwarfyAttributeSpec *spec;
+  unsigned char *end;
+  unsigned char *compilation_units;
+  unsigned char *entry_offsets;
+  unsigned char *abbreviation_table;
+  unsigned char *entry_pool;
+  unsigned char *entry;
+  unsigned int num_compilation_units,num_local_type_units,num_foreign_type_units,num_buckets,num_names;
+  unsigned int abbreviation_table_size,augmentation_string_size;
+  unsigned long int num_abbreviations;
+  unsigned long int code;
+  unsigned long int compilation_unit_index,DIE_offset;
+  unsigned long int value;
+  unsigned long int i,k;
+  long int unit;
+  
+  if(*((unsigned int*)address) == 0xffffffff) /* 64-bit DWARF */
+    return 0;
+  end = address + 4 + *((unsigned int*)address);
+  if(end > context->debug_names + context->debug_names_size || *((unsigned short*)(address + 4)) != 5)
+    return 0;
+  
+  num_compilation_units = *((unsigned int*)(address + 8));
+  num_local_type_units = *((unsigned int*)(address + 12));
+  num_foreign_type_units = *((unsigned int*)(address + 16));
+  num_buckets = *((unsigned int*)(address + 20));
+  num_names = *((unsigned int*)(address + 24));
+  abbreviation_table_size = *((unsigned int*)(address + 28));
+  augmentation_string_size = *((unsigned int*)(address + 32));
+  
+  compilation_units = address + 36 + augmentation_string_size;
+  entry_offsets = compilation_units + 4 * num_compilation_units + 4 * num_local_type_units + 8 * num_foreign_type_units
+                + 4 * num_buckets + (num_buckets ? 4 * num_names : 0) + 4 * num_names; /* past the hash table and string offsets */
+  abbreviation_table = entry_offsets + 4 * num_names;
+  entry_pool = abbreviation_table + abbreviation_table_size;
+  if(entry_pool > end)
+    return 0;
+  
+  /* the units this table covers are read through it, whether or not they define any functions */
+  for(i = 0; i < num_compilation_units; i++)
+  {
+    if((unit = dwarfy_find_unit(dwarf,*((unsigned int*)(compilation_units + 4 * i)))) != -1)
+      dwarf->units[unit].named = 1;
+  }
+  
+  abbreviations = 0;
+  num_abbreviations = 0;
+  for(address = abbreviation_table; address < entry_pool && (abbreviation.code = dwarfy_consume_unsigned_LEB128(&address));)
+  {
+    /* laid out like a DIE abbreviation, without the children flag, and with index attributes */
+    abbreviation.tag = dwarfy_consume_unsigned_LEB128(&address);
+    abbreviation.num_items = 0;
+    dwarfy_consume_abbreviation_attribute_specs(&abbreviation,&address);
+    free(abbreviation.steps);
+    abbreviations = realloc(abbreviations,(num_abbreviations + 1) * sizeof(DwarfyAbbreviation));
+    abbreviations[num_abbreviations++] = abbreviation;
+  }
+  
+  for(i = 0; i < num_names; i++)
+  {
+    for(entry = entry_pool + *((unsigned int*)(entry_offsets + 4 * i)); entry < end && (code = dwarfy_consume_unsigned_LEB128(&entry));)
+    {
+      for(k = 0; k < num_abbreviations && abbreviations[k].code != code; k++);
+      if(k == num_abbreviations)
+        break;
+      
+      compilation_unit_index = num_compilation_units == 1 ? 0 : -1;
+      DIE_offset = -1;
+      for(spec = abbreviations[k].specs; spec < abbreviations[k].specs + abbreviations[k].num_items; spec++)
+      {
+        value = spec->form == DW_FORM_implicit_const ? spec->implicit_const : dwarfy_consume_form_value(&entry,spec->form);
+        if(spec->name == DW_IDX_compile_unit)
+          compilation_unit_index = value;
+        else if(spec->name == DW_IDX_type_unit)
+          compilation_unit_index = -1;
+        else if(spec->name == DW_IDX_die_offset)
+          DIE_offset = value;
+      }
+      
+      if(abbreviations[k].tag != DW_TAG_subprogram || compilation_unit_index >= num_compilation_units || DIE_offset == -1)
+        continue;
+      if((unit = dwarfy_find_unit(dwarf,*((unsigned int*)(compilation_units + 4 * compilation_unit_index)))) == -1)
+        continue;
+      
+      if(*num_function_DIEs == *max_num_function_DIEs)
+      {
+        *max_num_function_DIEs = *max_num_function_DIEs ? *max_num_function_DIEs * 2 : 256;
+        *function_DIEs = realloc(*function_DIEs,*max_num_function_DIEs * 2 * sizeof(unsigned long int));
+      }
+      (*function_DIEs)[2 * *num_function_DIEs] = unit;
+      (*function_DIEs)[2 * *num_function_DIEs + 1] = DIE_offset;
+      (*num_function_DIEs)++;
+    }
+  }
+  
+  for(k = 0; k < num_abbreviations; k++)
+    free(abbreviations[k].specs);
+  free(abbreviations);
+  
+  return end;
+}
+
+int dwarfy_compare_function_DIEs(const void *d1,const void *d2)
+{
+  const unsigned long int *p1 = d1;
+  const unsigned long int *p2 = d2;
+  
+  if(p1[0] != p2[0])
+    return (p1[0] > p2[0]) - (p1[0] < p2[0]);
+  return (p1[1] > p2[1]) - (p1[1] < p2[1]);
+}
+
+/* build the address-to-unit index, from .debug_aranges where it covers a unit and from the unit DIE otherwise */
+
+void dwarfy_index_compilation_units(DwarfyContext *context,DWARF_DATA *dwarf)
+{
+  unsigned long int max_num_ranges;
+  unsigned long int i;
+  
+  dwarf->ranges = 0;
+  dwarf->num_ranges = 0;
+  max_num_ranges = 0;
+  
+  if(context->gdb_index)
+    dwarfy_index_gdb_index(context,dwarf,&max_num_ranges);
+  else if(context->debug_aranges)
+    dwarfy_index_aranges(context,dwarf,&max_num_ranges);
+  
+  for(i = 0; i < dwarf->num_units; i++)
+  {
+    if(!dwarf->units[i].indexed)
+      dwarfy_index_unit_DIE(context,dwarf,&max_num_ranges,i);
+  }
+  
+  qsort(dwarf->ranges,dwarf->num_ranges,sizeof(DwarfyAddressRange),dwarfy_compare_address_ranges);
+}
+
+
+/* walk the unit's DIEs in order without building a tree of them: nesting does not matter to the symbolizer, so a null
+   entry that ends a list of siblings is simply stepped over. each DIE is walked by its abbreviation's steps, and only
+   subprograms and the unit DIE itself produce anything */
+
+int dwarfy_consume_DIEs(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+{
+  unsigned char *end;
+  
+  end = context->debug_info + context->compilation_unit_end;
+  while(*address < end)
+  {
+    if(dwarfy_consume_DIE(context,compilation_unit,address))
+      return -1;
+  }
+  return 0;
+}
+
+/* for a unit .debug_names covers: the unit DIE, for the line number program and the bases, then only the subprograms
+   the index lists, each found by its offset */
+
+int dwarfy_consume_named_DIEs(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyUnitSpan *span)
+{
+  unsigned char *address;
+  unsigned long int i;
+  
+  address = context->debug_info + span->first_DIE;
+  if(dwarfy_consume_DIE(context,compilation_unit,&address))
+    return -1;
+  
+  for(i = 0; i < span->num_function_DIEs; i++)
+  {
+    address = context->debug_info + span->offset + span->function_DIEs[i];
+    if(address < context->debug_info + span->end && dwarfy_consume_DIE(context,compilation_unit,&address))
+      return -1;
+  }
+  return 0;
+}
+
+/* the DIE at address, by its abbreviation's steps; a null entry is one byte, stepped over. -1 if the DIE cannot be
+   walked, so the unit it is in is not parsed further */
+
+int dwarfy_consume_DIE(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+{
+  DwarfyAbbreviationSet *set;
+  DwarfyAbbreviation *abbreviation;
+  DwarfyAttributeStep *step;
+  DwarfyFunction *function;
+  unsigned long int abbreviation_code;
+  unsigned long int function_address;
+  char *function_name;
+  int function_name_is_inline; /* rather than in .debug_str or .debug_line_str, where it stays */
+  
+  set = compilation_unit->abbreviations;
+  
+  if(0 == (abbreviation_code = dwarfy_consume_unsigned_LEB128(address)))
+    return 0;
+  
+  compilation_unit->num_DIEs++;
+  if(abbreviation_code >= set->num_codes || 0 == (abbreviation = &set->abbreviations[abbreviation_code])->code)
+  {
+    fprintf(stderr,"[valve] DWARF error: unknown abbreviation code %lu.\n",abbreviation_code);
+    return -1;
+  }
+  
+  if(abbreviation->fixed_size >= 0)
+  {
+    (*address) += abbreviation->fixed_size;
+    return 0;
+  }
+  
+  function_address = 0;
+  function_name = 0;
+  function_name_is_inline = 0;
+  
+  for(step = abbreviation->steps; step < abbreviation->steps + abbreviation->num_steps; step++)
+  {
+    switch(step->name)
+    {
+      case 0:
+      {
+        break;
+      }
+      case DW_AT_low_pc:
+      {
+        if(step->form == DW_FORM_addr)
+        {
+          function_address = *((unsigned long int*)*address) - context->elf_base_address + context->elf_runtime_address;
+          break;
+        }
+        if((function_address = dwarfy_consume_address(context,address,step->form)))
+          function_address += context->elf_runtime_address - context->elf_base_address;
+        continue;
+      }
+      case DW_AT_name:
+      {
+        if(step->form == DW_FORM_strp)
+        {
+          function_name = ((char*)context->debug_str) + *((unsigned int*)*address);
+          break;
+        }
+        function_name = dwarfy_consume_string(context,address,step->form);
+        function_name_is_inline = step->form == DW_FORM_string;
+        continue;
+      }
+      case DW_AT_stmt_list:
+      {
+        context->line_number_program_offset = dwarfy_consume_form_value(address,step->form);
+        continue;
+      }
+      case DW_AT_str_offsets_base:
+      {
+        context->str_offsets_base = dwarfy_consume_form_value(address,step->form);
+        continue;
+      }
+      case DW_AT_addr_base:
+      {
+        context->addr_base = dwarfy_consume_form_value(address,step->form);
+        continue;
+      }
+    }
+    
+    if(step->size >= 0)
+      (*address) += step->size;
+    else if(step->num_LEB128s)
+      dwarfy_skip_LEB128s(address,step->num_LEB128s);
+    else if(dwarfy_skip_form(address,step->form))
+      return -1;
+  }
+  
+  if(abbreviation->tag == DW_TAG_subprogram && function_address) /* declarations have no code */
+  {
+    function = malloc(sizeof(DwarfyFunction));
+    function->address = function_address;
+    if(function_name == 0)
+      function->name = "";
+    else if(function_name_is_inline)
+      function->name = dwarfy_intern(function_name);
+    else
+      function->name = function_name;
+    RB_INSERT(DwarfyFunctionTree,&compilation_unit->functions,function);
+  }
+  return 0;
+}
+
+/* the attributes the DIE walker reads, by tag */
+
+int dwarfy_attribute_is_read(unsigned long int tag,unsigned long int name)
+{
+  if(tag == DW_TAG_subprogram)
+    return name == DW_AT_low_pc || name == DW_AT_name;
+  if(tag == DW_TAG_compile_unit || tag == DW_TAG_skeleton_unit) /* a split unit's skeleton keeps its line table */
+    return name == DW_AT_stmt_list || name == DW_AT_str_offsets_base || name == DW_AT_addr_base;
+  return 0;
+}
+
+/* the size of a value of a form, or -1 if it has to be read to be known */
+
+long int dwarfy_form_size(unsigned long int form)
+{
+  switch(form)
+  {
+    case DW_FORM_flag_present:
+    case DW_FORM_implicit_const:
+      return 0;
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_flag:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+      return 1;
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+      return 2;
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+      return 3;
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_addr: /* an offset from version 3 on */
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_strp_sup:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+      return 4;
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+    case DW_FORM_addr:
+      return 8;
+    case DW_FORM_data16:
+      return 16;
+    default:
+      return -1;
+  }
+}
+
+/* step over an attribute value; returns -1 for a form dwarfy does not know */
+
+int dwarfy_skip_form(unsigned char **address,unsigned long int form)
+{
+  unsigned long int size;
+  
+  if((long int)(size = dwarfy_form_size(form)) >= 0)
+  {
+    (*address) += size;
+    return 0;
+  }
+  
+  switch(form)
+  {
+    case DW_FORM_sdata:
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    {
+      dwarfy_skip_LEB128s(address,1);
+      break;
+    }
+    case DW_FORM_string:
+    {
+      (*address) += strlen((char*)*address) + 1;
+      break;
+    }
+    case DW_FORM_exprloc:
+    case DW_FORM_block:
+    {
+      size = dwarfy_consume_unsigned_LEB128(address);
+      (*address) += size;
+      break;
+    }
+    case DW_FORM_block1:
+    {
+      size = **address;
+      (*address) += size + 1;
+      break;
+    }
+    case DW_FORM_block2:
+    {
+      size = *((unsigned short*)*address);
+      (*address) += size + 2;
+      break;
+    }
+    case DW_FORM_block4:
+    {
+      size = *((unsigned int*)*address);
+      (*address) += size + 4;
+      break;
+    }
+    case DW_FORM_indirect:
+    {
+      form = dwarfy_consume_unsigned_LEB128(address);
+      return form == DW_FORM_indirect ? -1 : dwarfy_skip_form(address,form);
+    }
+    default:
+    {
+      return -1;
+    }
+  }
+  
+  return 0;
+}
+
+/* read a constant, address or section offset attribute value, stepping over it. for the DWARF 5 indexed forms
+   (DW_FORM_strx*, DW_FORM_addrx*, DW_FORM_rnglistx, DW_FORM_loclistx) the value is the index */
+
+unsigned long int dwarfy_consume_form_value(unsigned char **address,unsigned long int form)
+{
+  unsigned long int value;
+  
+  switch(form)
+  {
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+    {
+      value = **address;
+      break;
+    }
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+    {
+      value = *((unsigned short*)*address);
+      break;
+    }
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+    {
+      value = (*address)[0] | ((*address)[1] << 8) | ((*address)[2] << 16);
+      break;
+    }
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp:
+    case DW_FORM_line_strp:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+    {
+      value = *((unsigned int*)*address);
+      break;
+    }
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_addr:
+    {
+      value = *((unsigned long int*)*address);
+      break;
+    }
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_loclistx:
+    {
+      return dwarfy_consume_unsigned_LEB128(address);
+    }
+    default:
+    {
+      dwarfy_skip_form(address,form);
+      return 0;
+    }
+  }
+  
+  dwarfy_skip_form(address,form);
+  return value;
+}
+
+int dwarfy_form_is_address_index(unsigned long int form)
+{
+  return form == DW_FORM_addrx || (form >= DW_FORM_addrx1 && form <= DW_FORM_addrx4);
+}
+
+/* the address at an index in the unit's .debug_addr contribution, or 0 */
+
+unsigned long int dwarfy_indexed_address(DwarfyContext *context,unsigned long int index)
+{
+  unsigned long int offset;
+  
+  offset = context->addr_base + index * DWARFY_ARCHITECTURE_ADDRESS_SIZE;
+  if(!context->debug_addr || offset + DWARFY_ARCHITECTURE_ADDRESS_SIZE > context->debug_addr_size)
+    return 0;
+  
+  return *((unsigned long int*)(context->debug_addr + offset));
+}
+
+/* an address attribute value, given directly or as an index into .debug_addr; link-time, 0 if unknown */
+
+unsigned long int dwarfy_consume_address(DwarfyContext *context,unsigned char **address,unsigned long int form)
+{
+  if(form == DW_FORM_addr)
+    return dwarfy_consume_form_value(address,form);
+  if(dwarfy_form_is_address_index(form))
+    return dwarfy_indexed_address(context,dwarfy_consume_form_value(address,form));
+  
+  dwarfy_skip_form(address,form);
+  return 0;
+}
+
+/* a string attribute value wherever its form keeps it: inline, in .debug_str or .debug_line_str, or through the
+   unit's .debug_str_offsets contribution. 0 for a form that is not a string's */
+
+char *dwarfy_consume_string(DwarfyContext *context,unsigned char **address,unsigned long int form)
+{
+  unsigned long int offset;
+  char *string;
+  
+  switch(form)
+  {
+    case DW_FORM_string:
+    {
+      string = (char*)*address;
+      (*address) += strlen(string) + 1;
+      return string;
+    }
+    case DW_FORM_strp:
+    {
+      return (char*)context->debug_str + dwarfy_consume_form_value(address,form);
+    }
+    case DW_FORM_line_strp:
+    {
+      offset = dwarfy_consume_form_value(address,form);
+      return context->debug_line_str ? (char*)context->debug_line_str + offset : 0;
+    }
+    case DW_FORM_strx:
+    case DW_FORM_strx1:
+    case DW_FORM_strx2:
+    case DW_FORM_strx3:
+    case DW_FORM_strx4:
+    {
+      offset = context->str_offsets_base + dwarfy_consume_form_value(address,form) * 4;
+      if(!context->debug_str_offsets || offset + 4 > context->debug_str_offsets_size)
+        return 0;
+      return (char*)context->debug_str + *((unsigned int*)(context->debug_str_offsets + offset));
+    }
+    default:
+    {
+      dwarfy_skip_form(address,form);
+      return 0;
+    }
+  }
+}
+
+/* the set at an offset in .debug_abbrev, parsed the first time a unit asks for it. sets is kept sorted by offset */
+
+DwarfyAbbreviationSet *dwarfy_abbreviation_set(DwarfyContext *context,DwarfyAbbreviationSet ***sets,unsigned long int *num_sets,unsigned long int offset)
+{
+  DwarfyAbbreviationSet *set;
+  unsigned long int low,high,middle;
+  
+  /* units usually come in the order of their sets */
+  if(*num_sets && (*sets)[*num_sets - 1]->offset == offset)
+    return (*sets)[*num_sets - 1];
+  
+  low = 0;
+  high = *num_sets;
+  while(low < high)
+  {
+    middle = (low + high) / 2;
+    if((*sets)[middle]->offset < offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  if(low < *num_sets && (*sets)[low]->offset == offset)
+    return (*sets)[low];
+  
+  set = dwarfy_consume_abbreviations(context->debug_abbrev + offset,offset);
+  
+  if((*num_sets & (*num_sets - 1)) == 0)
+    *sets = realloc(*sets,(*num_sets ? *num_sets * 2 : 1) * sizeof(DwarfyAbbreviationSet*));
+  memmove(*sets + low + 1,*sets + low,(*num_sets - low) * sizeof(DwarfyAbbreviationSet*));
+  (*sets)[low] = set;
+  (*num_sets)++;
+  
+  return set;
+}
+
+DwarfyAbbreviationSet *dwarfy_consume_abbreviations(unsigned char *address,unsigned long int offset)
+{
+  DwarfyAbbreviationSet *set;
+  DwarfyAbbreviation abbreviation;
+  unsigned long int num_codes;
+  
+  set = malloc(sizeof(DwarfyAbbreviationSet));
+  set->offset = offset;
+  set->abbreviations = 0;
+  set->num_codes = 0;
+  
+  while(dwarfy_consume_abbreviation_header(&abbreviation,&address))
+  {
+    dwarfy_consume_abbreviation_attribute_specs(&abbreviation,&address);
+    
+    if(abbreviation.code >= set->num_codes)
+    {
+      for(num_codes = set->num_codes ? set->num_codes : 64; num_codes <= abbreviation.code; num_codes *= 2);
+      set->abbreviations = realloc(set->abbreviations,num_codes * sizeof(DwarfyAbbreviation));
+      memset(set->abbreviations + set->num_codes,0,(num_codes - set->num_codes) * sizeof(DwarfyAbbreviation));
+      set->num_codes = num_codes;
+    }
+    set->abbreviations[abbreviation.code] = abbreviation;
+  }
+  
+  return set;
+}
+
+int dwarfy_consume_abbreviation_header(DwarfyAbbreviation *abbreviation,unsigned char **address)
+{
+  unsigned long int abbreviation_code;
+  unsigned long int tag;
+ 
+  abbreviation_code = dwarfy_consume_unsigned_LEB128(address);
+  
+  if(abbreviation_code == 0)
+    return 0;
+  
+  abbreviation->code = abbreviation_code;
+   
+  tag = dwarfy_consume_unsigned_LEB128(address);
+  abbreviation->tag = tag;
+  
+  if(**address == DW_CHILDREN_yes)
+  {
+    abbreviation->has_children = 1;
+  }
+  else if(**address == DW_CHILDREN_no)
+  {
+    abbreviation->has_children = 0;
+  }
+  
+  abbreviation->num_items = 0;
+  
+  (*address)++;
+  
+  return 1;
+}
+
+/* turn an abbreviation's attribute specs into the steps that walk a DIE of its kind: adjacent fixed-size attributes
+   the walker does not read merge into one step, as do adjacent LEB128 ones */
+
+void dwarfy_consume_abbreviation_attribute_specs(DwarfyAbbreviation *abbreviation,unsigned char **address)
+{
+  unsigned long int attribute_name, attribute_form;
+  long int implicit_const;
+  int max_num_specs;
+  int max_num_steps;
+  long int size;
+  
+  abbreviation->specs = 0;
+  max_num_specs = 0;
+  abbreviation->steps = 0;
+  abbreviation->num_steps = 0;
+  max_num_steps = 0;
+  
+  for(;;)
+  {
+    attribute_name = dwarfy_consume_unsigned_LEB128(address);
+    attribute_form = dwarfy_consume_unsigned_LEB128(address);
+    if(attribute_name == 0 && attribute_form == 0)
+      break;
+    implicit_const = attribute_form == DW_FORM_implicit_const ? dwarfy_consume_signed_LEB128(address) : 0;
+    
+    if(abbreviation->num_items == max_num_specs)
+    {
+      max_num_specs = max_num_specs ? max_num_specs * 2 : 4;
+      abbreviation->specs = realloc(abbreviation->specs,max_num_specs * sizeof(DwarfyAttributeSpec));
+    }
+    abbreviation->specs[abbreviation->num_items].name = attribute_name;
+    abbreviation->specs[abbreviation->num_items].form = attribute_form;
+    abbreviation->specs[abbreviation->num_items].implicit_const = implicit_const;
+    abbreviation->num_items++;
+    
+    size = dwarfy_form_size(attribute_form);
+    
+    if(dwarfy_attribute_is_read(abbreviation->tag,attribute_name))
+      dwarfy_add_attribute_step(abbreviation,&max_num_steps,attribute_name,attribute_form,size,implicit_const);
+    else if(attribute_form == DW_FORM_udata || attribute_form == DW_FORM_sdata)
+    {
+      if(!(abbreviation->num_steps && abbreviation->steps[abbreviation->num_steps - 1].name == 0 && abbreviation->steps[abbreviation->num_steps - 1].num_LEB128s))
+        dwarfy_add_attribute_step(abbreviation,&max_num_steps,0,attribute_form,size,0);
+      abbreviation->steps[abbreviation->num_steps - 1].num_LEB128s++;
+    }
+    else if(size < 0)
+      dwarfy_add_attribute_step(abbreviation,&max_num_steps,0,attribute_form,size,0);
+    else if(abbreviation->num_steps && abbreviation->steps[abbreviation->num_steps - 1].name == 0 && abbreviation->steps[abbreviation->num_steps - 1].size >= 0)
+      abbreviation->steps[abbreviation->num_steps - 1].size += size;
+    else
+      dwarfy_add_attribute_step(abbreviation,&max_num_steps,0,attribute_form,size,0);
+  }
+  
+  if(abbreviation->num_steps == 0)
+    abbreviation->fixed_size = 0;
+  else if(abbreviation->num_steps == 1 && abbreviation->steps[0].name == 0 && abbreviation->steps[0].size >= 0)
+    abbreviation->fixed_size = abbreviation->steps[0].size;
+  else
+    abbreviation->fixed_size = -1;
+}
+
+void dwarfy_add_attribute_step(DwarfyAbbreviation *abbreviation,int *max_num_steps,unsigned long int name,unsigned long int form,long int size,long int implicit_const)
+{
+  if(abbreviation->num_steps == *max_num_steps)
+  {
+    *max_num_steps = *max_num_steps ? *max_num_steps * 2 : 4;
+    abbreviation->steps = realloc(abbreviation->steps,*max_num_steps * sizeof(DwarfyAttributeStep));
+  }
+  abbreviation->steps[abbreviation->num_steps].name = name;
+  abbreviation->steps[abbreviation->num_steps].form = form;
+  abbreviation->steps[abbreviation->num_steps].size = size;
+  abbreviation->steps[abbreviation->num_steps].num_LEB128s = 0;
+  abbreviation->steps[abbreviation->num_steps].implicit_const = implicit_const;
+  abbreviation->num_steps++;
+}
+
+void dwarfy_consume_line_numbers(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address)
+{
+  DwarfyLineNumberHeader line_number_header;
+  unsigned char *standard_opcode_lengths;
+  unsigned char *end;
+
+  end = *address + *((unsigned int*)*address) + 4;
+  standard_opcode_lengths = dwarfy_consume_line_number_header(context,compilation_unit,&line_number_header,address);
+  dwarfy_execute_line_number_program(context,compilation_unit,&line_number_header,standard_opcode_lengths,address,end);
+  
+  return;
+}
+
+void dwarfy_init_strings()
+{
+  intern_table_init(&DWARFY_STRINGS);
+  pthread_once(&DWARFY_FORK_HANDLERS_ONCE,dwarfy_register_fork_handlers);
+}
+
+/* the one copy of string kept for every unit of every object that names it */
+
+char *dwarfy_intern(char *string)
+{
+  char *result;
+  
+  pthread_once(&DWARFY_STRINGS_ONCE,dwarfy_init_strings);
+  pthread_mutex_lock(&DWARFY_STRINGS_LOCK);
+  result = DWARFY_STRINGS.strings[intern_string(&DWARFY_STRINGS,string)];
+  pthread_mutex_unlock(&DWARFY_STRINGS_LOCK);
+  
+  return result;
+}
+
+void dwarfy_add_include_path(DwarfyCompilationUnit *compilation_unit,char *include_path)
+{
+  if(compilation_unit->num_include_paths == compilation_unit->max_num_include_paths)
+  {
+    compilation_unit->max_num_include_paths = compilation_unit->max_num_include_paths ? compilation_unit->max_num_include_paths * 2 : 8;
+    compilation_unit->include_paths = realloc(compilation_unit->include_paths,compilation_unit->max_num_include_paths * sizeof(char*));
+  }
+  compilation_unit->include_paths[compilation_unit->num_include_paths++] = include_path;
+}
+
+void dwarfy_add_file_name(DwarfyCompilationUnit *compilation_unit,char *file_name,unsigned long int directory_index)
+{
+  if(compilation_unit->num_file_names == compilation_unit->max_num_file_names)
+  {
+    compilation_unit->max_num_file_names = compilation_unit->max_num_file_names ? compilation_unit->max_num_file_names * 2 : 16;
+    compilation_unit->file_names = realloc(compilation_unit->file_names,compilation_unit->max_num_file_names * sizeof(char*));
+    compilation_unit->directory_indices = realloc(compilation_unit->directory_indices,compilation_unit->max_num_file_names * sizeof(unsigned long int));
+  }
+  compilation_unit->file_names[compilation_unit->num_file_names] = file_name;
+  compilation_unit->directory_indices[compilation_unit->num_file_names] = directory_index;
+  compilation_unit->num_file_names++;
+}
+
+/* decode the header, fill the unit's directory and file tables, and leave address at the program; returns where the
+   standard opcode lengths are */
+
+unsigned char *dwarfy_consume_line_number_header(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char **address)
+{
+  unsigned char *standard_opcode_lengths;
+  unsigned char *program;
+  char *string;
+  unsigned long int index;
+  
+  line_number_header->unit_length = *((unsigned int*)*address);
+  line_number_header->version = *((unsigned short*)(*address + 4));
+  *address += 6;
+  if(line_number_header->version >= 5)
+    *address += 2; /* address and segment selector sizes */
+  line_number_header->header_length = *((unsigned int*)*address);
+  *address += 4;
+  program = *address + line_number_header->header_length;
+  
+  line_number_header->minimum_instruction_length = *(*address)++;
+  line_number_header->maximum_operations_per_instruction = line_number_header->version >= 4 ? *(*address)++ : 1;
+  line_number_header->default_is_stmt = *(*address)++;
+  line_number_header->line_base = (signed char)*(*address)++;
+  line_number_header->line_range = *(*address)++;
+  line_number_header->opcode_base = *(*address)++;
+  standard_opcode_lengths = *address;
+  *address += line_number_header->opcode_base - 1;
+  
+  if(line_number_header->version >= 5)
+  {
+    /* each table is described by (content type, form) pairs, and entry 0 is the unit's own directory and file */
+    dwarfy_consume_line_number_entries(context,compilation_unit,address,1);
+    dwarfy_consume_line_number_entries(context,compilation_unit,address,0);
+    compilation_unit->first_file = 0;
+  }
+  else
+  {
+    dwarfy_add_include_path(compilation_unit,""); /* directory 0, the unit's own */
+    while(**address != '\0')
+    {
+      dwarfy_add_include_path(compilation_unit,dwarfy_intern((char*)*address));
+      *address += strlen((char*)(*address)) + 1;
+    }
+    (*address)++;
+    
+    while(**address != '\0')
+    {
+      string = (char*)*address;
+      *address += strlen((char*)(*address)) + 1;
+      index = dwarfy_consume_unsigned_LEB128(address);
+      dwarfy_add_file_name(compilation_unit,dwarfy_intern(string),index);
+      dwarfy_skip_LEB128s(address,2); /* modification time and length */
+    }
+    compilation_unit->first_file = 1;
+  }
+  
+  *address = program;
+  return standard_opcode_lengths;
+}
+
+/* a DWARF 5 directory or file name table: its entry format, then the entries. only the path and the directory index
+   are kept */
+
+void dwarfy_consume_line_number_entries(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address,int directories)
+{
+  unsigned long int content_types[255];
+  unsigned long int forms[255];
+  unsigned long int num_formats;
+  unsigned long int num_entries;
+  unsigned long int directory_index;
+  unsigned long int i,j;
+  char *path;
+  
+  num_formats = *(*address)++;
+  for(i = 0; i < num_formats; i++)
+  {
+    content_types[i] = dwarfy_consume_unsigned_LEB128(address);
+    forms[i] = dwarfy_consume_unsigned_LEB128(address);
+  }
+  
+  num_entries = dwarfy_consume_unsigned_LEB128(address);
+  for(i = 0; i < num_entries; i++)
+  {
+    path = 0;
+    directory_index = 0;
+    for(j = 0; j < num_formats; j++)
+    {
+      if(content_types[j] == DW_LNCT_path)
+      {
+        path = dwarfy_consume_string(context,address,forms[j]);
+        if(path && forms[j] == DW_FORM_string)
+          path = dwarfy_intern(path);
+      }
+      else if(content_types[j] == DW_LNCT_directory_index)
+        directory_index = dwarfy_consume_form_value(address,forms[j]);
+      else
+        dwarfy_skip_form(address,forms[j]);
+    }
+    
+    if(directories)
+      dwarfy_add_include_path(compilation_unit,path ? path : "");
+    else
+      dwarfy_add_file_name(compilation_unit,path ? path : "??",directory_index);
+  }
+}
+
+void dwarfy_init_line_number_state_machine(DwarfyLineNumberStateMachine *state_machine,DwarfyLineNumberHeader* line_number_header)
+{
+  state_machine->address = 0;
+  state_machine->file = 1;
+  state_machine->line = 1;
+  state_machine->column = 0;
+  state_machine->is_stmt = line_number_header->default_is_stmt;
   state_machine->basic_block = 0;
   state_machine->end_sequence = 0;
 }
 
-void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char **address)
+/* run the program to its end, one sequence after another, encoding the rows of each into a DwarfyLineSequence */
+
+void dwarfy_execute_line_number_program(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char *standard_opcode_lengths,unsigned char **address,unsigned char *end)
 {
   unsigned char opcode;
   unsigned char adjusted_opcode;
   unsigned long int operation_size;
-  char *file_name;
-  unsigned long int directory_index;
-  unsigned long int modification_time;
-  unsigned long int size;
+  unsigned char *operation_end;
   DwarfyLineNumberStateMachine state_machine;
+  DwarfyLineSequenceBuilder builder;
   
+  memset(&builder,0,sizeof(DwarfyLineSequenceBuilder));
   dwarfy_init_line_number_state_machine(&state_machine,line_number_header);
   
-  for(;;)
+  while(*address < end)
   {
     opcode = **address;
     (*address)++;
@@ -592,7 +1954,8 @@ void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,
     {
       // extended opcode
       
-      dwarfy_consume_unsigned_LEB128(address);
+      operation_size = dwarfy_consume_unsigned_LEB128(address);
+      operation_end = *address + operation_size;
       
       opcode = **address;
       (*address)++;
@@ -601,24 +1964,24 @@ void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,
       {
         case DW_LNE_end_sequence:
           state_machine.end_sequence = 1;
-          dwarfy_line_number_state_machine_out(&state_machine,compilation_unit);
-          return;
+          dwarfy_line_number_state_machine_out(context,&state_machine,&builder,compilation_unit);
+          dwarfy_init_line_number_state_machine(&state_machine,line_number_header);
+          break;
         case DW_LNE_set_address:
           state_machine.address = **((unsigned long int**)address);
           (*address) += DWARFY_ARCHITECTURE_ADDRESS_SIZE ;
           break;
         case DW_LNE_define_file:
         {
-          file_name = (char*)*address;
           *address += strlen((char*)(*address)) + 1;
-          
-          directory_index = dwarfy_consume_unsigned_LEB128(address);
-          modification_time = dwarfy_consume_unsigned_LEB128(address);
-          size = dwarfy_consume_unsigned_LEB128(address);
+          dwarfy_skip_LEB128s(address,3); /* directory index, modification time and length */
           break;
         }
         case DW_LNE_set_discriminator:
-          dwarfy_consume_unsigned_LEB128(address);
+          dwarfy_skip_LEB128s(address,1);
+          break;
+        default:
+          *address = operation_end;
           break;
       }
     }
@@ -627,7 +1990,7 @@ void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,
       switch(opcode)
       {
         case DW_LNS_copy:
-          dwarfy_line_number_state_machine_out(&state_machine,compilation_unit);
+          dwarfy_line_number_state_machine_out(context,&state_machine,&builder,compilation_unit);
           state_machine.basic_block = 0;
           break;
         case DW_LNS_advance_pc:
@@ -654,13 +2017,15 @@ void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,
           break;
         case DW_LNS_const_add_pc:
           adjusted_opcode = 255 - line_number_header->opcode_base;
-          state_machine.address += adjusted_opcode / line_number_header->line_range;
-          dwarfy_line_number_state_machine_out(&state_machine,compilation_unit);
+          state_machine.address += adjusted_opcode / line_number_header->line_range; /* only advances; no row is appended */
           break;
         case DW_LNS_fixed_advance_pc:
           state_machine.address += *((unsigned short*)(*address));
           (*address) += 2;
           break;
+        default: /* an opcode added by a later version, with its LEB128 operand count in the header */
+          dwarfy_skip_LEB128s(address,standard_opcode_lengths[opcode - 1]);
+          break;
       }
     }
     else // special opcode
@@ -668,124 +2033,451 @@ void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,
       adjusted_opcode = opcode - line_number_header->opcode_base;
       state_machine.address += adjusted_opcode / line_number_header->line_range;
       state_machine.line += line_number_header->line_base + (adjusted_opcode % line_number_header->line_range);
-      dwarfy_line_number_state_machine_out(&state_machine,compilation_unit);
+      dwarfy_line_number_state_machine_out(context,&state_machine,&builder,compilation_unit);
+    }
+  }
+  
+  /* a program cut short leaves its last sequence open */
+  if(builder.num_rows)
+    dwarfy_finish_line_sequence(&builder,compilation_unit,builder.previous.address + 1);
+  
+  compilation_unit->sequences = realloc(compilation_unit->sequences,compilation_unit->num_sequences * sizeof(DwarfyLineSequence));
+  compilation_unit->max_num_sequences = compilation_unit->num_sequences;
+  qsort(compilation_unit->sequences,compilation_unit->num_sequences,sizeof(DwarfyLineSequence),dwarfy_compare_line_sequences);
+}
+
+/* append a row to the sequence being built. a checkpoint row is kept whole and not encoded; every other row is
+   encoded as its change from the row before, usually two bytes */
+
+void dwarfy_line_number_state_machine_out(DwarfyContext *context,DwarfyLineNumberStateMachine *state_machine,DwarfyLineSequenceBuilder *builder,DwarfyCompilationUnit *compilation_unit)
+{
+  DwarfyLineRow row;
+  
+  row.address = state_machine->address - context->elf_base_address + context->elf_runtime_address;
+  row.file = state_machine->file;
+  row.line_number = state_machine->line;
+  
+  if(state_machine->end_sequence)
+  {
+    dwarfy_finish_line_sequence(builder,compilation_unit,row.address);
+    return;
+  }
+  
+  /* rows only move forward within a sequence; a producer that steps back starts a new one */
+  if(builder->num_rows && row.address < builder->previous.address)
+    dwarfy_finish_line_sequence(builder,compilation_unit,builder->previous.address + 1);
+  
+  if(builder->num_rows == 0)
+    builder->start = row.address;
+  
+  if(builder->num_rows % DWARFY_LINE_CHECKPOINT_INTERVAL == 0)
+  {
+    if(builder->num_checkpoints == builder->max_num_checkpoints)
+    {
+      builder->max_num_checkpoints = builder->max_num_checkpoints ? builder->max_num_checkpoints * 2 : 16;
+      builder->checkpoints = realloc(builder->checkpoints,builder->max_num_checkpoints * sizeof(DwarfyLineCheckpoint));
     }
+    builder->checkpoints[builder->num_checkpoints].row = row;
+    builder->checkpoints[builder->num_checkpoints].offset = builder->size;
+    builder->num_checkpoints++;
+  }
+  else
+  {
+    dwarfy_put_unsigned_LEB128(builder,((row.address - builder->previous.address) << 1) | (row.file != builder->previous.file));
+    dwarfy_put_signed_LEB128(builder,(long int)row.line_number - (long int)builder->previous.line_number);
+    if(row.file != builder->previous.file)
+      dwarfy_put_unsigned_LEB128(builder,row.file);
+  }
+  
+  builder->previous = row;
+  builder->num_rows++;
+}
+
+void dwarfy_put_unsigned_LEB128(DwarfyLineSequenceBuilder *builder,unsigned long int value)
+{
+  if(builder->size + 10 > builder->max_size)
+  {
+    builder->max_size = builder->max_size ? builder->max_size * 2 : 256;
+    builder->rows = realloc(builder->rows,builder->max_size);
   }
+  
+  for(; value >= 0x80; value >>= 7)
+    builder->rows[builder->size++] = (value & 0x7f) | 0x80;
+  builder->rows[builder->size++] = value;
 }
 
-void dwarfy_line_number_state_machine_out(DwarfyLineNumberStateMachine *state_machine,DwarfyCompilationUnit *compilation_unit)
+void dwarfy_put_signed_LEB128(DwarfyLineSequenceBuilder *builder,long int value)
 {
-  DwarfyObjectRecord *object_record;
-  DwarfyObjectRecord match_object_record;
-  DwarfySourceRecord *source_record;
+  if(builder->size + 10 > builder->max_size)
+  {
+    builder->max_size = builder->max_size ? builder->max_size * 2 : 256;
+    builder->rows = realloc(builder->rows,builder->max_size);
+  }
   
-  match_object_record.address = state_machine->address - DWARFY_ELF_BASE_ADDRESS + DWARFY_ELF_RUNTIME_ADDRESS;
+  for(; value < -0x40 || value >= 0x40; value >>= 7)
+    builder->rows[builder->size++] = (value & 0x7f) | 0x80;
+  builder->rows[builder->size++] = value & 0x7f;
+}
+
+/* hand the rows built so far to the unit as a sequence ending at end, trimmed to size; the LEB128 decoders may
+   read ELF_UTIL_PADDING bytes past the last row */
+
+void dwarfy_finish_line_sequence(DwarfyLineSequenceBuilder *builder,DwarfyCompilationUnit *compilation_unit,unsigned long int end)
+{
+  DwarfyLineSequence *sequence;
   
-  if(0 == (object_record = RB_FIND(DwarfyObjectRecordTree,&compilation_unit->line_numbers,&match_object_record)))
+  if(builder->num_rows)
   {
-    object_record = malloc(sizeof(DwarfyObjectRecord));
+    if(compilation_unit->num_sequences == compilation_unit->max_num_sequences)
+    {
+      compilation_unit->max_num_sequences = compilation_unit->max_num_sequences ? compilation_unit->max_num_sequences * 2 : 4;
+      compilation_unit->sequences = realloc(compilation_unit->sequences,compilation_unit->max_num_sequences * sizeof(DwarfyLineSequence));
+    }
+    sequence = &compilation_unit->sequences[compilation_unit->num_sequences++];
     
-    LIST_INIT(&object_record->source_records);
-    object_record->address = state_machine->address - DWARFY_ELF_BASE_ADDRESS + DWARFY_ELF_RUNTIME_ADDRESS;
-    RB_INSERT(DwarfyObjectRecordTree,&compilation_unit->line_numbers,object_record);
+    sequence->start = builder->start;
+    sequence->end = end;
+    sequence->rows = realloc(builder->rows,builder->size + ELF_UTIL_PADDING);
+    memset(sequence->rows + builder->size,0,ELF_UTIL_PADDING);
+    sequence->size = builder->size;
+    sequence->num_rows = builder->num_rows;
+    sequence->checkpoints = realloc(builder->checkpoints,builder->num_checkpoints * sizeof(DwarfyLineCheckpoint));
+    sequence->num_checkpoints = builder->num_checkpoints;
+    compilation_unit->num_line_rows += builder->num_rows;
+  }
+  else
+  {
+    free(builder->rows);
+    free(builder->checkpoints);
+  }
+  
+  memset(builder,0,sizeof(DwarfyLineSequenceBuilder));
+}
+
+int dwarfy_compare_line_sequences(const void *s1,const void *s2)
+{
+  unsigned long int a1 = ((DwarfyLineSequence*)s1)->start;
+  unsigned long int a2 = ((DwarfyLineSequence*)s2)->start;
+  
+  return (a1 > a2) - (a1 < a2);
+}
+
+/* the last row at or below address, in the sequence that covers it: binary searches for the sequence and then for
+   the checkpoint, and at most DWARFY_LINE_CHECKPOINT_INTERVAL - 1 rows decoded after it */
+
+int dwarfy_find_line_row(DwarfyCompilationUnit *compilation_unit,unsigned long int address,DwarfyLineRow *row)
+{
+  DwarfyLineSequence *sequence;
+  DwarfyLineRow next;
+  unsigned long int low,high,middle;
+  unsigned long int file_changed;
+  unsigned char *rows;
+  unsigned char *end;
+  
+  low = 0;
+  high = compilation_unit->num_sequences;
+  while(low < high)
+  {
+    middle = (low + high) / 2;
+    if(compilation_unit->sequences[middle].start <= address)
+      low = middle + 1;
+    else
+      high = middle;
   }
+  if(low == 0 || address >= compilation_unit->sequences[low - 1].end)
+    return 0;
+  sequence = &compilation_unit->sequences[low - 1];
   
-  source_record = malloc(sizeof(DwarfySourceRecord));
+  low = 0;
+  high = sequence->num_checkpoints;
+  while(low < high)
+  {
+    middle = (low + high) / 2;
+    if(sequence->checkpoints[middle].row.address <= address)
+      low = middle + 1;
+    else
+      high = middle;
+  }
   
-  source_record->file = state_machine->file;
-  source_record->line_number = state_machine->line;
-  source_record->column = state_machine->column;
+  *row = sequence->checkpoints[low - 1].row;
+  rows = sequence->rows + sequence->checkpoints[low - 1].offset;
+  end = sequence->rows + (low < sequence->num_checkpoints ? sequence->checkpoints[low].offset : sequence->size);
   
-  LIST_INSERT_HEAD(&object_record->source_records,source_record,linkage);
+  while(rows < end)
+  {
+    next.address = dwarfy_consume_unsigned_LEB128(&rows);
+    file_changed = next.address & 1;
+    next.address = row->address + (next.address >> 1);
+    if(next.address > address)
+      break;
+    next.line_number = row->line_number + dwarfy_consume_signed_LEB128(&rows);
+    next.file = file_changed ? dwarfy_consume_unsigned_LEB128(&rows) : row->file;
+    *row = next;
+  }
   
+  return 1;
 }
 
-int file_num_lines(char *file_name)
+/* find the source location of the instruction at (runtime) address in one unit; the line number and function trees are
+   ordered by descending address, so RB_NFIND yields the nearest record at or below the address */
+
+int dwarfy_symbolize_compilation_unit(DwarfyCompilationUnit *compilation_unit,unsigned long int address,DwarfySymbol *symbol)
 {
-  FILE *file;
-  int file_size;
-  char *block;
-  int num_lines;
-  int i;
-  i = 0;
-  num_lines = 0;
-  file = fopen(file_name,"rb");
-  if(file == 0)
+  DwarfyLineRow row;
+  DwarfyFunction match_function;
+  DwarfyFunction *function;
+  
+  match_function.address = address;
+  
+  if(!dwarfy_find_line_row(compilation_unit,address,&row))
     return 0;
   
-  fseek(file,0,SEEK_END);
-  file_size = ftell(file);
-  fseek(file,0,SEEK_SET);
-  block = malloc(file_size);
-  fread(block,file_size,1,file);
+  function = RB_NFIND(DwarfyFunctionTree,&compilation_unit->functions,&match_function);
+  
+  symbol->compilation_unit = compilation_unit;
+  if(row.file >= compilation_unit->first_file && row.file - compilation_unit->first_file < compilation_unit->num_file_names)
+  {
+    symbol->file_name = compilation_unit->file_names[row.file - compilation_unit->first_file];
+    if(compilation_unit->directory_indices[row.file - compilation_unit->first_file] < compilation_unit->num_include_paths)
+      symbol->directory = compilation_unit->include_paths[compilation_unit->directory_indices[row.file - compilation_unit->first_file]];
+    else
+      symbol->directory = "";
+  }
+  else
+  {
+    symbol->file_name = "??";
+    symbol->directory = "";
+  }
+  symbol->line_number = row.line_number;
+  symbol->function_name = function ? function->name : "??";
+  
+  return 1;
+}
+
+/* the range index leads straight to the unit holding the address, which is parsed if it has not been yet;
+   units the index does not cover were parsed at load time and are searched one by one */
+
+int dwarfy_symbolize(DWARF_DATA *dwarf,unsigned long int address,DwarfySymbol *symbol)
+{
+  DwarfyCompilationUnit *compilation_unit;
+  unsigned long int low,high,middle;
+  
+  if(dwarf->num_ranges)
+  {
+    /* the last range starting at or below the address */
+    low = 0;
+    high = dwarf->num_ranges;
+    while(low < high)
+    {
+      middle = (low + high) / 2;
+      if(dwarf->ranges[middle].low <= address)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    
+    if(low && address < dwarf->ranges[low - 1].high &&
+       (compilation_unit = dwarfy_compilation_unit(dwarf,dwarf->ranges[low - 1].unit)) &&
+       dwarfy_symbolize_compilation_unit(compilation_unit,address,symbol))
+      return 1;
+  }
+  
+  LIST_FOREACH(compilation_unit,&dwarf->compilation_units,linkage)
+  {
+    if(dwarfy_symbolize_compilation_unit(compilation_unit,address,symbol))
+      return 1;
+  }
+  
+  return 0;
+}
+
+typedef struct
+{
+  DWARF_DATA *dwarf;
+  unsigned long int next_unit;
+} DwarfyParseQueue;
+
+void *dwarfy_parse_thread(void *arg)
+{
+  DwarfyParseQueue *queue = arg;
+  unsigned long int i;
   
-  while(i < file_size)
+  while((i = __atomic_fetch_add(&queue->next_unit,1,__ATOMIC_RELAXED)) < queue->dwarf->num_units)
   {
-    if(block[i] == 0xA)
-      num_lines++;
-    i++;
+    if(!queue->dwarf->units[i].compilation_unit && !queue->dwarf->units[i].unreadable)
+      queue->dwarf->units[i].unreadable = 0 == (queue->dwarf->units[i].compilation_unit = dwarfy_consume_compilation_unit(&queue->dwarf->context,&queue->dwarf->units[i]));
   }
   
-  fclose(file);
-  free(block);
+  return 0;
+}
+
+/* parse every unit not parsed yet, on the number of threads the object was loaded with, and measure what came of
+   it. the units are handed out as at load time rather than through dwarfy_compilation_unit(), whose lock would
+   parse them one at a time; nothing else may be symbolizing addresses in the object meanwhile */
+
+void dwarfy_parse_all(DWARF_DATA *dwarf,DwarfyParseStatistics *statistics)
+{
+  DwarfyCompilationUnit *compilation_unit;
+  DwarfyLineSequence *sequence;
+  DwarfyParseQueue queue;
+  pthread_t threads[DWARFY_MAX_NUM_LOAD_THREADS];
+  int num_threads;
+  int num_started;
+  unsigned long int i;
+  
+  queue.dwarf = dwarf;
+  queue.next_unit = 0;
+  
+  num_threads = dwarf->context.num_threads;
+  if(num_threads > dwarf->num_units)
+    num_threads = dwarf->num_units;
+  if(num_threads > DWARFY_MAX_NUM_LOAD_THREADS)
+    num_threads = DWARFY_MAX_NUM_LOAD_THREADS;
   
-  return num_lines;
+  for(num_started = 0; num_started < num_threads - 1; num_started++)
+  {
+    if(pthread_create(&threads[num_started],0,dwarfy_parse_thread,&queue))
+      break;
+  }
+  dwarfy_parse_thread(&queue);
+  for(i = 0; i < num_started; i++)
+    pthread_join(threads[i],0);
+  
+  memset(statistics,0,sizeof(DwarfyParseStatistics));
+  statistics->num_units = dwarf->num_units;
+  for(i = 0; i < dwarf->num_units; i++)
+  {
+    if(0 == (compilation_unit = dwarf->units[i].compilation_unit))
+      continue;
+    statistics->num_named_units += dwarf->units[i].named;
+    statistics->num_DIEs += compilation_unit->num_DIEs;
+    statistics->DIE_seconds += compilation_unit->DIE_seconds;
+    statistics->num_line_rows += compilation_unit->num_line_rows;
+    for(sequence = compilation_unit->sequences; sequence < compilation_unit->sequences + compilation_unit->num_sequences; sequence++)
+      statistics->line_table_size += sizeof(DwarfyLineSequence) + sequence->size + sequence->num_checkpoints * sizeof(DwarfyLineCheckpoint);
+  }
 }
 
-void dwarfy_load_source_code(DwarfyCompilationUnit *compilation_unit)
+/* the source file a symbol is in, mapped and indexed by line the first time a report asks for it. nothing is read
+   at load time, so only the files that reports show are ever touched */
+
+DwarfySourceCode *dwarfy_source_code(DwarfySymbol *symbol)
 {
+  DwarfySourceCode match_source_code;
   DwarfySourceCode *source_code;
-  char *source_line;
-  unsigned int line_number;
-  int i,j,k;
-  int num_lines;
-  char buffer[1024];
-  FILE *file;
-  unsigned long int file_size;
-  char *block;
-  
-  for(i = 0; i < compilation_unit->num_file_names; i++)
-  {
-    strncpy(buffer,compilation_unit->include_paths[compilation_unit->directory_indices[i]],512);
-    strncat(buffer,compilation_unit->file_names[i],511);
-    
-    num_lines = file_num_lines(buffer);
-    
-    file = fopen(buffer,"rb");
-    if(!file)
-      continue;    
-    
-    source_code = malloc(sizeof(DwarfySourceCode));
-    
-    source_code->file_name = malloc(strlen(compilation_unit->file_names[i]) + 1);
-    strcpy(source_code->file_name,compilation_unit->file_names[i]);
-    source_code->source_code = malloc(num_lines * sizeof(char*));
-	source_code->num_lines = num_lines;
-    
-    fseek(file,0,SEEK_END);
-    file_size = ftell(file);
-    fseek(file,0,SEEK_SET);
-    block = malloc(file_size);
-    fread(block,file_size,1,file);
-    
-    line_number = 0;
-    j = 0;
-    for(j = 0; j < file_size; j++)
-    {
-      line_number++;
-      k = j;
-      while(block[j] != 0xA && j < file_size)
-        j++;
-      source_line = malloc(j - k + 1);
-      memcpy(source_line,block + k,j-k);
-      source_line[j - k] = '\0';
-      source_code->source_code[line_number - 1] = source_line;
-    }
-    RB_INSERT(DwarfySourceCodeTree,&compilation_unit->source_code,source_code);
-    
-    free(block);
-    fclose(file);
+  DwarfySourceCodeName match_name;
+  DwarfySourceCodeName *name;
+  char path[PATH_MAX];
+  char resolved_path[PATH_MAX];
+  
+  if(!symbol->compilation_unit)
+    return 0;
+  
+  match_name.directory = symbol->directory;
+  match_name.file_name = symbol->file_name;
+  
+  pthread_once(&DWARFY_FORK_HANDLERS_ONCE,dwarfy_register_fork_handlers);
+  pthread_mutex_lock(&DWARFY_SOURCE_CODE_LOCK);
+  if((name = RB_FIND(DwarfySourceCodeNameTree,&DWARFY_SOURCE_CODE_NAMES,&match_name)))
+  {
+    pthread_mutex_unlock(&DWARFY_SOURCE_CODE_LOCK);
+    return name->source_code->text ? name->source_code : 0;
+  }
+  pthread_mutex_unlock(&DWARFY_SOURCE_CODE_LOCK);
+  
+  /* a name not seen before: the path is resolved outside the lock, as different names can be the same file */
+  if(symbol->file_name[0] == '/' || !symbol->directory || !symbol->directory[0])
+    snprintf(path,PATH_MAX,"%s",symbol->file_name);
+  else
+    snprintf(path,PATH_MAX,"%s/%s",symbol->directory,symbol->file_name);
+  match_source_code.file_name = realpath(path,resolved_path) ? resolved_path : path;
+  
+  pthread_mutex_lock(&DWARFY_SOURCE_CODE_LOCK);
+  if(0 == (source_code = RB_FIND(DwarfySourceCodeTree,&DWARFY_SOURCE_CODE,&match_source_code)))
+  {
+    source_code = dwarfy_map_source_code(match_source_code.file_name);
+    RB_INSERT(DwarfySourceCodeTree,&DWARFY_SOURCE_CODE,source_code);
+  }
+  if(0 == RB_FIND(DwarfySourceCodeNameTree,&DWARFY_SOURCE_CODE_NAMES,&match_name))
+  {
+    name = malloc(sizeof(DwarfySourceCodeName));
+    name->directory = symbol->directory;
+    name->file_name = symbol->file_name;
+    name->source_code = source_code;
+    RB_INSERT(DwarfySourceCodeNameTree,&DWARFY_SOURCE_CODE_NAMES,name);
+  }
+  pthread_mutex_unlock(&DWARFY_SOURCE_CODE_LOCK);
+  
+  return source_code->text ? source_code : 0;
+}
+
+/* a file that cannot be read is remembered too, so that it is not tried again */
+
+DwarfySourceCode *dwarfy_map_source_code(char *path)
+{
+  DwarfySourceCode *source_code;
+  struct stat status;
+  char *line;
+  char *end;
+  int max_num_lines;
+  int fd;
+  
+  source_code = malloc(sizeof(DwarfySourceCode));
+  source_code->file_name = dwarfy_intern(path);
+  source_code->text = 0;
+  source_code->size = 0;
+  source_code->line_offsets = 0;
+  source_code->num_lines = 0;
+  
+  if(-1 == (fd = open(path,O_RDONLY)))
+    return source_code;
+  if(fstat(fd,&status) == 0 && status.st_size > 0)
+  {
+    source_code->text = mmap(0,status.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if(source_code->text == MAP_FAILED)
+      source_code->text = 0;
+    else
+      source_code->size = status.st_size;
   }
+  close(fd);
+  
+  if(!source_code->text)
+    return source_code;
+  
+  /* memchr() scans a vector at a time */
+  max_num_lines = 64;
+  source_code->line_offsets = malloc((max_num_lines + 1) * sizeof(unsigned long int));
+  end = source_code->text + source_code->size;
+  for(line = source_code->text; line < end; line++)
+  {
+    if(source_code->num_lines == max_num_lines)
+    {
+      max_num_lines *= 2;
+      source_code->line_offsets = realloc(source_code->line_offsets,(max_num_lines + 1) * sizeof(unsigned long int));
+    }
+    source_code->line_offsets[source_code->num_lines++] = line - source_code->text;
+    if(0 == (line = memchr(line,'\n',end - line)))
+      break;
+  }
+  source_code->line_offsets[source_code->num_lines] = source_code->size;
+  
+  return source_code;
+}
+
+/* a line of a source file, without its newline: sets *line and returns its length, or -1 if there is no such line */
+
+int dwarfy_source_line(DwarfySourceCode *source_code,int line_number,char **line)
+{
+  unsigned long int length;
+  
+  if(line_number < 1 || line_number > source_code->num_lines)
+    return -1;
+  
+  *line = source_code->text + source_code->line_offsets[line_number - 1];
+  length = source_code->line_offsets[line_number] - source_code->line_offsets[line_number - 1];
+  if(length && (*line)[length - 1] == '\n')
+    length--;
+  return length;
 }
 
 int dwarfy_compare_integers(unsigned long int a, unsigned long int b)
@@ -799,7 +2491,102 @@ int dwarfy_compare_integers(unsigned long int a, unsigned long int b)
 }
 
 
+/* LEB128 decoding. most values (abbreviation codes, attribute names and forms, line and column numbers) fit in one
+   byte and are decoded inline; longer ones go through a decoder chosen at startup from what the CPU supports.
+   the wide decoders may read past the last value, as every buffer they read ends in ELF_UTIL_PADDING zero bytes:
+   the DWARF sections lie in the file map_elf() maps over an anonymous mapping that much longer, and
+   dwarfy_finish_line_sequence() pads each line table's rows itself */
+
+unsigned long int (*DWARFY_CONSUME_UNSIGNED_LEB128)(unsigned char **address) = dwarfy_consume_unsigned_LEB128_scalar;
+long int (*DWARFY_CONSUME_SIGNED_LEB128)(unsigned char **address) = dwarfy_consume_signed_LEB128_scalar;
+unsigned char *(*DWARFY_SKIP_LEB128S)(unsigned char *address,unsigned long int num_values) = dwarfy_skip_LEB128s_scalar;
+char *DWARFY_LEB128_IMPLEMENTATION = "scalar";
+
+#if defined(__x86_64__)
+
+/* PEXT is one cycle on Intel and on AMD from Zen 3 (family 0x19) on, but microcoded, at tens of cycles per call, on
+   the AMD (and Hygon) cores before it that report BMI2, where the scalar decoder is faster */
+
+int dwarfy_PEXT_is_fast()
+{
+  unsigned int eax,ebx,ecx,edx;
+  unsigned int family;
+  
+  if(!__builtin_cpu_supports("bmi2") || !__get_cpuid(0,&eax,&ebx,&ecx,&edx))
+    return 0;
+  if(!(ebx == signature_AMD_ebx && ecx == signature_AMD_ecx && edx == signature_AMD_edx) &&
+     !(ebx == signature_HYGON_ebx && ecx == signature_HYGON_ecx && edx == signature_HYGON_edx))
+    return 1;
+  
+  if(!__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+    return 0;
+  family = (eax >> 8) & 0xf;
+  if(family == 0xf)
+    family += (eax >> 20) & 0xff;
+  return family >= 0x19;
+}
+
+#endif
+
+/* before any other constructor, libvalve_init() in particular, loads debug information */
+
+void __attribute__((constructor(101))) dwarfy_select_LEB128()
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  
+  DWARFY_SKIP_LEB128S = dwarfy_skip_LEB128s_sse2;
+  DWARFY_LEB128_IMPLEMENTATION = "sse2";
+  
+  if(dwarfy_PEXT_is_fast())
+  {
+    DWARFY_CONSUME_UNSIGNED_LEB128 = dwarfy_consume_unsigned_LEB128_bmi2;
+    DWARFY_CONSUME_SIGNED_LEB128 = dwarfy_consume_signed_LEB128_bmi2;
+    DWARFY_LEB128_IMPLEMENTATION = "sse2+bmi2";
+  }
+  
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+  {
+    DWARFY_SKIP_LEB128S = dwarfy_skip_LEB128s_avx2;
+    DWARFY_LEB128_IMPLEMENTATION = DWARFY_CONSUME_UNSIGNED_LEB128 == dwarfy_consume_unsigned_LEB128_bmi2 ? "avx2+bmi2" : "avx2";
+  }
+#endif
+}
+
 long int dwarfy_consume_signed_LEB128(unsigned char **address)
+{
+  long int result;
+  
+  if(**address & 0x80)
+    return DWARFY_CONSUME_SIGNED_LEB128(address);
+  
+  result = ((long int)(**address) << 57) >> 57;
+  (*address)++;
+  return result;
+}
+
+unsigned long int dwarfy_consume_unsigned_LEB128(unsigned char **address)
+{
+  unsigned long int result;
+  
+  if(**address & 0x80)
+    return DWARFY_CONSUME_UNSIGNED_LEB128(address);
+  
+  result = **address;
+  (*address)++;
+  return result;
+}
+
+/* step over num_values LEB128 values of either signedness */
+
+void dwarfy_skip_LEB128s(unsigned char **address,unsigned long int num_values)
+{
+  *address = DWARFY_SKIP_LEB128S(*address,num_values);
+}
+
+/* the byte-at-a-time decoders: the fallback, and the reference the others are checked against */
+
+long int dwarfy_consume_signed_LEB128_scalar(unsigned char **address)
 {
   long int result = 0; 
   long int shift = 0; 
@@ -810,19 +2597,20 @@ long int dwarfy_consume_signed_LEB128(unsigned char **address)
   for(i = 0; 1; i++) 
   {
     byte = (unsigned long int)((*address)[i]);
-    result |= ((byte & 0x7f) << shift);
+    if(shift < size)
+      result |= ((byte & 0x7f) << shift);
     shift += 7;
     if ((byte & 0x80) == 0) 
       break; 
   } 
   if ((shift < size) && (byte & 0x40))
-    result |= - (1 << shift);
+    result |= - (1L << shift);
     
   *address += i + 1;
   return result;
 }
 
-unsigned long int dwarfy_consume_unsigned_LEB128(unsigned char **address)
+unsigned long int dwarfy_consume_unsigned_LEB128_scalar(unsigned char **address)
 {
   unsigned long int result = 0;
   unsigned long int shift = 0;
@@ -831,7 +2619,8 @@ unsigned long int dwarfy_consume_unsigned_LEB128(unsigned char **address)
   for(i = 0; 1; i++) 
   {
      byte = (unsigned long int)((*address)[i]);
-     result |= ((byte & 0x7F) << shift); 
+     if(shift < 64)
+       result |= ((byte & 0x7F) << shift); 
      if ((byte & 0x80) == 0) 
           break; 
      shift += 7;
@@ -840,6 +2629,111 @@ unsigned long int dwarfy_consume_unsigned_LEB128(unsigned char **address)
   return result;
 }
 
+unsigned char *dwarfy_skip_LEB128s_scalar(unsigned char *address,unsigned long int num_values)
+{
+  for(; num_values; num_values--)
+  {
+    while(*address & 0x80)
+      address++;
+    address++;
+  }
+  
+  return address;
+}
+
+#if defined(__x86_64__)
+
+/* values of up to eight bytes: the last byte is the first without its high bit set, and PEXT gathers the seven
+   payload bits of each byte in one instruction */
+
+unsigned long int __attribute__((target("bmi2"))) dwarfy_consume_unsigned_LEB128_bmi2(unsigned char **address)
+{
+  unsigned long int word;
+  unsigned long int ends;
+  int num_bits;
+  
+  memcpy(&word,*address,8);
+  if(0 == (ends = ~word & 0x8080808080808080UL))
+    return dwarfy_consume_unsigned_LEB128_scalar(address);
+  
+  num_bits = __builtin_ctzl(ends) + 1;
+  *address += num_bits / 8;
+  if(num_bits < 64)
+    word &= (1UL << num_bits) - 1;
+  return _pext_u64(word,0x7f7f7f7f7f7f7f7fUL);
+}
+
+long int __attribute__((target("bmi2"))) dwarfy_consume_signed_LEB128_bmi2(unsigned char **address)
+{
+  unsigned long int word;
+  unsigned long int ends;
+  int num_bits;
+  int num_value_bits;
+  
+  memcpy(&word,*address,8);
+  if(0 == (ends = ~word & 0x8080808080808080UL))
+    return dwarfy_consume_signed_LEB128_scalar(address);
+  
+  num_bits = __builtin_ctzl(ends) + 1;
+  num_value_bits = num_bits / 8 * 7;
+  *address += num_bits / 8;
+  if(num_bits < 64)
+    word &= (1UL << num_bits) - 1;
+  return ((long int)(_pext_u64(word,0x7f7f7f7f7f7f7f7fUL) << (64 - num_value_bits))) >> (64 - num_value_bits);
+}
+
+/* the bulk skippers find the last byte of every value in a block at once: those are the bytes whose high bit is clear */
+
+unsigned char *dwarfy_skip_LEB128s_sse2(unsigned char *address,unsigned long int num_values)
+{
+  unsigned int ends;
+  unsigned int num_ends;
+  
+  while(num_values)
+  {
+    ends = ~_mm_movemask_epi8(_mm_loadu_si128((__m128i*)address)) & 0xffff;
+    num_ends = __builtin_popcount(ends);
+    
+    if(num_ends >= num_values)
+    {
+      while(--num_values)
+        ends &= ends - 1;
+      return address + __builtin_ctz(ends) + 1;
+    }
+    
+    num_values -= num_ends;
+    address += ends ? 32 - __builtin_clz(ends) : 16;
+  }
+  
+  return address;
+}
+
+unsigned char * __attribute__((target("avx2,popcnt"))) dwarfy_skip_LEB128s_avx2(unsigned char *address,unsigned long int num_values)
+{
+  unsigned int ends;
+  unsigned int num_ends;
+  
+  while(num_values)
+  {
+    ends = ~(unsigned int)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i*)address));
+    num_ends = __builtin_popcount(ends);
+    
+    if(num_ends >= num_values)
+    {
+      while(--num_values)
+        ends &= ends - 1;
+      return address + __builtin_ctz(ends) + 1;
+    }
+    
+    num_values -= num_ends;
+    address += ends ? 32 - __builtin_clz(ends) : 32;
+  }
+  
+  return address;
+}
+
+#endif
+
 char *dwarfy_tag_to_string(unsigned long int tag)
 {
   switch(tag)
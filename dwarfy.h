@@ -31,6 +31,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef DWARFY_H
 #define DWARFY_H
 
+#include <pthread.h>
+
 #ifdef LINUX
 #include "queue.h"
 #include "tree.h"
@@ -39,33 +41,27 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <sys/tree.h>
 #endif
 
-typedef LIST_HEAD(DwarfySourceRecordList,DwarfySourceRecord) DwarfySourceRecordList_t;
 typedef LIST_HEAD(DWARF_DATAList,DWARF_DATA) DWARF_DATAList_t;
 typedef LIST_HEAD(DwarfyCompilationUnitList,DwarfyCompilationUnit) DwarfyCompilationUnitList_t;
-typedef LIST_HEAD(DwarfyDIEList,DwarfyDIE) DwarfyDIEList_t;
-typedef LIST_HEAD(DwarfyAttributeSpecList,DwarfyAttributeSpec) DwarfyAttributeSpecList_t;
-typedef RB_HEAD(DwarfyObjectRecordTree,DwarfyObjectRecord) DwarfyObjectRecordTree_t;
 typedef RB_HEAD(DwarfyFunctionTree,DwarfyFunction) DwarfyFunctionTree_t;
 typedef RB_HEAD(DwarfySourceCodeTree,DwarfySourceCode) DwarfySourceCodeTree_t;
-typedef RB_HEAD(DwarfyAbbreviationTree,DwarfyAbbreviation) DwarfyAbbreviationTree_t;
-
-typedef struct DwarfyDIE DwarfyDIE;
+typedef RB_HEAD(DwarfySourceCodeNameTree,DwarfySourceCodeName) DwarfySourceCodeNameTree_t;
 
-struct DwarfyDIE
+typedef struct
 {
-  unsigned long int abbreviation_code;
-  DwarfyDIEList_t children;
-  LIST_ENTRY(DwarfyDIE) linkage;
-};
-
-typedef struct DwarfyAttributeSpec DwarfyAttributeSpec;
+  unsigned long int name;
+  unsigned long int form;
+  long int implicit_const; /* the value, for DW_FORM_implicit_const, which keeps it in the abbreviation */
+} DwarfyAttributeSpec;
 
-struct DwarfyAttributeSpec
+typedef struct
 {
-  unsigned long int name;
+  unsigned long int name; /* 0 for a run of attributes nobody reads */
   unsigned long int form;
-  LIST_ENTRY(DwarfyAttributeSpec) linkage;
-};
+  long int size; /* bytes, or -1 when only the data says how long the value is */
+  int num_LEB128s; /* for a run of LEB128 values nobody reads, how many */
+  long int implicit_const;
+} DwarfyAttributeStep;
 
 typedef struct DwarfyAbbreviation DwarfyAbbreviation;
 
@@ -75,32 +71,55 @@ struct DwarfyAbbreviation
   unsigned long int tag;
   int num_items;
   int has_children;
-  DwarfyAttributeSpecList_t specs;
-  RB_ENTRY(DwarfyAbbreviation) DwarfyAbbreviationLinks;
+  DwarfyAttributeSpec *specs; /* num_items of them, in the order the values appear */
+  DwarfyAttributeStep *steps; /* how to walk a DIE of this kind: the attributes read, and runs of fixed-size ones stepped over at once */
+  int num_steps;
+  long int fixed_size; /* a DIE of this kind is all unread fixed-size attributes, this many bytes long; otherwise -1 */
 };
 
-int dwarfy_compare_abbreviations(DwarfyAbbreviation *a1,DwarfyAbbreviation *a2);
-
-typedef struct DwarfyObjectRecord DwarfyObjectRecord;
-
-struct DwarfyObjectRecord /* maps ELF executable addresses to human-readable locations in source code */ 
+typedef struct
 {
-  unsigned long int address;
-  DwarfySourceRecordList_t source_records;
-  RB_ENTRY(DwarfyObjectRecord) DwarfyObjectRecordLinks;
-};
+  unsigned long int offset; /* in .debug_abbrev */
+  DwarfyAbbreviation *abbreviations; /* indexed by code; unused codes are 0 */
+  unsigned long int num_codes;
+} DwarfyAbbreviationSet; /* parsed once per offset and shared by every unit that uses it */
 
-int dwarfy_compare_object_records_by_address(DwarfyObjectRecord *dlr1,DwarfyObjectRecord *dlr2);
-
-typedef struct DwarfySourceRecord DwarfySourceRecord;
-
-struct DwarfySourceRecord
+typedef struct
 {
+  unsigned long int address; /* runtime */
   unsigned int file;
   unsigned int line_number;
-  unsigned int column;
-  LIST_ENTRY(DwarfySourceRecord) linkage;
-};
+} DwarfyLineRow;
+
+typedef struct
+{
+  DwarfyLineRow row; /* every DWARFY_LINE_CHECKPOINT_INTERVAL-th row, decoded */
+  unsigned int offset; /* in the sequence's rows, of the row after it */
+} DwarfyLineCheckpoint;
+
+typedef struct /* maps ELF executable addresses to human-readable locations in source code */ 
+{
+  unsigned long int start; /* the address of the first row */
+  unsigned long int end; /* one past the last instruction */
+  unsigned char *rows; /* each a change from the row before: LEB128s of address delta * 2 + (file changed), line delta, and the new file if it did */
+  unsigned int size;
+  unsigned int num_rows;
+  DwarfyLineCheckpoint *checkpoints;
+  unsigned int num_checkpoints;
+} DwarfyLineSequence;
+
+typedef struct /* a line number program's sequence while it is being encoded */
+{
+  unsigned char *rows;
+  unsigned int size;
+  unsigned int max_size;
+  unsigned int num_rows;
+  DwarfyLineCheckpoint *checkpoints;
+  unsigned int num_checkpoints;
+  unsigned int max_num_checkpoints;
+  DwarfyLineRow previous;
+  unsigned long int start;
+} DwarfyLineSequenceBuilder;
   
 typedef struct DwarfyFunction DwarfyFunction;
 
@@ -115,42 +134,149 @@ int dwarfy_compare_functions(DwarfyFunction *df1,DwarfyFunction *df2);
 
 typedef struct DwarfySourceCode DwarfySourceCode;
 
-struct DwarfySourceCode
+struct DwarfySourceCode /* one per source file, shared by every unit and object that names it */
 {
-  char *file_name;
-  char **source_code;
+  char *file_name; /* the resolved path */
+  char *text; /* mapped; 0 if the file could not be read */
+  unsigned long int size;
+  unsigned long int *line_offsets; /* where each line starts, and then the end of the text */
   int num_lines;
   RB_ENTRY(DwarfySourceCode) DwarfySourceCodeLinks;
 };
 
 int dwarfy_compare_source_code(DwarfySourceCode *dsc1,DwarfySourceCode *dsc2); /* actually compares file names */
 
+typedef struct DwarfySourceCodeName DwarfySourceCodeName;
+
+struct DwarfySourceCodeName /* a (directory, file name) pair, as line tables give them, already resolved */
+{
+  char *directory; /* both interned or in .debug_line_str, so compared by address */
+  char *file_name;
+  DwarfySourceCode *source_code;
+  RB_ENTRY(DwarfySourceCodeName) DwarfySourceCodeNameLinks;
+};
+
+int dwarfy_compare_source_code_names(DwarfySourceCodeName *dscn1,DwarfySourceCodeName *dscn2);
+
 typedef struct DwarfyCompilationUnit DwarfyCompilationUnit;
 
 struct DwarfyCompilationUnit
 {
-  DwarfyObjectRecordTree_t line_numbers;
-  DwarfyObjectRecordTree_t addresses;
+  DwarfyLineSequence *sequences; /* sorted by start */
+  unsigned long int num_sequences;
+  unsigned long int max_num_sequences;
   DwarfyFunctionTree_t functions;
-  DwarfyAbbreviationTree_t abbreviations;
-  DwarfyDIEList_t DIE_list;
-  DwarfySourceCodeTree_t source_code;
-  char *include_paths[256];
-  char *file_names[256];
-  int num_include_paths;
-  int num_file_names;
-  int directory_indices[256];
+  DwarfyAbbreviationSet *abbreviations;
+  unsigned long int num_DIEs;
+  double DIE_seconds; /* spent walking them */
+  unsigned long int num_line_rows;
+  char **include_paths; /* interned or in .debug_line_str, as are file_names */
+  unsigned long int num_include_paths;
+  unsigned long int max_num_include_paths;
+  char **file_names;
+  unsigned long int first_file; /* the file number of file_names[0]: 1 before DWARF 5, 0 from it on */
+  unsigned long int *directory_indices; /* into include_paths, one per file name */
+  unsigned long int num_file_names;
+  unsigned long int max_num_file_names;
   LIST_ENTRY(DwarfyCompilationUnit) linkage;
 };
 
 typedef struct DWARF_DATA DWARF_DATA;
 
+typedef struct
+{
+  unsigned char *debug_info;
+  unsigned char *debug_abbrev;
+  unsigned char *debug_line;
+  unsigned char *debug_str;
+  unsigned char *debug_aranges;
+  unsigned char *debug_ranges;
+  unsigned char *debug_str_offsets; /* this and the rest only in DWARF 5 */
+  unsigned char *debug_addr;
+  unsigned char *debug_rnglists;
+  unsigned char *debug_line_str;
+  unsigned char *debug_names; /* accelerator tables, when the compiler or linker made them */
+  unsigned char *gdb_index;
+  unsigned long int debug_info_size;
+  unsigned long int debug_aranges_size;
+  unsigned long int debug_ranges_size;
+  unsigned long int debug_str_offsets_size;
+  unsigned long int debug_addr_size;
+  unsigned long int debug_rnglists_size;
+  unsigned long int debug_names_size;
+  unsigned long int gdb_index_size;
+  unsigned long int compilation_unit_end; /* offset in .debug_info of the end of the unit being parsed */
+  unsigned long int line_number_program_offset; /* the unit's DW_AT_stmt_list, or -1 */
+  unsigned long int str_offsets_base; /* the unit's contributions to .debug_str_offsets, .debug_addr and .debug_rnglists */
+  unsigned long int addr_base;
+  unsigned long int rnglists_base;
+  unsigned long int elf_base_address;
+  unsigned long int elf_runtime_address;
+  int num_threads; /* for parsing compilation units */
+} DwarfyContext; /* the parse state of one object, so that several objects can be loaded at once */
+
+typedef struct
+{
+  char *file_name;
+  unsigned long int runtime_address;
+  DWARF_DATA *dwarf; /* the result, or 0 */
+} DwarfyLoadRequest;
+
+typedef struct
+{
+  unsigned long int offset; /* of the unit header in .debug_info */
+  unsigned long int first_DIE; /* the header's length depends on the version and, from DWARF 5, the unit type */
+  unsigned long int end;
+  unsigned short version;
+  DwarfyAbbreviationSet *abbreviations;
+  DwarfyCompilationUnit *compilation_unit; /* once parsed */
+  int indexed; /* its addresses are in the range index, so it is parsed on demand */
+  int named; /* .debug_names lists its subprograms, so only those DIEs (and the unit DIE) are read */
+  unsigned long int *function_DIEs; /* their offsets from the unit header */
+  unsigned long int num_function_DIEs;
+  int unreadable; /* its DIEs could not be parsed, so it is left unsymbolized */
+} DwarfyUnitSpan;
+
+typedef struct
+{
+  unsigned long int low; /* runtime addresses */
+  unsigned long int high;
+  unsigned long int unit; /* index into units */
+} DwarfyAddressRange;
+
 struct DWARF_DATA
 {
-  DwarfyCompilationUnitList_t compilation_units;
+  DwarfyCompilationUnitList_t compilation_units; /* the units parsed at load time: those the range index does not cover */
+  DwarfyContext context; /* for parsing the other units on demand */
+  unsigned char *elf; /* mapped for as long as the object is loaded: units parsed on demand read it, and function names point into its .debug_str */
+  unsigned long int elf_size;
+  DwarfyUnitSpan *units;
+  unsigned long int num_units;
+  DwarfyAddressRange *ranges; /* sorted by low */
+  unsigned long int num_ranges;
+  pthread_mutex_t lazy_lock; /* serializes parsing this object's units on demand */
   LIST_ENTRY(DWARF_DATA) linkage;
 };
 
+typedef struct
+{
+  char *file_name;
+  char *directory; /* the file name's include path, "" for the unit's own directory */
+  unsigned int line_number;
+  char *function_name;
+  DwarfyCompilationUnit *compilation_unit;
+} DwarfySymbol;
+
+typedef struct
+{
+  unsigned long int num_units;
+  unsigned long int num_named_units; /* parsed through .debug_names */
+  unsigned long int num_DIEs;
+  double DIE_seconds;
+  unsigned long int num_line_rows;
+  unsigned long int line_table_size; /* bytes */
+} DwarfyParseStatistics;
+
 typedef struct
 {
   unsigned long int address;
@@ -170,44 +296,106 @@ typedef struct __attribute__((packed))
   unsigned char address_size;
 } DwarfyCompilationUnitHeader;
 
-typedef struct __attribute__((packed)) 
+typedef struct
 {
   unsigned int unit_length;
   unsigned short version;
   unsigned int header_length;
   unsigned char minimum_instruction_length;
-  //unsigned char maximum_operations_per_instruction;
+  unsigned char maximum_operations_per_instruction; /* from version 4; 1 before */
   unsigned char default_is_stmt;
   signed char line_base;
   unsigned char line_range;
   unsigned char opcode_base;
-} DwarfyLineNumberHeader;
+} DwarfyLineNumberHeader; /* decoded rather than overlaid, as fields come and go between versions */
 
+#define DWARFY_MAX_NUM_LOAD_THREADS 64
+#define DWARFY_LINE_CHECKPOINT_INTERVAL 16
 #define DWARFY_ARCHITECTURE_ADDRESS_SIZE 8
 #define DWARFY_FORMAT_64 1
 #define DWARFY_FORMAT_32 2
 
-RB_PROTOTYPE(DwarfyObjectRecordTree,DwarfyObjectRecord,DwarfyObjectRecordLinks,dwarfy_compare_location_records_by_address)
 RB_PROTOTYPE(DwarfyFunctionTree,DwarfyFunction,DwarfyFunctionLinks,dwarfy_compare_functions);
-RB_PROTOTYPE(DwarfyAbbreviationTree,DwarfyAbbreviation,DwarfyAbbreviationLinks,dwarfy_compare_location_records_by_address)
 RB_PROTOTYPE(DwarfySourceCodeTree,DwarfySourceCode,DwarfySourceCodeLinks,dwarfy_compare_source_code);
+RB_PROTOTYPE(DwarfySourceCodeNameTree,DwarfySourceCodeName,DwarfySourceCodeNameLinks,dwarfy_compare_source_code_names);
+
+extern char *DWARFY_LEB128_IMPLEMENTATION; /* the decoders chosen for this CPU */
 
 DWARF_DATA *load_dwarf(char *file_name,unsigned long int runtime_address);
-DWARF_DATA *dwarfy_load_debug_info(unsigned char *elf);
-DWARF_DATA *dwarfy_main(void);
-void dwarfy_consume_compilation_units(DwarfyCompilationUnitList_t *compilation_units,unsigned char **address);
-void dwarfy_consume_DIEs(DwarfyDIEList_t *DIE_list,DwarfyCompilationUnit *compilation_unit,unsigned char **address);
-void dwarfy_consume_abbreviations(DwarfyCompilationUnit *compilation_unit,unsigned char **address);
-DwarfyAbbreviation *dwarfy_consume_abbreviation_header(unsigned char **address);
+DWARF_DATA *dwarfy_load(char *file_name,unsigned long int runtime_address,int num_threads);
+void load_dwarf_parallel(DwarfyLoadRequest *requests,int num_requests,int num_threads);
+int dwarfy_num_cpus(void);
+DWARF_DATA *dwarfy_load_debug_info(DwarfyContext *context,unsigned char *elf);
+void dwarfy_init_strings();
+char *dwarfy_intern(char *string);
+void dwarfy_add_include_path(DwarfyCompilationUnit *compilation_unit,char *include_path);
+void dwarfy_add_file_name(DwarfyCompilationUnit *compilation_unit,char *file_name,unsigned long int directory_index);
+DWARF_DATA *dwarfy_main(DwarfyContext *context);
+unsigned long int dwarfy_find_compilation_units(DwarfyContext *context,DwarfyUnitSpan **spans);
+void dwarfy_index_compilation_units(DwarfyContext *context,DWARF_DATA *dwarf);
+int dwarfy_unit_is_C(DwarfyContext *context,DwarfyUnitSpan *span);
+void dwarfy_free_compilation_unit(DwarfyCompilationUnit *compilation_unit);
+DwarfyCompilationUnit *dwarfy_consume_compilation_unit(DwarfyContext *context,DwarfyUnitSpan *span);
+void dwarfy_consume_compilation_units(DwarfyContext *context,DWARF_DATA *dwarf);
+DwarfyCompilationUnit *dwarfy_compilation_unit(DWARF_DATA *dwarf,unsigned long int unit);
+void dwarfy_lock_lazy(void);
+void dwarfy_unlock_lazy(void);
+void dwarfy_register_fork_handlers(void);
+long int dwarfy_find_unit(DWARF_DATA *dwarf,unsigned long int offset);
+void dwarfy_index_aranges(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges);
+void dwarfy_index_unit_DIE(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges,unsigned long int unit);
+void dwarfy_index_gdb_index(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges);
+void dwarfy_index_debug_names(DwarfyContext *context,DWARF_DATA *dwarf);
+unsigned char *dwarfy_index_name_table(DwarfyContext *context,DWARF_DATA *dwarf,unsigned char *address,unsigned long int **function_DIEs,unsigned long int *num_function_DIEs,unsigned long int *max_num_function_DIEs);
+int dwarfy_compare_function_DIEs(const void *d1,const void *d2);
+int dwarfy_consume_DIEs(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address);
+int dwarfy_consume_named_DIEs(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyUnitSpan *span);
+int dwarfy_consume_DIE(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address);
+int dwarfy_skip_form(unsigned char **address,unsigned long int form);
+long int dwarfy_form_size(unsigned long int form);
+int dwarfy_attribute_is_read(unsigned long int tag,unsigned long int name);
+unsigned long int dwarfy_consume_form_value(unsigned char **address,unsigned long int form);
+unsigned long int dwarfy_consume_address(DwarfyContext *context,unsigned char **address,unsigned long int form);
+unsigned long int dwarfy_indexed_address(DwarfyContext *context,unsigned long int index);
+int dwarfy_form_is_address_index(unsigned long int form);
+char *dwarfy_consume_string(DwarfyContext *context,unsigned char **address,unsigned long int form);
+void dwarfy_index_rnglist(DwarfyContext *context,DWARF_DATA *dwarf,unsigned long int *max_num_ranges,unsigned long int offset,unsigned long int base,unsigned long int unit);
+DwarfyAbbreviationSet *dwarfy_abbreviation_set(DwarfyContext *context,DwarfyAbbreviationSet ***sets,unsigned long int *num_sets,unsigned long int offset);
+DwarfyAbbreviationSet *dwarfy_consume_abbreviations(unsigned char *address,unsigned long int offset);
+int dwarfy_consume_abbreviation_header(DwarfyAbbreviation *abbreviation,unsigned char **address);
 void dwarfy_consume_abbreviation_attribute_specs(DwarfyAbbreviation *abbreviation,unsigned char **address);
-void dwarfy_consume_line_numbers(DwarfyCompilationUnit *compilation_unit,unsigned char **address);
-DwarfyLineNumberHeader *dwarfy_consume_line_number_header(DwarfyCompilationUnit *compilation_unit,unsigned char **address);
+void dwarfy_add_attribute_step(DwarfyAbbreviation *abbreviation,int *max_num_steps,unsigned long int name,unsigned long int form,long int size,long int implicit_const);
+void dwarfy_consume_line_numbers(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address);
+unsigned char *dwarfy_consume_line_number_header(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char **address);
+void dwarfy_consume_line_number_entries(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,unsigned char **address,int directories);
 void dwarfy_init_line_number_state_machine(DwarfyLineNumberStateMachine *state_machine,DwarfyLineNumberHeader* line_number_header);
-void dwarfy_execute_line_number_program(DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char **address);
-void dwarfy_line_number_state_machine_out(DwarfyLineNumberStateMachine *state_machine,DwarfyCompilationUnit *compilation_unit);
-void dwarfy_load_source_code(DwarfyCompilationUnit *compilation_unit);
+void dwarfy_execute_line_number_program(DwarfyContext *context,DwarfyCompilationUnit *compilation_unit,DwarfyLineNumberHeader *line_number_header,unsigned char *standard_opcode_lengths,unsigned char **address,unsigned char *end);
+void dwarfy_line_number_state_machine_out(DwarfyContext *context,DwarfyLineNumberStateMachine *state_machine,DwarfyLineSequenceBuilder *builder,DwarfyCompilationUnit *compilation_unit);
+void dwarfy_put_unsigned_LEB128(DwarfyLineSequenceBuilder *builder,unsigned long int value);
+void dwarfy_put_signed_LEB128(DwarfyLineSequenceBuilder *builder,long int value);
+void dwarfy_finish_line_sequence(DwarfyLineSequenceBuilder *builder,DwarfyCompilationUnit *compilation_unit,unsigned long int end);
+int dwarfy_compare_line_sequences(const void *s1,const void *s2);
+int dwarfy_find_line_row(DwarfyCompilationUnit *compilation_unit,unsigned long int address,DwarfyLineRow *row);
+DwarfySourceCode *dwarfy_source_code(DwarfySymbol *symbol);
+DwarfySourceCode *dwarfy_map_source_code(char *path);
+int dwarfy_source_line(DwarfySourceCode *source_code,int line_number,char **line);
+int dwarfy_symbolize_compilation_unit(DwarfyCompilationUnit *compilation_unit,unsigned long int address,DwarfySymbol *symbol);
+void dwarfy_parse_all(DWARF_DATA *dwarf,DwarfyParseStatistics *statistics);
+int dwarfy_symbolize(DWARF_DATA *dwarf,unsigned long int address,DwarfySymbol *symbol);
+void dwarfy_select_LEB128(void);
 long int dwarfy_consume_signed_LEB128(unsigned char **address);
 unsigned long int dwarfy_consume_unsigned_LEB128(unsigned char **address);
+void dwarfy_skip_LEB128s(unsigned char **address,unsigned long int num_values);
+long int dwarfy_consume_signed_LEB128_scalar(unsigned char **address);
+unsigned long int dwarfy_consume_unsigned_LEB128_scalar(unsigned char **address);
+unsigned char *dwarfy_skip_LEB128s_scalar(unsigned char *address,unsigned long int num_values);
+#if defined(__x86_64__)
+int dwarfy_PEXT_is_fast(void);
+unsigned long int dwarfy_consume_unsigned_LEB128_bmi2(unsigned char **address);
+long int dwarfy_consume_signed_LEB128_bmi2(unsigned char **address);
+unsigned char *dwarfy_skip_LEB128s_sse2(unsigned char *address,unsigned long int num_values);
+unsigned char *dwarfy_skip_LEB128s_avx2(unsigned char *address,unsigned long int num_values);
+#endif
 char *dwarfy_tag_to_string(unsigned long int tag);
 char *dwarfy_attribute_to_string(unsigned long int attribute);
 char *dwarfy_form_to_string(unsigned long int form);
@@ -0,0 +1,264 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dwarfy.h"
+#include "elf_util.h"
+
+/* dwarfy_test: checks every LEB128 decoder this CPU can run against the values encoded, then loads the objects
+   named on the command line on more and more threads and parses all their debug information, printing how fast each
+   went. exits non-zero if a decoder gets a value wrong or an object cannot be read, so that make test fails */
+
+#define DWARFY_TEST_NUM_LEB128S 1000000
+
+double dwarfy_test_seconds_since(struct timespec *start)
+{
+  struct timespec end;
+  
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+typedef struct
+{
+  char *name;
+  int supported; /* by this CPU */
+  unsigned long int (*consume_unsigned)(unsigned char **address);
+  long int (*consume_signed)(unsigned char **address);
+  unsigned char *(*skip)(unsigned char *address,unsigned long int num_values);
+} DwarfyTestLEB128Implementation;
+
+/* the skipper dwarfy_skip_LEB128s() dispatches to, called the way the other skippers are */
+
+unsigned char *dwarfy_test_skip_LEB128s(unsigned char *address,unsigned long int num_values)
+{
+  dwarfy_skip_LEB128s(&address,num_values);
+  return address;
+}
+
+/* check one set of LEB128 decoders against the values that were encoded, and time them */
+
+int dwarfy_test_LEB128_implementation(DwarfyTestLEB128Implementation *implementation,unsigned long int *values,unsigned char *encoded,unsigned char *end)
+{
+  unsigned char *address;
+  struct timespec start;
+  unsigned long int value;
+  double seconds,skip_seconds;
+  long int i;
+  
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  for(address = encoded, i = 0; i < DWARFY_TEST_NUM_LEB128S; i++)
+  {
+    value = (i & 1) ? (unsigned long int)implementation->consume_signed(&address) : implementation->consume_unsigned(&address);
+    if(value != values[i])
+    {
+      printf("LEB128 (%s): value %ld (0x%lx) decoded wrongly\n",implementation->name,i,values[i]);
+      return 1;
+    }
+  }
+  seconds = dwarfy_test_seconds_since(&start);
+  if(address != end)
+  {
+    printf("LEB128 (%s): decoded to the wrong place\n",implementation->name);
+    return 1;
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  address = implementation->skip(encoded,DWARFY_TEST_NUM_LEB128S);
+  skip_seconds = dwarfy_test_seconds_since(&start);
+  if(address != end)
+  {
+    printf("LEB128 (%s): skipped to the wrong place\n",implementation->name);
+    return 1;
+  }
+  
+  printf("LEB128 (%s): %d values of 1 to 10 bytes decoded and skipped correctly; decode %.1f ns/value, skip %.2f ns/value\n",
+         implementation->name,DWARFY_TEST_NUM_LEB128S,seconds * 1e9 / DWARFY_TEST_NUM_LEB128S,skip_seconds * 1e9 / DWARFY_TEST_NUM_LEB128S);
+  return 0;
+}
+
+/* check every LEB128 implementation this CPU can run, whether or not it was chosen, and the decoders that were, on values
+   of every length */
+
+int dwarfy_test_LEB128()
+{
+  unsigned long int *values;
+  unsigned char *encoded;
+  unsigned char *end;
+  unsigned long int random_state;
+  unsigned long int value;
+  unsigned char byte;
+  int result;
+  long int i;
+  
+  /* the dispatchers last, with their inline one-byte paths; dwarfy_select_LEB128() has run, and with it __builtin_cpu_init() */
+  DwarfyTestLEB128Implementation implementations[] =
+  {
+    {"scalar",1,dwarfy_consume_unsigned_LEB128_scalar,dwarfy_consume_signed_LEB128_scalar,dwarfy_skip_LEB128s_scalar},
+#if defined(__x86_64__)
+    {"sse2",1,dwarfy_consume_unsigned_LEB128_scalar,dwarfy_consume_signed_LEB128_scalar,dwarfy_skip_LEB128s_sse2},
+    {dwarfy_PEXT_is_fast() ? "bmi2" : "bmi2, not chosen: PEXT is slow here",__builtin_cpu_supports("bmi2"),
+     dwarfy_consume_unsigned_LEB128_bmi2,dwarfy_consume_signed_LEB128_bmi2,dwarfy_skip_LEB128s_scalar},
+    {"avx2",__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"),
+     dwarfy_consume_unsigned_LEB128_scalar,dwarfy_consume_signed_LEB128_scalar,dwarfy_skip_LEB128s_avx2},
+#endif
+    {DWARFY_LEB128_IMPLEMENTATION,1,dwarfy_consume_unsigned_LEB128,dwarfy_consume_signed_LEB128,dwarfy_test_skip_LEB128s}
+  };
+  
+  values = malloc(DWARFY_TEST_NUM_LEB128S * sizeof(unsigned long int));
+  encoded = malloc(DWARFY_TEST_NUM_LEB128S * 10 + ELF_UTIL_PADDING);
+  
+  /* even entries unsigned, odd ones signed, with bit widths spread evenly from 0 to 64 */
+  random_state = 88172645463325252UL;
+  end = encoded;
+  for(i = 0; i < DWARFY_TEST_NUM_LEB128S; i++)
+  {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    value = random_state % 65 == 64 ? random_state : random_state & ((1UL << (random_state % 65)) - 1);
+    values[i] = (i & 1) ? (unsigned long int)((long int)(value << (random_state % 65 % 64)) >> (random_state % 65 % 64)) : value;
+    
+    value = values[i];
+    for(;;)
+    {
+      byte = value & 0x7f;
+      value = (i & 1) ? (unsigned long int)((long int)value >> 7) : value >> 7;
+      if((i & 1) ? ((value == 0 && !(byte & 0x40)) || (value == ~0UL && (byte & 0x40))) : value == 0)
+        break;
+      *end++ = byte | 0x80;
+    }
+    *end++ = byte;
+  }
+  memset(end,0,ELF_UTIL_PADDING);
+  
+  result = 0;
+  for(i = 0; i < sizeof(implementations) / sizeof(DwarfyTestLEB128Implementation) && !result; i++)
+  {
+    if(implementations[i].supported)
+      result = dwarfy_test_LEB128_implementation(&implementations[i],values,encoded,end);
+  }
+  
+  free(values);
+  free(encoded);
+  return result;
+}
+
+/* load the objects together, as libvalve -j does, on 1, 2, 4 ... threads up to one per CPU, and print how long each
+   load took */
+
+int dwarfy_test_load(char **objects,int num_objects)
+{
+  DwarfyLoadRequest *requests;
+  struct timespec start;
+  int num_cpus,num_threads;
+  int i;
+  
+  requests = calloc(num_objects + 1,sizeof(DwarfyLoadRequest));
+  num_cpus = dwarfy_num_cpus();
+  
+  for(num_threads = 1;; num_threads = num_threads * 2 < num_cpus ? num_threads * 2 : num_cpus)
+  {
+    for(i = 0; i < num_objects; i++)
+    {
+      requests[i].file_name = objects[i];
+      requests[i].runtime_address = 0;
+      requests[i].dwarf = 0;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    load_dwarf_parallel(requests,num_objects,num_threads);
+    printf("load: %d object(s) on %d thread(s) in %.1f ms\n",num_objects,num_threads,dwarfy_test_seconds_since(&start) * 1000.0);
+    
+    for(i = 0; i < num_objects; i++)
+    {
+      if(requests[i].dwarf == 0)
+      {
+        fprintf(stderr,"[dwarfy_test] Error: no debug information in \"%s\".\n",objects[i]);
+        free(requests);
+        return 1;
+      }
+    }
+    
+    if(num_threads == num_cpus)
+      break;
+  }
+  
+  free(requests);
+  return 0;
+}
+
+/* parse all the debug information in each object on one thread per CPU, as libvalve would if every unit were needed,
+   and report how fast the DIEs were walked */
+
+int dwarfy_test_parse(char **objects,int num_objects)
+{
+  DWARF_DATA *dwarf;
+  struct timespec start,end;
+  DwarfyParseStatistics statistics;
+  double seconds;
+  int num_threads;
+  int i;
+  
+  num_threads = dwarfy_num_cpus();
+  for(i = 0; i < num_objects; i++)
+  {
+    clock_gettime(CLOCK_MONOTONIC,&start);
+    if(0 == (dwarf = dwarfy_load(objects[i],0,num_threads)))
+    {
+      fprintf(stderr,"[dwarfy_test] Error: no debug information in \"%s\".\n",objects[i]);
+      return 1;
+    }
+    dwarfy_parse_all(dwarf,&statistics);
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    printf("%s: %lu unit(s) (%lu through .debug_names) parsed on %d thread(s) in %.1f ms; %lu DIE(s) walked in %.1f ms (%.0f DIEs/s); %lu line row(s) in %lu bytes (%.1f bytes/row)\n",
+           objects[i],statistics.num_units,statistics.num_named_units,num_threads,seconds * 1000.0,statistics.num_DIEs,statistics.DIE_seconds * 1000.0,
+           statistics.DIE_seconds > 0 ? statistics.num_DIEs / statistics.DIE_seconds : 0.0,statistics.num_line_rows,statistics.line_table_size,
+           statistics.num_line_rows ? (double)statistics.line_table_size / statistics.num_line_rows : 0.0);
+  }
+  
+  return 0;
+}
+
+int main(int argc,char **argv)
+{
+  if(dwarfy_test_LEB128())
+    return 1;
+  
+  if(argc > 1 && dwarfy_test_load(argv + 1,argc - 1))
+    return 1;
+  
+  return dwarfy_test_parse(argv + 1,argc - 1);
+}
@@ -32,6 +32,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <elf.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "elf_util.h"
 
 unsigned char *load_elf(char *file_name)
@@ -47,13 +51,48 @@ unsigned char *load_elf(char *file_name)
   fseek(f,0,SEEK_END);
   file_size = ftell(f);
   fseek(f,0,SEEK_SET);
-  block = malloc(file_size);
+  block = malloc(file_size + ELF_UTIL_PADDING);
   fread(block,file_size,1,f);
+  memset(block + file_size,0,ELF_UTIL_PADDING);
   fclose(f);
   
   return block;
 }
 
+/* as load_elf, but maps the file read-only instead of reading it, so that only the pages used are resident; the
+   padding is an anonymous mapping after the file's */
+
+unsigned char *map_elf(char *file_name,unsigned long int *size)
+{
+  unsigned char *block;
+  struct stat status;
+  int fd;
+  
+  if((fd = open(file_name,O_RDONLY)) < 0)
+    return 0;
+  if(fstat(fd,&status) != 0 || status.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+  
+  *size = status.st_size;
+  block = mmap(0,*size + ELF_UTIL_PADDING,PROT_READ,MAP_PRIVATE | MAP_ANON,-1,0);
+  if(block != MAP_FAILED && mmap(block,*size,PROT_READ,MAP_PRIVATE | MAP_FIXED,fd,0) == MAP_FAILED)
+  {
+    munmap(block,*size + ELF_UTIL_PADDING);
+    block = MAP_FAILED;
+  }
+  close(fd);
+  
+  return block == MAP_FAILED ? 0 : block;
+}
+
+void unmap_elf(unsigned char *elf,unsigned long int size)
+{
+  munmap(elf,size + ELF_UTIL_PADDING);
+}
+
 unsigned long int get_elf_base_address(unsigned char *elf)
 {
   char *section_name;
@@ -76,6 +115,43 @@ unsigned long int get_elf_base_address(unsigned char *elf)
   return lowest_address;
 }
 
+/* copy the NT_GNU_BUILD_ID note's descriptor (at most 32 bytes) into build_id; returns its size, or 0 if there is none */
+
+int get_elf_build_id(unsigned char *elf,unsigned char *build_id)
+{
+  Elf64_Ehdr *elf_header;
+  Elf64_Phdr *program_header;
+  Elf64_Nhdr *note;
+  unsigned char *address,*end;
+  int i;
+  
+  elf_header = (Elf64_Ehdr*)elf;
+  program_header = (Elf64_Phdr*)(elf + elf_header->e_phoff);
+  
+  for(i = 0; i < elf_header->e_phnum; i++)
+  {
+    if(program_header[i].p_type != PT_NOTE)
+      continue;
+    
+    address = elf + program_header[i].p_offset;
+    end = address + program_header[i].p_filesz;
+    
+    while(address + sizeof(Elf64_Nhdr) <= end)
+    {
+      note = (Elf64_Nhdr*)address;
+      address += sizeof(Elf64_Nhdr) + ((note->n_namesz + 3) & ~3);
+      if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && !memcmp(note + 1,"GNU",4) && note->n_descsz <= 32)
+      {
+        memcpy(build_id,address,note->n_descsz);
+        return note->n_descsz;
+      }
+      address += (note->n_descsz + 3) & ~3;
+    }
+  }
+  
+  return 0;
+}
+
 unsigned long int get_elf_symbol(unsigned char *elf,char *name)
 {
   char *section_name;
@@ -31,8 +31,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef ELF_UTIL_H
 #define ELF_UTIL_H
 
+#define ELF_UTIL_PADDING 32 /* zero bytes after a loaded file, so that readers may load a whole vector past the last byte */
+
 unsigned char *load_elf(char *file_name);
+unsigned char *map_elf(char *file_name,unsigned long int *size);
+void unmap_elf(unsigned char *elf,unsigned long int size);
 unsigned long int get_elf_base_address(unsigned char *elf);
+int get_elf_build_id(unsigned char *elf,unsigned char *build_id);
 unsigned long int get_elf_symbol(unsigned char *elf,char *name);
 unsigned long int get_elf_relocation(unsigned char *elf,char *name);
 
@@ -28,13 +28,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#define _GNU_SOURCE
+
 #include <signal.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <link.h>
 #include "dwarfy.h"
 #include "valve.h"
 #include "libvalve.h"
@@ -48,6 +55,10 @@ long int LIBVALVE_NUM_MALLOCS;
 long int LIBVALVE_NUM_CALLOCS;
 long int LIBVALVE_NUM_REALLOCS;
 long int LIBVALVE_NUM_FREES;
+long int LIBVALVE_NUM_LIVE_BLOCKS;
+unsigned long int LIBVALVE_NUM_LIVE_BYTES;
+unsigned long int LIBVALVE_NUM_BYTES_ALLOCATED;
+int LIBVALVE_TRACKING = 1; /* cleared by the control socket's disable command */
 
 int VALVE_INSTANCE_COUNTER;
 int LIBVALVE_INIT_COUNTER;
@@ -57,43 +68,228 @@ long int LIBVALVE_REGION_BASE[LIBVALVE_MAX_NUM_REGIONS];
 long int LIBVALVE_NUM_REGIONS;
 
 AllocationPointTree_t ALLOCATION_POINTS;
+unsigned long int LIBVALVE_NUM_ALLOCATION_POINTS;
+pthread_mutex_t LIBVALVE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+sem_t LIBVALVE_SNAPSHOT_REQUEST;
+pthread_t LIBVALVE_SNAPSHOT_THREAD;
+int LIBVALVE_NUM_SNAPSHOTS;
+pid_t LIBVALVE_SNAPSHOT_PIDS[LIBVALVE_MAX_NUM_SNAPSHOT_PIDS]; /* snapshot children not yet reaped */
+int LIBVALVE_NUM_SNAPSHOT_PIDS;
+pid_t LIBVALVE_REPORT_PID; /* the process a report describes; a snapshot child reports on its parent */
 
 DWARF_DATAList_t DWARFY_PROGRAM;
 
-void leak_report(void);
+char *LIBVALVE_REPORT_EXTENSIONS[] = {"txt","pb.gz","ndjson","snap"};
+
+int libvalve_write_flame_report(char *path);
+void libvalve_snapshot_signal_handler(int signal_number);
+void *libvalve_snapshot_thread(void *arg);
+void libvalve_reap_snapshots(int wait);
+
+/* the addresses are compared rather than subtracted: a difference truncated to int would order blocks in the brk
+   heap and in mmap'd chunks inconsistently, and corrupt the trees */
 
 int compare_allocation_points(AllocationPoint *a1,AllocationPoint *a2)
 {
-  return a1->address - a2->address;
+  return (a1->address > a2->address) - (a1->address < a2->address);
 }
 
 int compare_memory_blocks(MemoryBlock *mb1,MemoryBlock *mb2)
 {
-  return mb1->address - mb2->address;
+  return (mb1->address > mb2->address) - (mb1->address < mb2->address);
+}
+
+int compare_allocation_point_samples(const void *s1,const void *s2)
+{
+  long int a1 = ((AllocationPointSample*)s1)->address;
+  long int a2 = ((AllocationPointSample*)s2)->address;
+  
+  return (a1 > a2) - (a1 < a2);
 }
 
 void  __attribute__((constructor)) libvalve_init()
 {
   int shmid;
   int i = 0;
+  int j;
   char name[256];
+  DwarfyLoadRequest requests[LIBVALVE_MAX_NUM_LIBRARIES];
+  int num_threads;
+  struct timespec start,end;
   
   LIBVALVE_NUM_ALLOCS = LIBVALVE_NUM_MALLOCS = LIBVALVE_NUM_CALLOCS = LIBVALVE_NUM_REALLOCS = LIBVALVE_NUM_FREES = 0;
+  LIBVALVE_NUM_LIVE_BLOCKS = LIBVALVE_NUM_LIVE_BYTES = LIBVALVE_NUM_BYTES_ALLOCATED = 0;
   
   RB_INIT(&ALLOCATION_POINTS);
+  LIBVALVE_NUM_ALLOCATION_POINTS = 0;
+  libvalve_thread_init();
   
   shmid = shmget(ftok("/usr/local/lib/libvalve.so",1),LIBVALVE_MAX_NUM_LIBRARIES * sizeof(Library),0666);
   LIBVALVE_SHARED_MEM =shmat(shmid,0,0);
   
   raise(SIGTRAP);
   
+  /* find_file() is not re-entrant, so the objects are found first and then loaded in parallel */
+  clock_gettime(CLOCK_MONOTONIC,&start);
   while(strlen(LIBVALVE_SHARED_MEM->libraries[i].name))
   {
     strcpy(name,file_part(LIBVALVE_SHARED_MEM->libraries[i].name));
-    LIBVALVE_SHARED_MEM->libraries[i].dwarf = load_dwarf(find_file(name,"."),LIBVALVE_SHARED_MEM->libraries[i].base_address);
+    requests[i].file_name = find_file(name,".");
+    requests[i].runtime_address = LIBVALVE_SHARED_MEM->libraries[i].base_address;
     i++;
   }
   
+  num_threads = LIBVALVE_SHARED_MEM->config.num_load_threads ? LIBVALVE_SHARED_MEM->config.num_load_threads : dwarfy_num_cpus();
+  load_dwarf_parallel(requests,i,num_threads);
+  for(j = 0; j < i; j++)
+  {
+    LIBVALVE_SHARED_MEM->libraries[j].dwarf = requests[j].dwarf;
+    free(requests[j].file_name);
+  }
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  
+  if(LIBVALVE_SHARED_MEM->config.num_load_threads)
+    fprintf(stderr,"[libvalve] Loaded debug information for %d object(s) in %.1f ms using %d thread(s)\n",i,
+            (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0,num_threads < i ? num_threads : i);
+  
+  LIBVALVE_NUM_SNAPSHOTS = 0;
+  LIBVALVE_NUM_SNAPSHOT_PIDS = 0;
+  LIBVALVE_REPORT_PID = getpid();
+  
+  if(LIBVALVE_SHARED_MEM->config.snapshot_signal)
+  {
+    struct sigaction action;
+    
+    sem_init(&LIBVALVE_SNAPSHOT_REQUEST,0,0);
+    pthread_create(&LIBVALVE_SNAPSHOT_THREAD,0,libvalve_snapshot_thread,0);
+    
+    memset(&action,0,sizeof(action));
+    action.sa_handler = libvalve_snapshot_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(LIBVALVE_SHARED_MEM->config.snapshot_signal,&action,0);
+  }
+  
+  if(LIBVALVE_SHARED_MEM->config.profile_interval_bytes || LIBVALVE_SHARED_MEM->config.profile_interval_seconds)
+    libvalve_profile_init();
+  
+  if(LIBVALVE_SHARED_MEM->config.growth_epoch_seconds)
+    libvalve_growth_init();
+  
+  if(strlen(LIBVALVE_SHARED_MEM->config.metrics_path))
+    libvalve_metrics_init();
+  
+  if(LIBVALVE_SHARED_MEM->config.control)
+    libvalve_control_init();
+  
+}
+
+void libvalve_snapshot_signal_handler(int signal_number)
+{
+  /* only async-signal-safe work here; the snapshot thread does the rest */
+  sem_post(&LIBVALVE_SNAPSHOT_REQUEST);
+}
+
+void *libvalve_snapshot_thread(void *arg)
+{
+  for(;;)
+  {
+    if(sem_wait(&LIBVALVE_SNAPSHOT_REQUEST) == 0)
+      libvalve_snapshot(0,0);
+  }
+  return 0;
+}
+
+/* fork() the target so that the child holds a frozen copy-on-write image of the allocation tables;
+   the child writes the report while the parent only pauses for the duration of the fork.
+   snapshots are numbered, and also carry name in their file names when one is given;
+   a path, when given, replaces the numbered file name altogether */
+
+int libvalve_snapshot(const char *name,const char *path_override)
+{
+  pid_t pid;
+  int snapshot_num;
+  struct timespec start,end;
+  char stem[256];
+  char path[512];
+  int i;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  libvalve_reap_snapshots(0);
+  if(LIBVALVE_NUM_SNAPSHOT_PIDS == LIBVALVE_MAX_NUM_SNAPSHOT_PIDS) /* too many still writing: wait for the oldest */
+  {
+    waitpid(LIBVALVE_SNAPSHOT_PIDS[0],0,0);
+    LIBVALVE_NUM_SNAPSHOT_PIDS--;
+    memmove(LIBVALVE_SNAPSHOT_PIDS,LIBVALVE_SNAPSHOT_PIDS + 1,LIBVALVE_NUM_SNAPSHOT_PIDS * sizeof(pid_t));
+  }
+  
+  snapshot_num = ++LIBVALVE_NUM_SNAPSHOTS;
+  snprintf(stem,256,name ? "%d.%s" : "%d",snapshot_num,name);
+  for(i = 0; stem[i]; i++)
+  {
+    if(stem[i] == '/' || stem[i] == ' ')
+      stem[i] = '_';
+  }
+  if(path_override)
+    snprintf(path,512,"%s",path_override);
+  else
+    snprintf(path,512,"%s/valve.%d.%s.%s",LIBVALVE_SHARED_MEM->config.output_directory,(int)getpid(),stem,LIBVALVE_REPORT_EXTENSIONS[LIBVALVE_SHARED_MEM->config.report_format]);
+  
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  pid = fork();
+  
+  if(pid == 0)
+  {
+    int result;
+    
+    LIBVALVE_REPORT_PID = getppid();
+    result = libvalve_write_report(path);
+    
+    if(LIBVALVE_SHARED_MEM->config.flame_mode)
+    {
+      if(path_override)
+        snprintf(path,512,"%s.folded",path_override);
+      else
+        snprintf(path,512,"%s/valve.%d.%s.folded",LIBVALVE_SHARED_MEM->config.output_directory,(int)LIBVALVE_REPORT_PID,stem);
+      result |= libvalve_write_flame_report(path);
+    }
+    _exit(result ? 1 : 0);
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  
+  if(pid > 0)
+    LIBVALVE_SNAPSHOT_PIDS[LIBVALVE_NUM_SNAPSHOT_PIDS++] = pid;
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  if(pid == -1)
+  {
+    fprintf(stderr,"[libvalve] Error: unable to fork snapshot process.\n");
+    return -1;
+  }
+  
+  fprintf(stderr,"[libvalve] Snapshot %d: %s (fork pause %.3f ms)\n",snapshot_num,path,
+          (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+  
+  return snapshot_num;
+}
+
+/* reap the snapshot children that have exited, or with wait set all of them; each is waited for by its own pid, since
+   waiting for any child would also take the target's own. the caller holds LIBVALVE_LOCK */
+
+void libvalve_reap_snapshots(int wait)
+{
+  int i,j;
+  
+  for(i = 0, j = 0; i < LIBVALVE_NUM_SNAPSHOT_PIDS; i++)
+  {
+    if(waitpid(LIBVALVE_SNAPSHOT_PIDS[i],0,wait ? 0 : WNOHANG) == 0)
+      LIBVALVE_SNAPSHOT_PIDS[j++] = LIBVALVE_SNAPSHOT_PIDS[i];
+  }
+  LIBVALVE_NUM_SNAPSHOT_PIDS = j;
 }
 
 AllocationPoint *create_allocation_point(long int address)
@@ -105,10 +301,50 @@ AllocationPoint *create_allocation_point(long int address)
   RB_INIT(&allocation_point->memory_blocks);
   allocation_point->address = address;
   RB_INSERT(AllocationPointTree,&ALLOCATION_POINTS,allocation_point);
+  LIBVALVE_NUM_ALLOCATION_POINTS++;
   
   return allocation_point;
 }
 
+/* copy every allocation point's counters, sorted by address, so that reports can be written without holding the lock */
+
+AllocationPointSample *libvalve_sample_allocation_points(unsigned long int *num_samples)
+{
+  AllocationPointSample *samples;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  samples = libvalve_copy_allocation_points(num_samples);
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  return samples;
+}
+
+/* as above, for callers that already hold LIBVALVE_LOCK (or are a snapshot child) */
+
+AllocationPointSample *libvalve_copy_allocation_points(unsigned long int *num_samples)
+{
+  AllocationPointSample *samples;
+  AllocationPoint *allocation_point;
+  unsigned long int i = 0;
+  
+  samples = malloc((LIBVALVE_NUM_ALLOCATION_POINTS + 1) * sizeof(AllocationPointSample));
+  
+  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  {
+    samples[i].address = allocation_point->address;
+    samples[i].current_num_allocations = allocation_point->current_num_allocations;
+    samples[i].current_bytes_allocated = allocation_point->current_bytes_allocated;
+    samples[i].total_num_allocations = allocation_point->total_num_allocations;
+    samples[i].total_bytes_allocated = allocation_point->total_bytes_allocated;
+    i++;
+  }
+  
+  qsort(samples,i,sizeof(AllocationPointSample),compare_allocation_point_samples);
+  *num_samples = i;
+  
+  return samples;
+}
+
 MemoryBlock *create_memory_block(unsigned long int address,size_t size,AllocationPoint *allocation_point)
 {
   MemoryBlock *memory_block;
@@ -117,8 +353,22 @@ MemoryBlock *create_memory_block(unsigned long int address,size_t size,Allocatio
   memory_block->address = address;
   memory_block->size = size;
   memory_block->allocation_point = allocation_point;
+  memory_block->scope = LIBVALVE_SCOPE;
+  memory_block->tag = LIBVALVE_CURRENT_TAG();
   
   RB_INSERT(MemoryBlockTree,&allocation_point->memory_blocks,memory_block);
+  libvalve_thread_allocate(memory_block);
+  
+  LIBVALVE_TAGS[memory_block->tag].current_num_allocations++;
+  LIBVALVE_TAGS[memory_block->tag].current_bytes_allocated += size;
+  LIBVALVE_TAGS[memory_block->tag].total_num_allocations++;
+  LIBVALVE_TAGS[memory_block->tag].total_bytes_allocated += size;
+  
+  if(memory_block->scope)
+  {
+    LIST_INSERT_HEAD(&memory_block->scope->memory_blocks,memory_block,ScopeLinks);
+    memory_block->scope->num_allocations++;
+  }
   
   return memory_block;
 }
@@ -141,8 +391,13 @@ void *malloc_wrapper(size_t size)
     : "rax"
   );
   
+  if(!__atomic_load_n(&LIBVALVE_TRACKING,__ATOMIC_RELAXED))
+    return malloc(size);
+  
   match_allocation_point.address = return_address;
 
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
   if(0 == (allocation_point = RB_FIND(AllocationPointTree,&ALLOCATION_POINTS,&match_allocation_point)))
     allocation_point = create_allocation_point(match_allocation_point.address);
   
@@ -151,12 +406,20 @@ void *malloc_wrapper(size_t size)
   allocation_point->total_num_allocations++;
   allocation_point->total_bytes_allocated += size;
 
+  if(LIBVALVE_SHARED_MEM->config.profile_interval_bytes)
+    libvalve_profile_count(size);
+  
   result = malloc(size);
   
   memory_block = create_memory_block((unsigned long int)result,size,allocation_point);
 
   LIBVALVE_NUM_ALLOCS++;
   LIBVALVE_NUM_MALLOCS++;
+  LIBVALVE_NUM_LIVE_BLOCKS++;
+  LIBVALVE_NUM_LIVE_BYTES += size;
+  LIBVALVE_NUM_BYTES_ALLOCATED += size;
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
   
   return result;
 }
@@ -179,8 +442,13 @@ void *calloc_wrapper(size_t num,size_t size)
     : "rax"
   );
   
+  if(!__atomic_load_n(&LIBVALVE_TRACKING,__ATOMIC_RELAXED))
+    return calloc(num,size);
+  
   match_allocation_point.address = return_address;
   
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
   if(0 == (allocation_point = RB_FIND(AllocationPointTree,&ALLOCATION_POINTS,&match_allocation_point)))
     allocation_point = create_allocation_point(match_allocation_point.address);
   
@@ -189,13 +457,21 @@ void *calloc_wrapper(size_t num,size_t size)
   allocation_point->total_num_allocations++;
   allocation_point->total_bytes_allocated += num * size;
 
+  if(LIBVALVE_SHARED_MEM->config.profile_interval_bytes)
+    libvalve_profile_count(num * size);
+  
   result = calloc(num,size);
   
   memory_block = create_memory_block((unsigned long int)result,num * size,allocation_point);
 
   LIBVALVE_NUM_ALLOCS++;
   LIBVALVE_NUM_CALLOCS++;
+  LIBVALVE_NUM_LIVE_BLOCKS++;
+  LIBVALVE_NUM_LIVE_BYTES += num * size;
+  LIBVALVE_NUM_BYTES_ALLOCATED += num * size;
 
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
   return result;
 }
 
@@ -207,10 +483,14 @@ void *realloc_wrapper(void *ptr,size_t size)
   AllocationPoint match_allocation_point;
   AllocationPoint *allocation_point;
   MemoryBlock *memory_block,match_memory_block;
+  LibvalveThread *previous_thread;
+  size_t previous_size;
   match_memory_block.address = (unsigned long int)ptr;
   
   memory_block = 0;
   
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
   RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
   {
     if((memory_block = RB_FIND(MemoryBlockTree,&allocation_point->memory_blocks,&match_memory_block)))
@@ -218,7 +498,10 @@ void *realloc_wrapper(void *ptr,size_t size)
   }
   
   if(memory_block == 0)
+  {
+    pthread_mutex_unlock(&LIBVALVE_LOCK);
     return realloc(ptr,size);
+  }
   
   __asm__
   (
@@ -234,27 +517,47 @@ void *realloc_wrapper(void *ptr,size_t size)
   if(0 == (allocation_point = RB_FIND(AllocationPointTree,&ALLOCATION_POINTS,&match_allocation_point)))
     allocation_point = create_allocation_point(match_allocation_point.address);
   
-  if(allocation_point != memory_block->allocation_point)
-  {
-    RB_REMOVE(MemoryBlockTree,&memory_block->allocation_point->memory_blocks,memory_block);
-    memory_block->allocation_point->current_bytes_allocated -= memory_block->size;
-    memory_block->allocation_point->current_num_allocations--;
-    RB_INSERT(MemoryBlockTree,&allocation_point->memory_blocks,memory_block);
-  }
+  /* the block tree is keyed on address, so the block must come out before realloc() moves it */
+  RB_REMOVE(MemoryBlockTree,&memory_block->allocation_point->memory_blocks,memory_block);
+  previous_thread = libvalve_thread_release(memory_block);
+  previous_size = memory_block->size;
+  memory_block->allocation_point->current_bytes_allocated -= memory_block->size;
+  memory_block->allocation_point->current_num_allocations--;
+  LIBVALVE_NUM_LIVE_BYTES -= memory_block->size;
+  LIBVALVE_TAGS[memory_block->tag].current_num_allocations--;
+  LIBVALVE_TAGS[memory_block->tag].current_bytes_allocated -= memory_block->size;
   
   allocation_point->current_bytes_allocated += size;
   allocation_point->total_bytes_allocated += size;
   allocation_point->current_num_allocations++;
   allocation_point->total_num_allocations++;
 
+  if(LIBVALVE_SHARED_MEM->config.profile_interval_bytes)
+    libvalve_profile_count(size);
+  
   result = realloc(ptr,size);
   
   memory_block->address = (unsigned long int)result;
   memory_block->size = size;
   memory_block->allocation_point = allocation_point;
+  RB_INSERT(MemoryBlockTree,&allocation_point->memory_blocks,memory_block);
+  libvalve_thread_allocate(memory_block);
+  
+  /* like the allocation point, the tag follows the block to whoever reallocated it */
+  memory_block->tag = LIBVALVE_CURRENT_TAG();
+  LIBVALVE_TAGS[memory_block->tag].current_num_allocations++;
+  LIBVALVE_TAGS[memory_block->tag].current_bytes_allocated += size;
+  LIBVALVE_TAGS[memory_block->tag].total_num_allocations++;
+  LIBVALVE_TAGS[memory_block->tag].total_bytes_allocated += size;
 
   LIBVALVE_NUM_ALLOCS++;
   LIBVALVE_NUM_REALLOCS++;
+  LIBVALVE_NUM_LIVE_BYTES += size;
+  LIBVALVE_NUM_BYTES_ALLOCATED += size;
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  libvalve_thread_count_release(previous_thread,previous_size);
   
   return result;
 }
@@ -264,131 +567,386 @@ void free_wrapper(void *ptr)
   MemoryBlock match;
   MemoryBlock *memory_block;
   AllocationPoint *allocation_point;
+  LibvalveThread *thread;
+  size_t size;
   match.address = (unsigned long int)ptr;
+  
+  thread = 0;
+  size = 0;
 
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
   RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
   {
     if((memory_block = RB_FIND(MemoryBlockTree,&allocation_point->memory_blocks,&match)))
     {
       allocation_point->current_num_allocations--;
       allocation_point->current_bytes_allocated -= memory_block->size;
+      LIBVALVE_NUM_LIVE_BLOCKS--;
+      LIBVALVE_NUM_LIVE_BYTES -= memory_block->size;
+      LIBVALVE_TAGS[memory_block->tag].current_num_allocations--;
+      LIBVALVE_TAGS[memory_block->tag].current_bytes_allocated -= memory_block->size;
       RB_REMOVE(MemoryBlockTree,&allocation_point->memory_blocks,memory_block);
+      libvalve_scope_forget(memory_block);
+      thread = libvalve_thread_release(memory_block);
+      size = memory_block->size;
+      free(memory_block);
+      break;
     }
 
   }
   
   LIBVALVE_NUM_FREES++;
   
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  libvalve_thread_count_release(thread,size);
+  libvalve_thread_count_free();
+  
   free(ptr);
 }
 
 __attribute__((destructor)) void libvalve_final()
 {
-  fprintf(stderr,"\n[libvalve] Memory usage summary:\n");
-  fprintf(stderr,"[libvalve] Application allocated %ld block(s)\n",LIBVALVE_NUM_ALLOCS);
-  fprintf(stderr,"[libvalve] (malloc: %ld, calloc: %ld, realloc: %ld)\n",LIBVALVE_NUM_MALLOCS,LIBVALVE_NUM_CALLOCS,LIBVALVE_NUM_REALLOCS);
-  fprintf(stderr,"[libvalve] Application freed %ld block(s)\n\n",LIBVALVE_NUM_FREES);
+  /* the last metrics describe the heap at exit (and take the lock themselves) */
+  if(strlen(LIBVALVE_SHARED_MEM->config.metrics_path))
+    libvalve_metrics_dump();
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  if(LIBVALVE_SHARED_MEM->config.control)
+    libvalve_control_final();
+  
+  libvalve_reap_snapshots(1);
+  
+  libvalve_summary(stderr);
+  
+  if(LIBVALVE_SHARED_MEM->config.report_format == LIBVALVE_REPORT_TEXT && !strlen(LIBVALVE_SHARED_MEM->config.output_path))
+  {
+    leak_report(stderr);
+  }
+  else
+  {
+    char path[512];
+    
+    if(strlen(LIBVALVE_SHARED_MEM->config.output_path))
+      strcpy(path,LIBVALVE_SHARED_MEM->config.output_path);
+    else
+      snprintf(path,512,"%s/valve.%d.%s",LIBVALVE_SHARED_MEM->config.output_directory,(int)getpid(),LIBVALVE_REPORT_EXTENSIONS[LIBVALVE_SHARED_MEM->config.report_format]);
+    if(libvalve_write_report(path) == 0)
+      fprintf(stderr,"[libvalve] Report written to %s\n",path);
+    else
+      fprintf(stderr,"[libvalve] Error: unable to write report \"%s\".\n",path);
+  }
+  
+  if(LIBVALVE_SHARED_MEM->config.flame_mode)
+  {
+    char path[512];
+    
+    snprintf(path,512,"%s/valve.%d.folded",LIBVALVE_SHARED_MEM->config.output_directory,(int)getpid());
+    if(libvalve_write_flame_report(path) == 0)
+      fprintf(stderr,"[libvalve] Folded stacks written to %s\n",path);
+    else
+      fprintf(stderr,"[libvalve] Error: unable to write folded stacks \"%s\".\n",path);
+  }
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+}
+
+int libvalve_write_flame_report(char *path)
+{
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  int result;
+  
+  samples = libvalve_copy_allocation_points(&num_samples);
+  result = libvalve_write_flame(path,samples,num_samples,LIBVALVE_SHARED_MEM->config.flame_mode);
+  free(samples);
   
-  leak_report();
+  return result;
 }
 
-void leak_report()
+/* write a report in the configured format; the caller holds LIBVALVE_LOCK (or is a snapshot child) */
+
+int libvalve_write_report(char *path)
 {
-  AllocationPoint *allocation_point;
-  MemoryBlock *memory_block;
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  FILE *out;
+  int result;
+  
+  switch(LIBVALVE_SHARED_MEM->config.report_format)
+  {
+    case LIBVALVE_REPORT_PPROF:
+    {
+      samples = libvalve_copy_allocation_points(&num_samples);
+      result = libvalve_write_pprof(path,samples,num_samples);
+      free(samples);
+      return result;
+    }
+    case LIBVALVE_REPORT_JSON:
+    {
+      samples = libvalve_copy_allocation_points(&num_samples);
+      result = libvalve_write_json(path,samples,num_samples);
+      free(samples);
+      return result;
+    }
+    case LIBVALVE_REPORT_SNAPSHOT:
+    {
+      return libvalve_write_heap_snapshot(path);
+    }
+    default:
+    {
+      if(0 == (out = fopen(path,"w")))
+        return -1;
+      setvbuf(out,0,_IOFBF,1 << 20);
+      libvalve_summary(out);
+      leak_report(out);
+      fclose(out);
+      return 0;
+    }
+  }
+}
+
+void libvalve_summary(FILE *out)
+{
+  fprintf(out,"\n[libvalve] Memory usage summary:\n");
+  fprintf(out,"[libvalve] Application allocated %ld block(s)\n",LIBVALVE_NUM_ALLOCS);
+  fprintf(out,"[libvalve] (malloc: %ld, calloc: %ld, realloc: %ld)\n",LIBVALVE_NUM_MALLOCS,LIBVALVE_NUM_CALLOCS,LIBVALVE_NUM_REALLOCS);
+  fprintf(out,"[libvalve] Application freed %ld block(s)\n\n",LIBVALVE_NUM_FREES);
+  
+  if(LIBVALVE_NUM_TAGS > 1)
+    libvalve_tag_report(out);
+  
+  if(LIBVALVE_NUM_THREADS > 1)
+    libvalve_thread_report(out);
+}
+
+int libvalve_symbolize(unsigned long int address,DwarfySymbol *symbol)
+{
+  int i = 0;
+  
+  while(strlen(LIBVALVE_SHARED_MEM->libraries[i].name))
+  {
+    if(LIBVALVE_SHARED_MEM->libraries[i].dwarf && dwarfy_symbolize(LIBVALVE_SHARED_MEM->libraries[i].dwarf,address,symbol))
+      return 1;
+    i++;
+  }
+  
+  return 0;
+}
+
+int libvalve_read_build_id(struct dl_phdr_info *info,LibvalveModule *module)
+{
+  ElfW(Nhdr) *note;
+  unsigned char *address,*end;
+  int i;
+  
+  for(i = 0; i < info->dlpi_phnum; i++)
+  {
+    if(info->dlpi_phdr[i].p_type != PT_NOTE)
+      continue;
+    
+    address = (unsigned char*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+    end = address + info->dlpi_phdr[i].p_memsz;
+    
+    while(address + sizeof(ElfW(Nhdr)) <= end)
+    {
+      note = (ElfW(Nhdr)*)address;
+      address += sizeof(ElfW(Nhdr)) + ((note->n_namesz + 3) & ~3);
+      if(note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && !memcmp(note + 1,"GNU",4) && note->n_descsz <= 32)
+      {
+        memcpy(module->build_id,address,note->n_descsz);
+        return module->build_id_size = note->n_descsz;
+      }
+      address += (note->n_descsz + 3) & ~3;
+    }
+  }
+  
+  return 0;
+}
+
+typedef struct
+{
+  LibvalveModule *modules;
+  int num_modules;
+  int max_num_modules;
+} LibvalveModuleList;
+
+int libvalve_add_module(struct dl_phdr_info *info,size_t size,void *data)
+{
+  LibvalveModuleList *list = data;
+  LibvalveModule *module;
+  unsigned long int start,end;
+  int i;
+  
+  if(list->num_modules == list->max_num_modules)
+    return 1;
+  
+  module = &list->modules[list->num_modules];
+  memset(module,0,sizeof(LibvalveModule));
+  module->start = ~0UL;
+  
+  for(i = 0; i < info->dlpi_phnum; i++)
+  {
+    if(info->dlpi_phdr[i].p_type != PT_LOAD)
+      continue;
+    start = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+    end = start + info->dlpi_phdr[i].p_memsz;
+    if(start < module->start)
+      module->start = start;
+    if(end > module->limit)
+      module->limit = end;
+  }
+  
+  if(module->limit == 0)
+    return 0;
+  
+  /* the dynamic linker leaves the main program's name empty */
+  strncpy(module->name,(info->dlpi_name && info->dlpi_name[0]) ? info->dlpi_name : LIBVALVE_SHARED_MEM->libraries[0].name,255);
+  libvalve_read_build_id(info,module);
+  
+  list->num_modules++;
+  return 0;
+}
+
+int libvalve_load_modules(LibvalveModule *modules,int max_num_modules)
+{
+  LibvalveModuleList list;
+  
+  list.modules = modules;
+  list.num_modules = 0;
+  list.max_num_modules = max_num_modules;
+  dl_iterate_phdr(libvalve_add_module,&list);
+  
+  return list.num_modules;
+}
 
-  DwarfyObjectRecord match_location_record;
-  DwarfyFunction match_function;
-  DwarfyFunction *nearest_function;
-  DwarfySourceCode match_source_file;
+/* the caller holds LIBVALVE_LOCK (or is a snapshot child) */
+
+void leak_report(FILE *out)
+{
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  
+  samples = libvalve_copy_allocation_points(&num_samples);
+  libvalve_leak_report_samples(out,samples,num_samples);
+  free(samples);
+}
+
+/* the leak report proper, from copied counters, so that it may be symbolized and written without the lock */
+
+void libvalve_leak_report_samples(FILE *out,AllocationPointSample *samples,unsigned long int num_samples)
+{
+  AllocationPointSample *sample;
+  DwarfySymbol symbol;
   DwarfySourceCode *source_code;
-  DwarfyCompilationUnit *compilation_unit;
-  int matched;
   unsigned long int num_leaks;
   int line_number;
-  unsigned long int elf_address = 0;
-  char *name;
-  int i;
-  DwarfyObjectRecord *nearest_object_record;
-  DwarfySourceRecord *nearest_source_record;
+  int line_length;
+  char *line;
   
-  fprintf(stderr,"[libvalve] Leak report:\n");
+  fprintf(out,"[libvalve] Leak report:\n");
   
   num_leaks = 0;
   
-  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  for(sample = samples; sample < samples + num_samples; sample++)
   {
-    if(allocation_point->current_num_allocations)
+    if(sample->current_bytes_allocated && sample->current_num_allocations)
     {
-      elf_address = allocation_point->address;// - (long int)info.dli_fbase;
-      nearest_object_record = 0;
-      matched = 0;
-      compilation_unit = 0;
+      num_leaks += sample->current_num_allocations;
       
-      do
+      /* the return address points past the call; step back into it */
+      if(!libvalve_symbolize(sample->address - 1,&symbol))
       {
-        elf_address--;
-        match_location_record.address = elf_address;
-        
-        i = 0;
-        while(strlen(LIBVALVE_SHARED_MEM->libraries[i].name))
-        {
-          if(LIBVALVE_SHARED_MEM->libraries[i].dwarf)
-          {
-            LIST_FOREACH(compilation_unit,&LIBVALVE_SHARED_MEM->libraries[i].dwarf->compilation_units,linkage)
-            {
-              if((nearest_object_record = RB_FIND(DwarfyObjectRecordTree,&compilation_unit->line_numbers,&match_location_record)))
-              {
-                nearest_source_record = LIST_FIRST(&nearest_object_record->source_records);
-                matched = 1;
-                break;
-              }
-            }
-          }
-          if(matched) break;
-          i++;
-        }
-        
-      } while(!matched);
+        fprintf(out,"[libvalve] 0x%lx [in unknown function]: %lu bytes leaked in %lu block(s)\n\n",sample->address,sample->current_bytes_allocated,sample->current_num_allocations);
+        continue;
+      }
       
-      nearest_function = 0;
+      fprintf(out,"[libvalve] %s:%u [in function %s(...)]: %lu bytes leaked in %lu block(s)\n\n",symbol.file_name,symbol.line_number,symbol.function_name,sample->current_bytes_allocated,sample->current_num_allocations); 
       
-      do
+      if((source_code = dwarfy_source_code(&symbol)))
       {
-        elf_address--;
-        match_function.address = elf_address;
-        nearest_function = RB_FIND(DwarfyFunctionTree,&compilation_unit->functions,&match_function);
-      } while (!nearest_function);
-
-      if(allocation_point->current_bytes_allocated && allocation_point->current_num_allocations)
-      {
-        
-        num_leaks += allocation_point->current_num_allocations;
-        
-        fprintf(stderr,"[libvalve] %s:%u [in function %s(...)]: %lu bytes leaked in %lu block(s)\n\n",compilation_unit->file_names[nearest_source_record->file - 1],nearest_source_record->line_number,nearest_function->name,allocation_point->current_bytes_allocated,allocation_point->current_num_allocations); 
-        match_source_file.file_name = compilation_unit->file_names[nearest_source_record->file - 1];
-        
-        source_code = RB_FIND(DwarfySourceCodeTree,&compilation_unit->source_code,&match_source_file);
-
-        for(line_number = nearest_source_record->line_number - LIBVALVE_SHARED_MEM->config.context_num_lines; line_number <= nearest_source_record->line_number + LIBVALVE_SHARED_MEM->config.context_num_lines; line_number++)
+        for(line_number = symbol.line_number - LIBVALVE_SHARED_MEM->config.context_num_lines; line_number <= (int)(symbol.line_number + LIBVALVE_SHARED_MEM->config.context_num_lines); line_number++)
         {
-            if(line_number > 0 && line_number <= source_code->num_lines)
+            if((line_length = dwarfy_source_line(source_code,line_number,&line)) >= 0)
             {
-              if(line_number == nearest_source_record->line_number)
-                fprintf(stderr,"-> %d: %s\n",line_number,source_code->source_code[line_number - 1]);
+              if(line_number == (int)symbol.line_number)
+                fprintf(out,"-> %d: %.*s\n",line_number,line_length,line);
               else
-                fprintf(stderr,"   %d: %s\n",line_number,source_code->source_code[line_number - 1]);
+                fprintf(out,"   %d: %.*s\n",line_number,line_length,line);
             }
         }
-        
-        fprintf(stderr,"\n");
-        
       }
+      
+      fprintf(out,"\n");
     }
   }
 
   if(num_leaks == 0)
   {
-    fprintf(stderr,"[libvalve] No leaks detected.\n");
+    fprintf(out,"[libvalve] No leaks detected.\n");
+  }
+}
+
+typedef struct
+{
+  AllocationPoint *allocation_point;
+  unsigned long int num_blocks;
+  unsigned long int num_bytes;
+} LibvalveBlockGroup;
+
+int compare_block_groups(const void *g1,const void *g2)
+{
+  unsigned long int b1 = ((LibvalveBlockGroup*)g1)->num_bytes;
+  unsigned long int b2 = ((LibvalveBlockGroup*)g2)->num_bytes;
+  
+  return (b1 < b2) - (b1 > b2);
+}
+
+int compare_blocks_by_allocation_point(const void *b1,const void *b2)
+{
+  AllocationPoint *a1 = (*(MemoryBlock**)b1)->allocation_point;
+  AllocationPoint *a2 = (*(MemoryBlock**)b2)->allocation_point;
+  
+  return (a1 > a2) - (a1 < a2);
+}
+
+/* print a set of live blocks grouped by allocation point, most bytes first; the caller holds LIBVALVE_LOCK or passes
+   copies of the blocks. memory_blocks is reordered */
+
+void libvalve_report_memory_blocks(FILE *out,MemoryBlock **memory_blocks,unsigned long int num_blocks)
+{
+  LibvalveBlockGroup *groups;
+  DwarfySymbol symbol;
+  unsigned long int num_groups;
+  unsigned long int i;
+  
+  groups = malloc((num_blocks + 1) * sizeof(LibvalveBlockGroup));
+  qsort(memory_blocks,num_blocks,sizeof(MemoryBlock*),compare_blocks_by_allocation_point);
+  
+  num_groups = 0;
+  for(i = 0; i < num_blocks; i++)
+  {
+    if(i == 0 || memory_blocks[i]->allocation_point != memory_blocks[i - 1]->allocation_point)
+    {
+      groups[num_groups].allocation_point = memory_blocks[i]->allocation_point;
+      groups[num_groups].num_blocks = 0;
+      groups[num_groups].num_bytes = 0;
+      num_groups++;
+    }
+    groups[num_groups - 1].num_blocks++;
+    groups[num_groups - 1].num_bytes += memory_blocks[i]->size;
   }
+  qsort(groups,num_groups,sizeof(LibvalveBlockGroup),compare_block_groups);
+  
+  for(i = 0; i < num_groups; i++)
+  {
+    if(libvalve_symbolize(groups[i].allocation_point->address - 1,&symbol))
+      fprintf(out,"[libvalve]   %s:%u [in function %s(...)]: %lu bytes in %lu block(s)\n",symbol.file_name,symbol.line_number,symbol.function_name,groups[i].num_bytes,groups[i].num_blocks);
+    else
+      fprintf(out,"[libvalve]   0x%lx [in unknown function]: %lu bytes in %lu block(s)\n",groups[i].allocation_point->address,groups[i].num_bytes,groups[i].num_blocks);
+  }
+  
+  free(groups);
 }
@@ -31,11 +31,16 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef LIBVALVE_H
 #define LIBVALVE_H
 
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/queue.h>
 #ifdef LINUX
 #include "tree.h"
 #elif defined(FREEBSD)
 #include <sys/tree.h>
 #endif
+#include "dwarfy.h"
+#include "valve.h"
 
 typedef RB_HEAD(AllocationPointTree,AllocationPoint) AllocationPointTree_t;
 typedef RB_HEAD(MemoryBlockTree,MemoryBlock) MemoryBlockTree_t;
@@ -58,17 +63,153 @@ int compare_allocation_points(AllocationPoint *a1,AllocationPoint *a2);
 RB_PROTOTYPE(AllocationPointTree,AllocationPoint,AllocationPointLinks,compare_allocation_points);
 
 typedef struct MemoryBlock MemoryBlock;
+typedef struct LibvalveScope LibvalveScope;
+typedef struct LibvalveThread LibvalveThread;
 
 struct MemoryBlock
 {
   unsigned long int address;
   size_t size;
   AllocationPoint *allocation_point;
+  LibvalveScope *scope; /* the leak-check scope the block was allocated in, if any */
+  int tag; /* index into LIBVALVE_TAGS */
+  LibvalveThread *thread; /* the thread that allocated the block */
   RB_ENTRY(MemoryBlock) MemoryBlockLinks;
+  LIST_ENTRY(MemoryBlock) ScopeLinks;
+  LIST_ENTRY(MemoryBlock) ThreadLinks;
 };
 
+struct LibvalveScope
+{
+  unsigned long int epoch;
+  char name[64];
+  unsigned long int num_allocations;
+  LIST_HEAD(LibvalveScopeBlocks,MemoryBlock) memory_blocks; /* allocated in the scope and not yet freed */
+  LibvalveScope *parent; /* scopes nest per thread */
+}; /* a VALVE_SCOPE_BEGIN/VALVE_SCOPE_END pair in one thread */
+
+struct LibvalveThread
+{
+  unsigned long int thread_num;
+  long int thread_id;
+  unsigned long int current_num_allocations; /* counters are updated atomically, and read without LIBVALVE_LOCK */
+  unsigned long int current_bytes_allocated;
+  unsigned long int total_num_allocations;
+  unsigned long int total_bytes_allocated;
+  unsigned long int num_frees;
+  int exited;
+  LIST_HEAD(LibvalveThreadBlocks,MemoryBlock) memory_blocks; /* live blocks the thread allocated; guarded by LIBVALVE_LOCK */
+  LibvalveThread *next;
+}; /* one per thread that has allocated, kept after the thread exits for the final table */
+
 int compare_memory_blocks(MemoryBlock *mb1,MemoryBlock *mb2);
 
 RB_PROTOTYPE(MemoryBlockTree,MemoryBlock,MemoryBlockLinks,compare_memory_blocks);
 
+typedef struct
+{
+  long int address;
+  unsigned long int current_num_allocations;
+  unsigned long int current_bytes_allocated;
+  unsigned long int total_num_allocations;
+  unsigned long int total_bytes_allocated;
+} AllocationPointSample; /* a copy of one AllocationPoint's counters, taken under LIBVALVE_LOCK */
+
+int compare_allocation_point_samples(const void *s1,const void *s2);
+
+typedef struct
+{
+  char name[256];
+  unsigned long int start;
+  unsigned long int limit;
+  unsigned char build_id[32];
+  int build_id_size;
+} LibvalveModule; /* a loaded object's address range, as seen by the dynamic linker */
+
+#define LIBVALVE_MAX_NUM_TAGS 256
+#define LIBVALVE_MAX_TAG_DEPTH 32
+#define LIBVALVE_MAX_NUM_SNAPSHOT_PIDS 64
+
+typedef struct
+{
+  char name[64];
+  unsigned long int current_num_allocations;
+  unsigned long int current_bytes_allocated;
+  unsigned long int total_num_allocations;
+  unsigned long int total_bytes_allocated;
+} LibvalveTag; /* per-subsystem totals for blocks allocated while a thread had the tag pushed; tag 0 is "untagged" */
+
+extern LibvalveSharedMem *LIBVALVE_SHARED_MEM;
+extern AllocationPointTree_t ALLOCATION_POINTS;
+extern pthread_mutex_t LIBVALVE_LOCK;
+extern pid_t LIBVALVE_REPORT_PID;
+extern __thread LibvalveScope *LIBVALVE_SCOPE __attribute__((tls_model("initial-exec")));
+extern LibvalveThread *LIBVALVE_THREADS;
+extern unsigned long int LIBVALVE_NUM_THREADS;
+extern LibvalveTag LIBVALVE_TAGS[LIBVALVE_MAX_NUM_TAGS];
+extern int LIBVALVE_NUM_TAGS;
+extern __thread int LIBVALVE_TAG_STACK[LIBVALVE_MAX_TAG_DEPTH] __attribute__((tls_model("initial-exec")));
+extern __thread int LIBVALVE_TAG_DEPTH __attribute__((tls_model("initial-exec")));
+
+/* the calling thread's current tag; pushes past LIBVALVE_MAX_TAG_DEPTH keep the deepest tag that fitted */
+#define LIBVALVE_CURRENT_TAG() (LIBVALVE_TAG_DEPTH == 0 ? 0 : LIBVALVE_TAG_STACK[(LIBVALVE_TAG_DEPTH < LIBVALVE_MAX_TAG_DEPTH ? LIBVALVE_TAG_DEPTH : LIBVALVE_MAX_TAG_DEPTH) - 1])
+extern long int LIBVALVE_NUM_ALLOCS;
+extern long int LIBVALVE_NUM_MALLOCS;
+extern long int LIBVALVE_NUM_CALLOCS;
+extern long int LIBVALVE_NUM_REALLOCS;
+extern long int LIBVALVE_NUM_FREES;
+extern long int LIBVALVE_NUM_LIVE_BLOCKS;
+extern unsigned long int LIBVALVE_NUM_LIVE_BYTES;
+extern unsigned long int LIBVALVE_NUM_BYTES_ALLOCATED;
+extern unsigned long int LIBVALVE_NUM_ALLOCATION_POINTS;
+extern int LIBVALVE_NUM_SNAPSHOTS;
+extern int LIBVALVE_TRACKING;
+
+int libvalve_snapshot(const char *name,const char *path); /* fork a copy-on-write snapshot of the tables; returns the snapshot number, or -1 */
+void leak_report(FILE *out);
+void libvalve_leak_report_samples(FILE *out,AllocationPointSample *samples,unsigned long int num_samples);
+void libvalve_report_memory_blocks(FILE *out,MemoryBlock **memory_blocks,unsigned long int num_blocks);
+void libvalve_summary(FILE *out);
+AllocationPointSample *libvalve_sample_allocation_points(unsigned long int *num_samples);
+AllocationPointSample *libvalve_copy_allocation_points(unsigned long int *num_samples);
+int libvalve_symbolize(unsigned long int address,DwarfySymbol *symbol);
+int libvalve_load_modules(LibvalveModule *modules,int max_num_modules);
+int libvalve_write_report(char *path);
+
+int libvalve_write_pprof(char *path,AllocationPointSample *samples,unsigned long int num_samples);
+int libvalve_write_json(char *path,AllocationPointSample *samples,unsigned long int num_samples);
+int libvalve_write_heap_snapshot(char *path);
+int libvalve_write_flame(char *path,AllocationPointSample *samples,unsigned long int num_samples,int mode);
+
+void libvalve_profile_init(void);
+void libvalve_profile_count(size_t size);
+int libvalve_profile_dump(void);
+
+void libvalve_growth_init(void);
+
+void libvalve_control_init(void);
+void libvalve_control_final(void);
+
+void libvalve_metrics_init(void);
+int libvalve_metrics_dump(void);
+void libvalve_write_metrics(FILE *out);
+
+long int libvalve_client_request(int request,const char *name,long int value);
+long int libvalve_client_leak_check(void);
+void libvalve_client_reset(void);
+long int libvalve_scope_begin(const char *name);
+long int libvalve_scope_end(void);
+void libvalve_scope_forget(MemoryBlock *memory_block);
+void libvalve_thread_init(void);
+void libvalve_thread_allocate(MemoryBlock *memory_block);
+LibvalveThread *libvalve_thread_release(MemoryBlock *memory_block);
+void libvalve_thread_count_release(LibvalveThread *thread,size_t size);
+void libvalve_thread_count_free(void);
+void libvalve_thread_report(FILE *out);
+void libvalve_thread_reset(void);
+int libvalve_tag_id(const char *name);
+int libvalve_tag_push(int tag);
+int libvalve_tag_pop(void);
+void libvalve_tag_report(FILE *out);
+
 #endif
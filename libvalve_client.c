@@ -0,0 +1,188 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+#include "valve_client.h"
+
+/* the libvalve side of valve_client.h */
+
+char LIBVALVE_PHASE_NAME[256] = "start";
+long int LIBVALVE_PHASE_NUM_ALLOCS;
+unsigned long int LIBVALVE_PHASE_BYTES_ALLOCATED;
+long int LIBVALVE_PHASE_NUM_LIVE_BLOCKS;
+
+long int libvalve_client_phase(const char *name)
+{
+  long int num_allocs;
+  unsigned long int bytes_allocated;
+  long int live_blocks_difference;
+  int profile_num;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  num_allocs = LIBVALVE_NUM_ALLOCS - LIBVALVE_PHASE_NUM_ALLOCS;
+  bytes_allocated = LIBVALVE_NUM_BYTES_ALLOCATED - LIBVALVE_PHASE_BYTES_ALLOCATED;
+  live_blocks_difference = LIBVALVE_NUM_LIVE_BLOCKS - LIBVALVE_PHASE_NUM_LIVE_BLOCKS;
+  
+  LIBVALVE_PHASE_NUM_ALLOCS = LIBVALVE_NUM_ALLOCS;
+  LIBVALVE_PHASE_BYTES_ALLOCATED = LIBVALVE_NUM_BYTES_ALLOCATED;
+  LIBVALVE_PHASE_NUM_LIVE_BLOCKS = LIBVALVE_NUM_LIVE_BLOCKS;
+  
+  fprintf(stderr,"[libvalve] Phase \"%s\": %ld allocation(s), %lu bytes; live blocks %+ld (now %ld)\n",
+          LIBVALVE_PHASE_NAME,num_allocs,bytes_allocated,live_blocks_difference,LIBVALVE_NUM_LIVE_BLOCKS);
+  
+  strncpy(LIBVALVE_PHASE_NAME,name ? name : "",255);
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  /* the profile describes the heap at the boundary */
+  if((profile_num = libvalve_profile_dump()) > 0)
+    fprintf(stderr,"[libvalve] Heap profile %d written at start of phase \"%s\"\n",profile_num,name ? name : "");
+  
+  return num_allocs;
+}
+
+/* the totals were reset; the caller holds LIBVALVE_LOCK */
+
+void libvalve_client_reset()
+{
+  LIBVALVE_PHASE_NUM_ALLOCS = LIBVALVE_NUM_ALLOCS;
+  LIBVALVE_PHASE_BYTES_ALLOCATED = LIBVALVE_NUM_BYTES_ALLOCATED;
+}
+
+/* the summary is composed in memory and the counters copied under the lock; symbolizing (which may parse units and map
+   source files) and writing to stderr happen after it is released, so allocating threads are not held up */
+
+long int libvalve_client_leak_check()
+{
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  char *summary;
+  size_t summary_size;
+  FILE *out;
+  long int num_live_blocks;
+  
+  summary = 0;
+  summary_size = 0;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  if((out = open_memstream(&summary,&summary_size)))
+  {
+    libvalve_summary(out);
+    fclose(out);
+  }
+  samples = libvalve_copy_allocation_points(&num_samples);
+  num_live_blocks = LIBVALVE_NUM_LIVE_BLOCKS;
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  fwrite(summary,1,summary_size,stderr);
+  libvalve_leak_report_samples(stderr,samples,num_samples);
+  
+  free(summary);
+  free(samples);
+  
+  return num_live_blocks;
+}
+
+long int libvalve_client_request(int request,const char *name,long int value)
+{
+  long int result;
+  
+  switch(request)
+  {
+    case VALVE_CLIENT_DO_LEAK_CHECK:
+    {
+      return libvalve_client_leak_check();
+    }
+    case VALVE_CLIENT_SNAPSHOT:
+    {
+      return libvalve_snapshot(name,0);
+    }
+    case VALVE_CLIENT_COUNT_LIVE:
+    {
+      pthread_mutex_lock(&LIBVALVE_LOCK);
+      result = LIBVALVE_NUM_LIVE_BLOCKS;
+      pthread_mutex_unlock(&LIBVALVE_LOCK);
+      return result;
+    }
+    case VALVE_CLIENT_PHASE:
+    {
+      return libvalve_client_phase(name);
+    }
+    case VALVE_CLIENT_SCOPE_BEGIN:
+    {
+      return libvalve_scope_begin(name);
+    }
+    case VALVE_CLIENT_SCOPE_END:
+    {
+      return libvalve_scope_end();
+    }
+    case VALVE_CLIENT_TAG:
+    {
+      return libvalve_tag_id(name);
+    }
+    case VALVE_CLIENT_TAG_PUSH:
+    {
+      return libvalve_tag_push(value);
+    }
+    case VALVE_CLIENT_TAG_POP:
+    {
+      return libvalve_tag_pop();
+    }
+    case VALVE_CLIENT_TAG_REPORT:
+    {
+      pthread_mutex_lock(&LIBVALVE_LOCK);
+      libvalve_tag_report(stderr);
+      pthread_mutex_unlock(&LIBVALVE_LOCK);
+      return 0;
+    }
+    case VALVE_CLIENT_TAG_LIVE_BYTES:
+    {
+      if(value < 0 || value >= LIBVALVE_MAX_NUM_TAGS)
+        return 0;
+      pthread_mutex_lock(&LIBVALVE_LOCK);
+      result = LIBVALVE_TAGS[value].current_bytes_allocated;
+      pthread_mutex_unlock(&LIBVALVE_LOCK);
+      return result;
+    }
+    default:
+    {
+      fprintf(stderr,"[libvalve] Warning: unknown client request %d.\n",request);
+      return 0;
+    }
+  }
+}
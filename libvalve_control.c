@@ -0,0 +1,390 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* a control socket for inspecting a long-running program without stopping it, e.g.
+   echo "top 20 live" | nc -U /tmp/valve.<pid>.sock
+   one command per line; every reply ends with a line "ok" or "error: ...". replies are composed in memory
+   and LIBVALVE_LOCK is only held while counters are copied, so a slow client never stalls the program */
+
+#define LIBVALVE_CONTROL_SORT_LIVE_BYTES 0
+#define LIBVALVE_CONTROL_SORT_LIVE_BLOCKS 1
+#define LIBVALVE_CONTROL_SORT_TOTAL_BYTES 2
+#define LIBVALVE_CONTROL_SORT_TOTAL_BLOCKS 3
+
+int LIBVALVE_CONTROL_SOCKET = -1;
+char LIBVALVE_CONTROL_PATH[256];
+pthread_t LIBVALVE_CONTROL_THREAD;
+__thread int LIBVALVE_CONTROL_SORT_KEY __attribute__((tls_model("initial-exec"))); /* per connection, for the qsort comparator */
+
+void *libvalve_control_thread(void *arg);
+void *libvalve_control_connection_thread(void *arg);
+void libvalve_control_serve(int connection);
+int libvalve_control_command(char *line,FILE *out);
+
+void libvalve_control_init()
+{
+  struct sockaddr_un address;
+  
+  if(strlen(LIBVALVE_SHARED_MEM->config.control_path))
+    strcpy(LIBVALVE_CONTROL_PATH,LIBVALVE_SHARED_MEM->config.control_path);
+  else
+    snprintf(LIBVALVE_CONTROL_PATH,256,"/tmp/valve.%d.sock",(int)getpid());
+  
+  if(strlen(LIBVALVE_CONTROL_PATH) >= sizeof(address.sun_path))
+  {
+    fprintf(stderr,"[libvalve] Error: control socket path \"%s\" is too long.\n",LIBVALVE_CONTROL_PATH);
+    return;
+  }
+  
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path,LIBVALVE_CONTROL_PATH);
+  
+  if(-1 == (LIBVALVE_CONTROL_SOCKET = socket(AF_UNIX,SOCK_STREAM,0)))
+  {
+    fprintf(stderr,"[libvalve] Error: unable to create control socket.\n");
+    return;
+  }
+  /* a program that execs should not hand the socket on */
+  fcntl(LIBVALVE_CONTROL_SOCKET,F_SETFD,FD_CLOEXEC);
+  
+  unlink(LIBVALVE_CONTROL_PATH);
+  if(bind(LIBVALVE_CONTROL_SOCKET,(struct sockaddr*)&address,sizeof(address)) == -1 || listen(LIBVALVE_CONTROL_SOCKET,4) == -1)
+  {
+    fprintf(stderr,"[libvalve] Error: unable to listen on control socket \"%s\".\n",LIBVALVE_CONTROL_PATH);
+    close(LIBVALVE_CONTROL_SOCKET);
+    LIBVALVE_CONTROL_SOCKET = -1;
+    return;
+  }
+  
+  pthread_create(&LIBVALVE_CONTROL_THREAD,0,libvalve_control_thread,0);
+  fprintf(stderr,"[libvalve] Control socket listening on %s\n",LIBVALVE_CONTROL_PATH);
+}
+
+/* called from libvalve_final; the thread itself dies with the process */
+
+void libvalve_control_final()
+{
+  if(LIBVALVE_CONTROL_SOCKET == -1)
+    return;
+  
+  close(LIBVALVE_CONTROL_SOCKET);
+  unlink(LIBVALVE_CONTROL_PATH);
+}
+
+/* each client is served on a detached thread of its own, so that one left connected does not lock the others out;
+   the commands that touch shared state take LIBVALVE_LOCK themselves */
+
+void *libvalve_control_thread(void *arg)
+{
+  pthread_attr_t attributes;
+  pthread_t thread;
+  int connection;
+  
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes,PTHREAD_CREATE_DETACHED);
+  
+  for(;;)
+  {
+    if(-1 == (connection = accept(LIBVALVE_CONTROL_SOCKET,0,0)))
+    {
+      if(errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+    fcntl(connection,F_SETFD,FD_CLOEXEC);
+    if(pthread_create(&thread,&attributes,libvalve_control_connection_thread,(void*)(long int)connection))
+      close(connection);
+  }
+  
+  pthread_attr_destroy(&attributes);
+  
+  return 0;
+}
+
+void *libvalve_control_connection_thread(void *arg)
+{
+  libvalve_control_serve((int)(long int)arg);
+  return 0;
+}
+
+void libvalve_control_serve(int connection)
+{
+  FILE *in;
+  FILE *out;
+  char line[512];
+  char *reply;
+  size_t reply_size;
+  size_t written;
+  ssize_t result;
+  int status;
+  
+  if(0 == (in = fdopen(connection,"r")))
+  {
+    close(connection);
+    return;
+  }
+  
+  while(fgets(line,512,in))
+  {
+    line[strcspn(line,"\r\n")] = 0;
+    
+    reply = 0;
+    reply_size = 0;
+    out = open_memstream(&reply,&reply_size);
+    status = libvalve_control_command(line,out);
+    if(status == 0)
+      fprintf(out,"ok\n");
+    fclose(out);
+    
+    for(written = 0; written < reply_size; written += result)
+    {
+      if((result = write(connection,reply + written,reply_size - written)) <= 0)
+      {
+        if(result == -1 && errno == EINTR)
+        {
+          result = 0;
+          continue;
+        }
+        status = 1;
+        break;
+      }
+    }
+    free(reply);
+    
+    /* 1 asks for the connection to be closed */
+    if(status == 1)
+      break;
+  }
+  
+  fclose(in);
+}
+
+void libvalve_control_stats(FILE *out)
+{
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  fprintf(out,"pid %d\n",(int)getpid());
+  fprintf(out,"tracking %s\n",LIBVALVE_TRACKING ? "enabled" : "disabled");
+  fprintf(out,"allocations %ld (malloc %ld, calloc %ld, realloc %ld)\n",LIBVALVE_NUM_ALLOCS,LIBVALVE_NUM_MALLOCS,LIBVALVE_NUM_CALLOCS,LIBVALVE_NUM_REALLOCS);
+  fprintf(out,"frees %ld\n",LIBVALVE_NUM_FREES);
+  fprintf(out,"bytes allocated %lu\n",LIBVALVE_NUM_BYTES_ALLOCATED);
+  fprintf(out,"live blocks %ld\n",LIBVALVE_NUM_LIVE_BLOCKS);
+  fprintf(out,"live bytes %lu\n",LIBVALVE_NUM_LIVE_BYTES);
+  fprintf(out,"allocation points %lu\n",LIBVALVE_NUM_ALLOCATION_POINTS);
+  fprintf(out,"threads %lu\n",LIBVALVE_NUM_THREADS);
+  fprintf(out,"snapshots %d\n",LIBVALVE_NUM_SNAPSHOTS);
+  
+  if(LIBVALVE_NUM_TAGS > 1)
+    libvalve_tag_report(out);
+  if(LIBVALVE_NUM_THREADS > 1)
+    libvalve_thread_report(out);
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+}
+
+unsigned long int libvalve_control_sort_value(AllocationPointSample *sample)
+{
+  switch(LIBVALVE_CONTROL_SORT_KEY)
+  {
+    case LIBVALVE_CONTROL_SORT_LIVE_BLOCKS: return sample->current_num_allocations;
+    case LIBVALVE_CONTROL_SORT_TOTAL_BYTES: return sample->total_bytes_allocated;
+    case LIBVALVE_CONTROL_SORT_TOTAL_BLOCKS: return sample->total_num_allocations;
+    default: return sample->current_bytes_allocated;
+  }
+}
+
+int libvalve_control_compare_samples(const void *s1,const void *s2)
+{
+  unsigned long int v1 = libvalve_control_sort_value((AllocationPointSample*)s1);
+  unsigned long int v2 = libvalve_control_sort_value((AllocationPointSample*)s2);
+  
+  return (v1 < v2) - (v1 > v2);
+}
+
+/* the counters are copied under the lock; sorting and symbolizing happen after it is released */
+
+int libvalve_control_top(FILE *out,unsigned long int num_rows,const char *key)
+{
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  unsigned long int i;
+  DwarfySymbol symbol;
+  
+  if(!strcmp(key,"live"))
+    LIBVALVE_CONTROL_SORT_KEY = LIBVALVE_CONTROL_SORT_LIVE_BYTES;
+  else if(!strcmp(key,"blocks"))
+    LIBVALVE_CONTROL_SORT_KEY = LIBVALVE_CONTROL_SORT_LIVE_BLOCKS;
+  else if(!strcmp(key,"total"))
+    LIBVALVE_CONTROL_SORT_KEY = LIBVALVE_CONTROL_SORT_TOTAL_BYTES;
+  else if(!strcmp(key,"allocs"))
+    LIBVALVE_CONTROL_SORT_KEY = LIBVALVE_CONTROL_SORT_TOTAL_BLOCKS;
+  else
+  {
+    fprintf(out,"error: unknown sort key \"%s\" (live, blocks, total or allocs)\n",key);
+    return -1;
+  }
+  
+  samples = libvalve_sample_allocation_points(&num_samples);
+  qsort(samples,num_samples,sizeof(AllocationPointSample),libvalve_control_compare_samples);
+  
+  fprintf(out,"%14s %12s %14s %12s  %s\n","live bytes","live blocks","total bytes","total blocks","location");
+  for(i = 0; i < num_samples && i < num_rows; i++)
+  {
+    if(libvalve_control_sort_value(&samples[i]) == 0)
+      break;
+    
+    fprintf(out,"%14lu %12lu %14lu %12lu  ",samples[i].current_bytes_allocated,samples[i].current_num_allocations,
+            samples[i].total_bytes_allocated,samples[i].total_num_allocations);
+    if(libvalve_symbolize(samples[i].address - 1,&symbol))
+      fprintf(out,"%s:%u [in function %s(...)]\n",symbol.file_name,symbol.line_number,symbol.function_name);
+    else
+      fprintf(out,"0x%lx [in unknown function]\n",samples[i].address);
+  }
+  
+  free(samples);
+  return 0;
+}
+
+/* restart the running totals from what is live now; live counts are left alone */
+
+void libvalve_control_reset()
+{
+  AllocationPoint *allocation_point;
+  int i;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  {
+    allocation_point->total_num_allocations = allocation_point->current_num_allocations;
+    allocation_point->total_bytes_allocated = allocation_point->current_bytes_allocated;
+  }
+  for(i = 0; i < LIBVALVE_NUM_TAGS; i++)
+  {
+    LIBVALVE_TAGS[i].total_num_allocations = LIBVALVE_TAGS[i].current_num_allocations;
+    LIBVALVE_TAGS[i].total_bytes_allocated = LIBVALVE_TAGS[i].current_bytes_allocated;
+  }
+  libvalve_thread_reset();
+  
+  LIBVALVE_NUM_ALLOCS = LIBVALVE_NUM_MALLOCS = LIBVALVE_NUM_CALLOCS = LIBVALVE_NUM_REALLOCS = LIBVALVE_NUM_FREES = 0;
+  LIBVALVE_NUM_BYTES_ALLOCATED = 0;
+  libvalve_client_reset();
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+}
+
+/* returns 0 for success, 1 to close the connection, -1 when an error line has been written */
+
+int libvalve_control_command(char *line,FILE *out)
+{
+  char command[64];
+  char argument[2][256];
+  int num_arguments;
+  unsigned long int num_rows;
+  int snapshot_num;
+  
+  argument[0][0] = argument[1][0] = 0;
+  if((num_arguments = sscanf(line,"%63s %255s %255s",command,argument[0],argument[1])) < 1)
+  {
+    fprintf(out,"error: empty command\n");
+    return -1;
+  }
+  
+  if(!strcmp(command,"stats"))
+  {
+    libvalve_control_stats(out);
+    return 0;
+  }
+  else if(!strcmp(command,"top"))
+  {
+    num_rows = 20;
+    if(num_arguments > 1 && sscanf(argument[0],"%lu",&num_rows) != 1)
+    {
+      fprintf(out,"error: usage: top [count] [live|blocks|total|allocs]\n");
+      return -1;
+    }
+    return libvalve_control_top(out,num_rows,num_arguments > 2 ? argument[1] : "live");
+  }
+  else if(!strcmp(command,"snapshot"))
+  {
+    if((snapshot_num = libvalve_snapshot(0,num_arguments > 1 ? argument[0] : 0)) == -1)
+    {
+      fprintf(out,"error: unable to fork snapshot process\n");
+      return -1;
+    }
+    fprintf(out,"snapshot %d\n",snapshot_num);
+    return 0;
+  }
+  else if(!strcmp(command,"metrics"))
+  {
+    libvalve_write_metrics(out);
+    return 0;
+  }
+  else if(!strcmp(command,"reset"))
+  {
+    libvalve_control_reset();
+    return 0;
+  }
+  else if(!strcmp(command,"enable") || !strcmp(command,"disable"))
+  {
+    __atomic_store_n(&LIBVALVE_TRACKING,!strcmp(command,"enable"),__ATOMIC_RELAXED);
+    fprintf(stderr,"[libvalve] Tracking of new allocations %sd from the control socket\n",command);
+    return 0;
+  }
+  else if(!strcmp(command,"quit"))
+  {
+    return 1;
+  }
+  else if(!strcmp(command,"help"))
+  {
+    fprintf(out,"stats\ntop [count] [live|blocks|total|allocs]\nmetrics\nsnapshot [path]\nreset\nenable\ndisable\nquit\n");
+    return 0;
+  }
+  
+  fprintf(out,"error: unknown command \"%s\" (try help)\n",command);
+  return -1;
+}
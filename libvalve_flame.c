@@ -0,0 +1,113 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+#include "valve_util.h"
+
+/* folded stacks for flamegraph.pl and compatible tools: one "frame;frame;frame value" line per distinct stack.
+   valve records allocation points by call site only, so each stack is module;function;file:line */
+
+int libvalve_write_flame(char *path,AllocationPointSample *samples,unsigned long int num_samples,int mode)
+{
+  InternTable stacks;
+  unsigned long int *values;
+  unsigned long int max_num_values;
+  unsigned long int value;
+  unsigned long int index;
+  unsigned long int i;
+  LibvalveModule *modules;
+  char *module_name;
+  char stack[1024];
+  DwarfySymbol symbol;
+  int num_modules;
+  int j;
+  FILE *out;
+  char *buffer;
+  int result;
+  
+  if(0 == (out = fopen(path,"w")))
+    return -1;
+  buffer = malloc(1 << 20);
+  setvbuf(out,buffer,_IOFBF,1 << 20);
+  
+  modules = malloc(LIBVALVE_MAX_NUM_LIBRARIES * sizeof(LibvalveModule));
+  num_modules = libvalve_load_modules(modules,LIBVALVE_MAX_NUM_LIBRARIES);
+  
+  intern_table_init(&stacks);
+  max_num_values = 1024;
+  values = calloc(max_num_values,sizeof(unsigned long int));
+  
+  /* each allocation point is symbolized once; points that fold to the same stack are summed */
+  for(i = 0; i < num_samples; i++)
+  {
+    value = (mode == LIBVALVE_FLAME_ALLOC) ? samples[i].total_bytes_allocated : samples[i].current_bytes_allocated;
+    if(value == 0)
+      continue;
+    
+    module_name = "??";
+    for(j = 0; j < num_modules; j++)
+    {
+      if((unsigned long int)samples[i].address >= modules[j].start && (unsigned long int)samples[i].address < modules[j].limit)
+        module_name = file_part(modules[j].name);
+    }
+    
+    if(libvalve_symbolize(samples[i].address - 1,&symbol))
+      snprintf(stack,1024,"%s;%s;%s:%u",module_name,symbol.function_name,symbol.file_name,symbol.line_number);
+    else
+      snprintf(stack,1024,"%s;0x%lx",module_name,samples[i].address);
+    
+    index = intern_string(&stacks,stack);
+    
+    if(index >= max_num_values)
+    {
+      values = realloc(values,2 * index * sizeof(unsigned long int));
+      memset(values + max_num_values,0,(2 * index - max_num_values) * sizeof(unsigned long int));
+      max_num_values = 2 * index;
+    }
+    values[index] += value;
+  }
+  
+  for(i = 1; i < stacks.num_strings; i++)
+    fprintf(out,"%s %lu\n",stacks.strings[i],values[i]);
+  
+  result = fclose(out) ? -1 : 0;
+  
+  free(buffer);
+  free(values);
+  free(modules);
+  intern_table_free(&stacks);
+  
+  return result;
+}
@@ -0,0 +1,169 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* growth-based leak detection for programs that never exit: every epoch the allocation points are sampled, and a
+   site whose live block count has not fallen for growth_num_epochs epochs (and has risen overall) is reported
+   along with the least-squares trend of its live bytes over that run */
+
+typedef struct
+{
+  long int address;
+  unsigned long int first_num_allocations;
+  unsigned long int last_num_allocations;
+  unsigned int num_samples; /* samples in the current non-decreasing run */
+  double sum_x,sum_y,sum_xy,sum_xx;
+} AllocationPointTrend;
+
+pthread_t LIBVALVE_GROWTH_THREAD;
+AllocationPointTrend *LIBVALVE_TRENDS;
+unsigned long int LIBVALVE_NUM_TRENDS;
+unsigned long int LIBVALVE_GROWTH_EPOCH;
+
+void *libvalve_growth_thread(void *arg);
+void libvalve_growth_epoch(void);
+void libvalve_growth_update(AllocationPointTrend *trend,AllocationPointSample *sample);
+
+void libvalve_growth_init()
+{
+  LIBVALVE_TRENDS = 0;
+  LIBVALVE_NUM_TRENDS = 0;
+  LIBVALVE_GROWTH_EPOCH = 0;
+  
+  pthread_create(&LIBVALVE_GROWTH_THREAD,0,libvalve_growth_thread,0);
+}
+
+void *libvalve_growth_thread(void *arg)
+{
+  struct timespec epoch,remaining;
+  
+  for(;;)
+  {
+    epoch.tv_sec = LIBVALVE_SHARED_MEM->config.growth_epoch_seconds;
+    epoch.tv_nsec = 0;
+    while(nanosleep(&epoch,&remaining) == -1)
+      epoch = remaining;
+    
+    libvalve_growth_epoch();
+  }
+  
+  return 0;
+}
+
+/* samples and trends are both sorted by address, so the trends are carried forward with a single merge */
+
+void libvalve_growth_epoch()
+{
+  AllocationPointSample *samples;
+  AllocationPointTrend *trends;
+  unsigned long int num_samples;
+  unsigned long int i,j;
+  
+  samples = libvalve_sample_allocation_points(&num_samples);
+  trends = malloc((num_samples + 1) * sizeof(AllocationPointTrend));
+  LIBVALVE_GROWTH_EPOCH++;
+  
+  for(i = 0, j = 0; i < num_samples; i++)
+  {
+    while(j < LIBVALVE_NUM_TRENDS && LIBVALVE_TRENDS[j].address < samples[i].address)
+      j++;
+    
+    if(j < LIBVALVE_NUM_TRENDS && LIBVALVE_TRENDS[j].address == samples[i].address)
+    {
+      trends[i] = LIBVALVE_TRENDS[j];
+    }
+    else
+    {
+      memset(&trends[i],0,sizeof(AllocationPointTrend));
+      trends[i].address = samples[i].address;
+    }
+    
+    libvalve_growth_update(&trends[i],&samples[i]);
+  }
+  
+  free(LIBVALVE_TRENDS);
+  LIBVALVE_TRENDS = trends;
+  LIBVALVE_NUM_TRENDS = num_samples;
+  
+  free(samples);
+}
+
+void libvalve_growth_update(AllocationPointTrend *trend,AllocationPointSample *sample)
+{
+  unsigned int num_epochs;
+  double x,y,slope;
+  DwarfySymbol symbol;
+  
+  if(trend->num_samples == 0 || sample->current_num_allocations < trend->last_num_allocations)
+  {
+    trend->first_num_allocations = sample->current_num_allocations;
+    trend->num_samples = 0;
+    trend->sum_x = trend->sum_y = trend->sum_xy = trend->sum_xx = 0;
+  }
+  
+  x = trend->num_samples;
+  y = sample->current_bytes_allocated;
+  trend->sum_x += x;
+  trend->sum_y += y;
+  trend->sum_xy += x * y;
+  trend->sum_xx += x * x;
+  trend->num_samples++;
+  trend->last_num_allocations = sample->current_num_allocations;
+  
+  /* report once the run spans K epochs, and again after every further K while it keeps growing */
+  num_epochs = trend->num_samples - 1;
+  
+  if(num_epochs == 0 || num_epochs % LIBVALVE_SHARED_MEM->config.growth_num_epochs)
+    return;
+  if(trend->last_num_allocations <= trend->first_num_allocations)
+    return;
+  
+  slope = (trend->num_samples * trend->sum_xy - trend->sum_x * trend->sum_y) / (trend->num_samples * trend->sum_xx - trend->sum_x * trend->sum_x);
+  
+  if(slope <= 0)
+    return;
+  
+  if(libvalve_symbolize(sample->address - 1,&symbol))
+    fprintf(stderr,"[libvalve] Epoch %lu: %s:%u [in function %s(...)]: ",LIBVALVE_GROWTH_EPOCH,symbol.file_name,symbol.line_number,symbol.function_name);
+  else
+    fprintf(stderr,"[libvalve] Epoch %lu: 0x%lx [in unknown function]: ",LIBVALVE_GROWTH_EPOCH,sample->address);
+  
+  fprintf(stderr,"live blocks grew from %lu to %lu over %u epoch(s), trend %+.1f bytes/s (%lu bytes live)\n",
+          trend->first_num_allocations,trend->last_num_allocations,num_epochs,slope / LIBVALVE_SHARED_MEM->config.growth_epoch_seconds,sample->current_bytes_allocated);
+}
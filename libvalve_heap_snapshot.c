@@ -0,0 +1,174 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+#include "valve_util.h"
+#include "valve_snapshot.h"
+
+/* dump the allocation tables and module map as a binary snapshot (see valve_snapshot.h) for valve-analyze
+   to symbolize offline; nothing is symbolized here, so writing is a single sequential pass */
+
+int libvalve_write_heap_snapshot(char *path)
+{
+  ValveSnapshotHeader header;
+  ValveSnapshotModule *snapshot_modules;
+  ValveSnapshotSite site;
+  ValveSnapshotBlock block;
+  LibvalveModule *modules;
+  AllocationPoint *allocation_point;
+  MemoryBlock *memory_block;
+  char *strings;
+  uint64_t first_block;
+  uint32_t num_snapshot_modules;
+  uint32_t strings_size;
+  uint32_t module;
+  int num_modules;
+  int j;
+  FILE *out;
+  char *buffer;
+  char padding[8];
+  int result;
+  
+  if(0 == (out = fopen(path,"w")))
+    return -1;
+  buffer = malloc(1 << 20);
+  setvbuf(out,buffer,_IOFBF,1 << 20);
+  
+  modules = malloc(LIBVALVE_MAX_NUM_LIBRARIES * sizeof(LibvalveModule));
+  num_modules = libvalve_load_modules(modules,LIBVALVE_MAX_NUM_LIBRARIES);
+  
+  /* the modules are the patched objects valve has DWARF for; the dynamic linker supplies their extent and build-id */
+  snapshot_modules = calloc(LIBVALVE_MAX_NUM_LIBRARIES,sizeof(ValveSnapshotModule));
+  strings = malloc(LIBVALVE_MAX_NUM_LIBRARIES * 256 + 8);
+  strings[0] = 0;
+  strings_size = 1;
+  
+  for(num_snapshot_modules = 0; num_snapshot_modules < LIBVALVE_MAX_NUM_LIBRARIES && strlen(LIBVALVE_SHARED_MEM->libraries[num_snapshot_modules].name); num_snapshot_modules++)
+  {
+    Library *library = &LIBVALVE_SHARED_MEM->libraries[num_snapshot_modules];
+    ValveSnapshotModule *snapshot_module = &snapshot_modules[num_snapshot_modules];
+    
+    snapshot_module->base_address = library->base_address;
+    snapshot_module->name_offset = strings_size;
+    strcpy(strings + strings_size,file_part(library->name));
+    strings_size += strlen(strings + strings_size) + 1;
+    
+    for(j = 0; j < num_modules; j++)
+    {
+      if(library->base_address >= (modules[j].start & ~4095UL) && library->base_address < modules[j].limit)
+      {
+        snapshot_module->limit = modules[j].limit;
+        snapshot_module->build_id_size = modules[j].build_id_size;
+        memcpy(snapshot_module->build_id,modules[j].build_id,modules[j].build_id_size);
+      }
+    }
+  }
+  
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,VALVE_SNAPSHOT_MAGIC,8);
+  header.version = VALVE_SNAPSHOT_VERSION;
+  header.header_size = sizeof(header);
+  header.pid = LIBVALVE_REPORT_PID;
+  header.num_allocs = LIBVALVE_NUM_ALLOCS;
+  header.num_mallocs = LIBVALVE_NUM_MALLOCS;
+  header.num_callocs = LIBVALVE_NUM_CALLOCS;
+  header.num_reallocs = LIBVALVE_NUM_REALLOCS;
+  header.num_frees = LIBVALVE_NUM_FREES;
+  
+  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  {
+    header.num_sites++;
+    RB_FOREACH(memory_block,MemoryBlockTree,&allocation_point->memory_blocks)
+      header.num_blocks++;
+  }
+  
+  header.modules_offset = sizeof(header);
+  header.num_modules = num_snapshot_modules;
+  header.strings_offset = header.modules_offset + num_snapshot_modules * sizeof(ValveSnapshotModule);
+  header.strings_size = strings_size;
+  header.sites_offset = (header.strings_offset + strings_size + 7) & ~7UL;
+  header.blocks_offset = header.sites_offset + header.num_sites * sizeof(ValveSnapshotSite);
+  
+  memset(padding,0,8);
+  fwrite(&header,sizeof(header),1,out);
+  fwrite(snapshot_modules,sizeof(ValveSnapshotModule),num_snapshot_modules,out);
+  fwrite(strings,1,strings_size,out);
+  fwrite(padding,1,header.sites_offset - header.strings_offset - strings_size,out);
+  
+  first_block = 0;
+  memset(&site,0,sizeof(site));
+  
+  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  {
+    site.address = allocation_point->address;
+    site.module = VALVE_SNAPSHOT_NO_MODULE;
+    for(module = 0; module < num_snapshot_modules; module++)
+    {
+      if(site.address >= snapshot_modules[module].base_address && site.address < snapshot_modules[module].limit)
+        site.module = module;
+    }
+    site.current_num_allocations = allocation_point->current_num_allocations;
+    site.current_bytes_allocated = allocation_point->current_bytes_allocated;
+    site.total_num_allocations = allocation_point->total_num_allocations;
+    site.total_bytes_allocated = allocation_point->total_bytes_allocated;
+    site.first_block = first_block;
+    site.num_blocks = 0;
+    RB_FOREACH(memory_block,MemoryBlockTree,&allocation_point->memory_blocks)
+      site.num_blocks++;
+    first_block += site.num_blocks;
+    fwrite(&site,sizeof(site),1,out);
+  }
+  
+  /* each site's blocks, in the order they were counted above */
+  RB_FOREACH(allocation_point,AllocationPointTree,&ALLOCATION_POINTS)
+  {
+    RB_FOREACH(memory_block,MemoryBlockTree,&allocation_point->memory_blocks)
+    {
+      block.address = memory_block->address;
+      block.size = memory_block->size;
+      fwrite(&block,sizeof(block),1,out);
+    }
+  }
+  
+  result = (ferror(out) | fclose(out)) ? -1 : 0;
+  
+  free(buffer);
+  free(strings);
+  free(snapshot_modules);
+  free(modules);
+  
+  return result;
+}
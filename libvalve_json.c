@@ -0,0 +1,240 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+#include "valve_util.h"
+
+/* NDJSON report: a summary record followed by one record per allocation point, so that
+   reports can be consumed line by line. Records go through one large buffer flushed with write(2) */
+
+#define JSON_BUFFER_SIZE (1 << 20)
+
+#define json_put_literal(writer,literal) json_put(writer,literal,sizeof(literal) - 1)
+
+typedef struct
+{
+  int fd;
+  char *buffer;
+  size_t num_bytes;
+  int error;
+} JsonWriter;
+
+void json_flush(JsonWriter *writer)
+{
+  size_t offset = 0;
+  ssize_t num_written;
+  
+  while(offset < writer->num_bytes)
+  {
+    if((num_written = write(writer->fd,writer->buffer + offset,writer->num_bytes - offset)) <= 0)
+    {
+      writer->error = 1;
+      break;
+    }
+    offset += num_written;
+  }
+  writer->num_bytes = 0;
+}
+
+void json_put(JsonWriter *writer,const char *data,size_t size)
+{
+  if(writer->num_bytes + size > JSON_BUFFER_SIZE)
+    json_flush(writer);
+  
+  if(size > JSON_BUFFER_SIZE)
+  {
+    /* too big to buffer; pass it straight through */
+    if(write(writer->fd,data,size) != (ssize_t)size)
+      writer->error = 1;
+    return;
+  }
+  memcpy(writer->buffer + writer->num_bytes,data,size);
+  writer->num_bytes += size;
+}
+
+void json_printf(JsonWriter *writer,const char *format,...)
+{
+  char text[256];
+  va_list args;
+  int size;
+  
+  va_start(args,format);
+  size = vsnprintf(text,256,format,args);
+  va_end(args);
+  
+  json_put(writer,text,size < 256 ? size : 255);
+}
+
+void json_put_string_length(JsonWriter *writer,const char *string,unsigned long int length)
+{
+  const char *run = string;
+  const char *end = string + length;
+  char escape[8];
+  
+  json_put_literal(writer,"\"");
+  for(; string < end; string++)
+  {
+    unsigned char c = *string;
+    
+    if(c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    
+    json_put(writer,run,string - run);
+    run = string + 1;
+    
+    switch(c)
+    {
+      case '"':  json_put_literal(writer,"\\\""); break;
+      case '\\': json_put_literal(writer,"\\\\"); break;
+      case '\n': json_put_literal(writer,"\\n"); break;
+      case '\r': json_put_literal(writer,"\\r"); break;
+      case '\t': json_put_literal(writer,"\\t"); break;
+      default:
+      {
+        snprintf(escape,8,"\\u%04x",c);
+        json_put(writer,escape,6);
+      }
+    }
+  }
+  json_put(writer,run,string - run);
+  json_put_literal(writer,"\"");
+}
+
+void json_put_string(JsonWriter *writer,const char *string)
+{
+  json_put_string_length(writer,string,strlen(string));
+}
+
+void json_put_source_context(JsonWriter *writer,DwarfySymbol *symbol)
+{
+  DwarfySourceCode *source_code;
+  int context_num_lines = LIBVALVE_SHARED_MEM->config.context_num_lines;
+  int line_number;
+  int line_length;
+  char *line;
+  int first = 1;
+  
+  if(!(source_code = dwarfy_source_code(symbol)))
+    return;
+  
+  json_put_literal(writer,",\"context\":[");
+  for(line_number = symbol->line_number - context_num_lines; line_number <= (int)symbol->line_number + context_num_lines; line_number++)
+  {
+    if((line_length = dwarfy_source_line(source_code,line_number,&line)) >= 0)
+    {
+      json_printf(writer,"%s{\"line\":%d,\"text\":",first ? "" : ",",line_number);
+      json_put_string_length(writer,line,line_length);
+      json_put_literal(writer,"}");
+      first = 0;
+    }
+  }
+  json_put_literal(writer,"]");
+}
+
+int libvalve_write_json(char *path,AllocationPointSample *samples,unsigned long int num_samples)
+{
+  JsonWriter writer;
+  LibvalveModule *modules;
+  DwarfySymbol symbol;
+  char *module_name;
+  unsigned long int i;
+  int num_modules;
+  int j;
+  
+  if(-1 == (writer.fd = open(path,O_WRONLY | O_CREAT | O_TRUNC,0666)))
+    return -1;
+  writer.buffer = malloc(JSON_BUFFER_SIZE);
+  writer.num_bytes = 0;
+  writer.error = 0;
+  
+  modules = malloc(LIBVALVE_MAX_NUM_LIBRARIES * sizeof(LibvalveModule));
+  num_modules = libvalve_load_modules(modules,LIBVALVE_MAX_NUM_LIBRARIES);
+  
+  json_printf(&writer,"{\"type\":\"summary\",\"pid\":%d,\"allocs\":%ld,\"mallocs\":%ld,\"callocs\":%ld,\"reallocs\":%ld,\"frees\":%ld,\"allocation_points\":%lu}\n",
+              (int)LIBVALVE_REPORT_PID,LIBVALVE_NUM_ALLOCS,LIBVALVE_NUM_MALLOCS,LIBVALVE_NUM_CALLOCS,LIBVALVE_NUM_REALLOCS,LIBVALVE_NUM_FREES,num_samples);
+  
+  /* one record per allocation tag, when the program uses them */
+  for(j = 0; LIBVALVE_NUM_TAGS > 1 && j < LIBVALVE_NUM_TAGS; j++)
+  {
+    json_put_literal(&writer,"{\"type\":\"tag\",\"name\":");
+    json_put_string(&writer,LIBVALVE_TAGS[j].name);
+    json_printf(&writer,",\"live_bytes\":%lu,\"live_blocks\":%lu,\"total_bytes\":%lu,\"total_blocks\":%lu}\n",
+                LIBVALVE_TAGS[j].current_bytes_allocated,LIBVALVE_TAGS[j].current_num_allocations,LIBVALVE_TAGS[j].total_bytes_allocated,LIBVALVE_TAGS[j].total_num_allocations);
+  }
+  
+  for(i = 0; i < num_samples; i++)
+  {
+    module_name = "??";
+    for(j = 0; j < num_modules; j++)
+    {
+      if((unsigned long int)samples[i].address >= modules[j].start && (unsigned long int)samples[i].address < modules[j].limit)
+        module_name = file_part(modules[j].name);
+    }
+    
+    json_printf(&writer,"{\"type\":\"site\",\"address\":\"0x%lx\",\"module\":",samples[i].address);
+    json_put_string(&writer,module_name);
+    json_printf(&writer,",\"live_bytes\":%lu,\"live_blocks\":%lu,\"total_bytes\":%lu,\"total_blocks\":%lu",
+                samples[i].current_bytes_allocated,samples[i].current_num_allocations,samples[i].total_bytes_allocated,samples[i].total_num_allocations);
+    
+    /* valve records the call site only, so the stack has a single frame */
+    if(libvalve_symbolize(samples[i].address - 1,&symbol))
+    {
+      json_put_literal(&writer,",\"stack\":[{\"function\":");
+      json_put_string(&writer,symbol.function_name);
+      json_put_literal(&writer,",\"file\":");
+      json_put_string(&writer,symbol.file_name);
+      json_printf(&writer,",\"line\":%u}]",symbol.line_number);
+      
+      if(LIBVALVE_SHARED_MEM->config.context_num_lines)
+        json_put_source_context(&writer,&symbol);
+    }
+    else
+      json_put_literal(&writer,",\"stack\":[]");
+    
+    json_put_literal(&writer,"}\n");
+  }
+  
+  json_flush(&writer);
+  if(close(writer.fd))
+    writer.error = 1;
+  
+  free(writer.buffer);
+  free(modules);
+  
+  return writer.error ? -1 : 0;
+}
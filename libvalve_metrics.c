@@ -0,0 +1,209 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* heap statistics in the OpenMetrics text format, written every metrics_interval_seconds to metrics_path
+   (via a temporary file and rename(), so a scraper never reads half a file) and on the control socket's
+   metrics command. the totals are summed from the per-thread counter blocks and the remaining counters are
+   read with relaxed loads, so only the top sites, which need a copy of the allocation point tree, take LIBVALVE_LOCK */
+
+#define LIBVALVE_METRICS_NUM_SITES 10
+
+pthread_t LIBVALVE_METRICS_THREAD;
+
+void *libvalve_metrics_thread(void *arg);
+
+void libvalve_metrics_init()
+{
+  pthread_create(&LIBVALVE_METRICS_THREAD,0,libvalve_metrics_thread,0);
+}
+
+void *libvalve_metrics_thread(void *arg)
+{
+  struct timespec interval,remaining;
+  
+  for(;;)
+  {
+    interval.tv_sec = LIBVALVE_SHARED_MEM->config.metrics_interval_seconds;
+    interval.tv_nsec = 0;
+    while(nanosleep(&interval,&remaining) == -1)
+      interval = remaining;
+    
+    libvalve_metrics_dump();
+  }
+  
+  return 0;
+}
+
+int libvalve_metrics_dump()
+{
+  char path[512];
+  FILE *out;
+  
+  snprintf(path,512,"%s.tmp",LIBVALVE_SHARED_MEM->config.metrics_path);
+  if(0 == (out = fopen(path,"w")))
+  {
+    fprintf(stderr,"[libvalve] Error: unable to write metrics \"%s\".\n",path);
+    return -1;
+  }
+  libvalve_write_metrics(out);
+  if(fclose(out) || rename(path,LIBVALVE_SHARED_MEM->config.metrics_path))
+  {
+    fprintf(stderr,"[libvalve] Error: unable to write metrics \"%s\".\n",LIBVALVE_SHARED_MEM->config.metrics_path);
+    unlink(path);
+    return -1;
+  }
+  
+  return 0;
+}
+
+/* label values escape backslash, double quote and newline */
+
+void libvalve_metrics_put_label(FILE *out,const char *value)
+{
+  for(; *value; value++)
+  {
+    if(*value == '\\' || *value == '"')
+      fprintf(out,"\\%c",*value);
+    else if(*value == '\n')
+      fprintf(out,"\\n");
+    else
+      fputc(*value,out);
+  }
+}
+
+void libvalve_metrics_put_family(FILE *out,const char *name,const char *type,const char *unit,const char *help)
+{
+  fprintf(out,"# TYPE %s %s\n",name,type);
+  if(unit)
+    fprintf(out,"# UNIT %s %s\n",name,unit);
+  fprintf(out,"# HELP %s %s\n",name,help);
+}
+
+int libvalve_metrics_compare_samples(const void *s1,const void *s2)
+{
+  unsigned long int b1 = ((AllocationPointSample*)s1)->current_bytes_allocated;
+  unsigned long int b2 = ((AllocationPointSample*)s2)->current_bytes_allocated;
+  
+  return (b1 < b2) - (b1 > b2);
+}
+
+void libvalve_write_metrics(FILE *out)
+{
+  LibvalveThread *thread;
+  LibvalveThread totals;
+  AllocationPointSample *samples;
+  unsigned long int num_samples;
+  unsigned long int num_allocation_points;
+  unsigned long int i;
+  int tag,num_tags;
+  DwarfySymbol symbol;
+  char location[512];
+  
+  memset(&totals,0,sizeof(totals));
+  for(thread = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_ACQUIRE); thread; thread = thread->next)
+  {
+    totals.current_num_allocations += __atomic_load_n(&thread->current_num_allocations,__ATOMIC_RELAXED);
+    totals.current_bytes_allocated += __atomic_load_n(&thread->current_bytes_allocated,__ATOMIC_RELAXED);
+    totals.total_num_allocations += __atomic_load_n(&thread->total_num_allocations,__ATOMIC_RELAXED);
+    totals.total_bytes_allocated += __atomic_load_n(&thread->total_bytes_allocated,__ATOMIC_RELAXED);
+    totals.num_frees += __atomic_load_n(&thread->num_frees,__ATOMIC_RELAXED);
+  }
+  num_allocation_points = __atomic_load_n(&LIBVALVE_NUM_ALLOCATION_POINTS,__ATOMIC_RELAXED);
+  
+  libvalve_metrics_put_family(out,"valve_allocations","counter",0,"Blocks allocated, by allocation function.");
+  fprintf(out,"valve_allocations_total{function=\"malloc\"} %ld\n",__atomic_load_n(&LIBVALVE_NUM_MALLOCS,__ATOMIC_RELAXED));
+  fprintf(out,"valve_allocations_total{function=\"calloc\"} %ld\n",__atomic_load_n(&LIBVALVE_NUM_CALLOCS,__ATOMIC_RELAXED));
+  fprintf(out,"valve_allocations_total{function=\"realloc\"} %ld\n",__atomic_load_n(&LIBVALVE_NUM_REALLOCS,__ATOMIC_RELAXED));
+  libvalve_metrics_put_family(out,"valve_frees","counter",0,"Calls to free().");
+  fprintf(out,"valve_frees_total %lu\n",totals.num_frees);
+  libvalve_metrics_put_family(out,"valve_allocated_bytes","counter","bytes","Bytes allocated.");
+  fprintf(out,"valve_allocated_bytes_total %lu\n",totals.total_bytes_allocated);
+  libvalve_metrics_put_family(out,"valve_live_blocks","gauge",0,"Blocks allocated and not yet freed.");
+  fprintf(out,"valve_live_blocks %lu\n",totals.current_num_allocations);
+  libvalve_metrics_put_family(out,"valve_live_bytes","gauge","bytes","Bytes allocated and not yet freed.");
+  fprintf(out,"valve_live_bytes %lu\n",totals.current_bytes_allocated);
+  libvalve_metrics_put_family(out,"valve_metadata_bytes","gauge","bytes","Memory used by valve's own tables.");
+  fprintf(out,"valve_metadata_bytes %lu\n",num_allocation_points * sizeof(AllocationPoint) + totals.current_num_allocations * sizeof(MemoryBlock) +
+          __atomic_load_n(&LIBVALVE_NUM_THREADS,__ATOMIC_RELAXED) * sizeof(LibvalveThread));
+  libvalve_metrics_put_family(out,"valve_allocation_points","gauge",0,"Distinct call sites that have allocated.");
+  fprintf(out,"valve_allocation_points %lu\n",num_allocation_points);
+  
+  if(LIBVALVE_NUM_THREADS > 1)
+  {
+    libvalve_metrics_put_family(out,"valve_thread_live_bytes","gauge","bytes","Live bytes allocated by each thread.");
+    for(thread = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_ACQUIRE); thread; thread = thread->next)
+      fprintf(out,"valve_thread_live_bytes{thread=\"%lu\",id=\"%ld\"} %lu\n",thread->thread_num,thread->thread_id,__atomic_load_n(&thread->current_bytes_allocated,__ATOMIC_RELAXED));
+  }
+  
+  if((num_tags = __atomic_load_n(&LIBVALVE_NUM_TAGS,__ATOMIC_ACQUIRE)) > 1)
+  {
+    libvalve_metrics_put_family(out,"valve_tag_live_bytes","gauge","bytes","Live bytes allocated under each tag.");
+    for(tag = 0; tag < num_tags; tag++)
+    {
+      fprintf(out,"valve_tag_live_bytes{tag=\"");
+      libvalve_metrics_put_label(out,LIBVALVE_TAGS[tag].name);
+      fprintf(out,"\"} %lu\n",__atomic_load_n(&LIBVALVE_TAGS[tag].current_bytes_allocated,__ATOMIC_RELAXED));
+    }
+  }
+  
+  samples = libvalve_sample_allocation_points(&num_samples);
+  qsort(samples,num_samples,sizeof(AllocationPointSample),libvalve_metrics_compare_samples);
+  
+  libvalve_metrics_put_family(out,"valve_site_live_bytes","gauge","bytes","Live bytes of the allocation points holding the most memory.");
+  for(i = 0; i < num_samples && i < LIBVALVE_METRICS_NUM_SITES && samples[i].current_bytes_allocated; i++)
+  {
+    fprintf(out,"valve_site_live_bytes{location=\"");
+    if(libvalve_symbolize(samples[i].address - 1,&symbol))
+    {
+      snprintf(location,512,"%s:%u",symbol.file_name,symbol.line_number);
+      libvalve_metrics_put_label(out,location);
+      fprintf(out,"\",function=\"");
+      libvalve_metrics_put_label(out,symbol.function_name);
+    }
+    else
+    {
+      fprintf(out,"0x%lx\",function=\"",samples[i].address);
+    }
+    fprintf(out,"\"} %lu\n",samples[i].current_bytes_allocated);
+  }
+  free(samples);
+  
+  fprintf(out,"# EOF\n");
+}
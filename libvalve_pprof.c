@@ -0,0 +1,284 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+#include "valve_util.h"
+
+/* heap profiles in pprof's gzipped profile.proto format; see
+   https://github.com/google/pprof/blob/main/proto/profile.proto for the field numbers used below */
+
+#define PPROF_PROFILE_SAMPLE_TYPE 1
+#define PPROF_PROFILE_SAMPLE 2
+#define PPROF_PROFILE_MAPPING 3
+#define PPROF_PROFILE_LOCATION 4
+#define PPROF_PROFILE_FUNCTION 5
+#define PPROF_PROFILE_STRING_TABLE 6
+#define PPROF_PROFILE_TIME_NANOS 9
+#define PPROF_PROFILE_PERIOD_TYPE 11
+#define PPROF_PROFILE_PERIOD 12
+#define PPROF_PROFILE_DEFAULT_SAMPLE_TYPE 14
+
+#define PPROF_WIRE_VARINT 0
+#define PPROF_WIRE_BYTES 2
+
+typedef struct
+{
+  unsigned char *data;
+  unsigned long int size;
+  unsigned long int capacity;
+} PprofBuffer;
+
+typedef struct
+{
+  unsigned long int *keys;
+  unsigned long int *ids; /* 0 if free */
+  unsigned long int num_slots;
+  unsigned long int num_ids;
+} PprofIdTable;
+
+void pprof_reserve(PprofBuffer *buffer,unsigned long int size)
+{
+  if(buffer->size + size <= buffer->capacity)
+    return;
+  while(buffer->size + size > buffer->capacity)
+    buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+  buffer->data = realloc(buffer->data,buffer->capacity);
+}
+
+void pprof_put_varint(PprofBuffer *buffer,unsigned long int value)
+{
+  pprof_reserve(buffer,10);
+  while(value >= 0x80)
+  {
+    buffer->data[buffer->size++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  buffer->data[buffer->size++] = (unsigned char)value;
+}
+
+void pprof_put_uint(PprofBuffer *buffer,int field,unsigned long int value)
+{
+  pprof_put_varint(buffer,(field << 3) | PPROF_WIRE_VARINT);
+  pprof_put_varint(buffer,value);
+}
+
+void pprof_put_bytes(PprofBuffer *buffer,int field,void *data,unsigned long int size)
+{
+  pprof_put_varint(buffer,(field << 3) | PPROF_WIRE_BYTES);
+  pprof_put_varint(buffer,size);
+  pprof_reserve(buffer,size);
+  memcpy(buffer->data + buffer->size,data,size);
+  buffer->size += size;
+}
+
+void pprof_put_value_type(PprofBuffer *buffer,PprofBuffer *message,int field,unsigned long int type,unsigned long int unit)
+{
+  message->size = 0;
+  pprof_put_uint(message,1,type);
+  pprof_put_uint(message,2,unit);
+  pprof_put_bytes(buffer,field,message->data,message->size);
+}
+
+void pprof_init_id_table(PprofIdTable *table,unsigned long int num_keys)
+{
+  table->num_slots = 64;
+  while(table->num_slots < num_keys * 2)
+    table->num_slots *= 2;
+  table->keys = malloc(table->num_slots * sizeof(unsigned long int));
+  table->ids = calloc(table->num_slots,sizeof(unsigned long int));
+  table->num_ids = 0;
+}
+
+/* returns the id for key, allocating the next one if it is new; *is_new tells the caller to emit it */
+
+unsigned long int pprof_lookup_id(PprofIdTable *table,unsigned long int key,int *is_new)
+{
+  unsigned long int slot;
+  
+  for(slot = (key * 11400714819323198485UL) >> 32 & (table->num_slots - 1); table->ids[slot]; slot = (slot + 1) & (table->num_slots - 1))
+  {
+    if(table->keys[slot] == key)
+    {
+      *is_new = 0;
+      return table->ids[slot];
+    }
+  }
+  
+  table->keys[slot] = key;
+  table->ids[slot] = ++table->num_ids;
+  *is_new = 1;
+  return table->num_ids;
+}
+
+int libvalve_write_pprof(char *path,AllocationPointSample *samples,unsigned long int num_samples)
+{
+  PprofBuffer profile,message,line,packed;
+  InternTable strings;
+  PprofIdTable functions;
+  LibvalveModule *modules;
+  char (*build_ids)[65];
+  DwarfySymbol symbol;
+  struct timespec now;
+  unsigned long int function_id;
+  unsigned long int function_name,file_name;
+  unsigned long int mapping_id;
+  unsigned long int i;
+  int num_modules;
+  int is_new;
+  int j;
+  gzFile out;
+  int result;
+  
+  memset(&profile,0,sizeof(PprofBuffer));
+  memset(&message,0,sizeof(PprofBuffer));
+  memset(&line,0,sizeof(PprofBuffer));
+  memset(&packed,0,sizeof(PprofBuffer));
+  intern_table_init(&strings);
+  pprof_init_id_table(&functions,num_samples);
+  
+  pprof_put_value_type(&profile,&message,PPROF_PROFILE_SAMPLE_TYPE,intern_string(&strings,"alloc_objects"),intern_string(&strings,"count"));
+  pprof_put_value_type(&profile,&message,PPROF_PROFILE_SAMPLE_TYPE,intern_string(&strings,"alloc_space"),intern_string(&strings,"bytes"));
+  pprof_put_value_type(&profile,&message,PPROF_PROFILE_SAMPLE_TYPE,intern_string(&strings,"inuse_objects"),intern_string(&strings,"count"));
+  pprof_put_value_type(&profile,&message,PPROF_PROFILE_SAMPLE_TYPE,intern_string(&strings,"inuse_space"),intern_string(&strings,"bytes"));
+  
+  modules = malloc(LIBVALVE_MAX_NUM_LIBRARIES * sizeof(LibvalveModule));
+  num_modules = libvalve_load_modules(modules,LIBVALVE_MAX_NUM_LIBRARIES);
+  build_ids = malloc((num_modules + 1) * sizeof(*build_ids));
+  
+  for(j = 0; j < num_modules; j++)
+  {
+    message.size = 0;
+    pprof_put_uint(&message,1,j + 1);
+    pprof_put_uint(&message,2,modules[j].start);
+    pprof_put_uint(&message,3,modules[j].limit);
+    pprof_put_uint(&message,5,intern_string(&strings,modules[j].name));
+    if(modules[j].build_id_size)
+    {
+      int k;
+      for(k = 0; k < modules[j].build_id_size; k++)
+        sprintf(build_ids[j] + 2 * k,"%02x",modules[j].build_id[k]);
+      pprof_put_uint(&message,6,intern_string(&strings,build_ids[j]));
+    }
+    pprof_put_uint(&message,7,1);
+    pprof_put_uint(&message,8,1);
+    pprof_put_uint(&message,9,1);
+    pprof_put_bytes(&profile,PPROF_PROFILE_MAPPING,message.data,message.size);
+  }
+  
+  /* every allocation point is a distinct return address, so sample i gets location i + 1 */
+  for(i = 0; i < num_samples; i++)
+  {
+    mapping_id = 0;
+    for(j = 0; j < num_modules; j++)
+    {
+      if((unsigned long int)samples[i].address >= modules[j].start && (unsigned long int)samples[i].address < modules[j].limit)
+        mapping_id = j + 1;
+    }
+    
+    message.size = 0;
+    pprof_put_uint(&message,1,i + 1);
+    if(mapping_id)
+      pprof_put_uint(&message,2,mapping_id);
+    pprof_put_uint(&message,3,samples[i].address);
+    
+    if(libvalve_symbolize(samples[i].address - 1,&symbol))
+    {
+      function_name = intern_string(&strings,symbol.function_name);
+      file_name = intern_string(&strings,symbol.file_name);
+      function_id = pprof_lookup_id(&functions,(function_name << 32) | file_name,&is_new);
+      
+      if(is_new)
+      {
+        line.size = 0;
+        pprof_put_uint(&line,1,function_id);
+        pprof_put_uint(&line,2,function_name);
+        pprof_put_uint(&line,3,function_name);
+        pprof_put_uint(&line,4,file_name);
+        pprof_put_bytes(&profile,PPROF_PROFILE_FUNCTION,line.data,line.size);
+      }
+      
+      line.size = 0;
+      pprof_put_uint(&line,1,function_id);
+      pprof_put_uint(&line,2,symbol.line_number);
+      pprof_put_bytes(&message,4,line.data,line.size);
+    }
+    
+    pprof_put_bytes(&profile,PPROF_PROFILE_LOCATION,message.data,message.size);
+    
+    message.size = 0;
+    packed.size = 0;
+    pprof_put_varint(&packed,i + 1);
+    pprof_put_bytes(&message,1,packed.data,packed.size);
+    packed.size = 0;
+    pprof_put_varint(&packed,samples[i].total_num_allocations);
+    pprof_put_varint(&packed,samples[i].total_bytes_allocated);
+    pprof_put_varint(&packed,samples[i].current_num_allocations);
+    pprof_put_varint(&packed,samples[i].current_bytes_allocated);
+    pprof_put_bytes(&message,2,packed.data,packed.size);
+    pprof_put_bytes(&profile,PPROF_PROFILE_SAMPLE,message.data,message.size);
+  }
+  
+  clock_gettime(CLOCK_REALTIME,&now);
+  pprof_put_uint(&profile,PPROF_PROFILE_TIME_NANOS,now.tv_sec * 1000000000UL + now.tv_nsec);
+  pprof_put_value_type(&profile,&message,PPROF_PROFILE_PERIOD_TYPE,intern_string(&strings,"space"),intern_string(&strings,"bytes"));
+  pprof_put_uint(&profile,PPROF_PROFILE_PERIOD,1);
+  pprof_put_uint(&profile,PPROF_PROFILE_DEFAULT_SAMPLE_TYPE,intern_string(&strings,"inuse_space"));
+  
+  for(i = 0; i < strings.num_strings; i++)
+    pprof_put_bytes(&profile,PPROF_PROFILE_STRING_TABLE,strings.strings[i],strlen(strings.strings[i]));
+  
+  result = -1;
+  if((out = gzopen(path,"wb")))
+  {
+    if(gzwrite(out,profile.data,profile.size) == (int)profile.size)
+      result = 0;
+    if(gzclose(out) != Z_OK)
+      result = -1;
+  }
+  
+  free(profile.data);
+  free(message.data);
+  free(line.data);
+  free(packed.data);
+  intern_table_free(&strings);
+  free(functions.keys);
+  free(functions.ids);
+  free(modules);
+  free(build_ids);
+  
+  return result;
+}
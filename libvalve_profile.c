@@ -0,0 +1,247 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* periodic heap profiles in the gperftools "heap profile" text format, written by a background thread
+   every profile_interval_bytes allocated and/or every profile_interval_seconds */
+
+sem_t LIBVALVE_PROFILE_REQUEST;
+pthread_t LIBVALVE_PROFILE_THREAD;
+unsigned long int LIBVALVE_PROFILE_BYTES; /* allocated since the last request; guarded by LIBVALVE_LOCK */
+int LIBVALVE_NUM_PROFILES;
+pthread_mutex_t LIBVALVE_PROFILE_LOCK = PTHREAD_MUTEX_INITIALIZER; /* the profile thread and client phase markers both dump */
+
+AllocationPointSample *LIBVALVE_PREVIOUS_PROFILE;
+unsigned long int LIBVALVE_PREVIOUS_PROFILE_SIZE;
+
+typedef struct
+{
+  AllocationPointSample *sample;
+  long int bytes_difference;
+  long int num_difference;
+} LibvalveGrowth;
+
+void *libvalve_profile_thread(void *arg);
+void libvalve_profile_write_diff(AllocationPointSample *samples,unsigned long int num_samples,int profile_num);
+
+void libvalve_profile_init()
+{
+  LIBVALVE_PROFILE_BYTES = 0;
+  LIBVALVE_NUM_PROFILES = 0;
+  LIBVALVE_PREVIOUS_PROFILE = 0;
+  LIBVALVE_PREVIOUS_PROFILE_SIZE = 0;
+  
+  sem_init(&LIBVALVE_PROFILE_REQUEST,0,0);
+  pthread_create(&LIBVALVE_PROFILE_THREAD,0,libvalve_profile_thread,0);
+}
+
+/* called by the wrappers with LIBVALVE_LOCK held; never blocks */
+
+void libvalve_profile_count(size_t size)
+{
+  LIBVALVE_PROFILE_BYTES += size;
+  
+  if(LIBVALVE_PROFILE_BYTES >= LIBVALVE_SHARED_MEM->config.profile_interval_bytes)
+  {
+    LIBVALVE_PROFILE_BYTES = 0;
+    sem_post(&LIBVALVE_PROFILE_REQUEST);
+  }
+}
+
+void *libvalve_profile_thread(void *arg)
+{
+  struct timespec deadline;
+  int result;
+  
+  for(;;)
+  {
+    if(LIBVALVE_SHARED_MEM->config.profile_interval_seconds)
+    {
+      clock_gettime(CLOCK_REALTIME,&deadline);
+      deadline.tv_sec += LIBVALVE_SHARED_MEM->config.profile_interval_seconds;
+      while((result = sem_timedwait(&LIBVALVE_PROFILE_REQUEST,&deadline)) == -1 && errno == EINTR);
+    }
+    else
+    {
+      while((result = sem_wait(&LIBVALVE_PROFILE_REQUEST)) == -1 && errno == EINTR);
+    }
+    
+    libvalve_profile_dump();
+  }
+  
+  return 0;
+}
+
+int libvalve_profile_dump()
+{
+  AllocationPointSample *samples;
+  AllocationPointSample totals;
+  unsigned long int num_samples;
+  unsigned long int i;
+  int profile_num;
+  char path[512];
+  char buffer[4096];
+  size_t num_bytes;
+  FILE *out;
+  FILE *maps;
+  
+  pthread_mutex_lock(&LIBVALVE_PROFILE_LOCK);
+  
+  samples = libvalve_sample_allocation_points(&num_samples);
+  profile_num = ++LIBVALVE_NUM_PROFILES;
+  
+  memset(&totals,0,sizeof(totals));
+  for(i = 0; i < num_samples; i++)
+  {
+    totals.current_num_allocations += samples[i].current_num_allocations;
+    totals.current_bytes_allocated += samples[i].current_bytes_allocated;
+    totals.total_num_allocations += samples[i].total_num_allocations;
+    totals.total_bytes_allocated += samples[i].total_bytes_allocated;
+  }
+  
+  snprintf(path,512,"%s/valve.%d.%04d.heap",LIBVALVE_SHARED_MEM->config.output_directory,(int)getpid(),profile_num);
+  
+  if(0 == (out = fopen(path,"w")))
+  {
+    fprintf(stderr,"[libvalve] Error: unable to write heap profile \"%s\".\n",path);
+    free(samples);
+    pthread_mutex_unlock(&LIBVALVE_PROFILE_LOCK);
+    return -1;
+  }
+  
+  fprintf(out,"heap profile: %6lu: %8lu [%6lu: %8lu] @ heapprofile\n",totals.current_num_allocations,totals.current_bytes_allocated,totals.total_num_allocations,totals.total_bytes_allocated);
+  
+  for(i = 0; i < num_samples; i++)
+    fprintf(out,"%6lu: %8lu [%6lu: %8lu] @ 0x%lx\n",samples[i].current_num_allocations,samples[i].current_bytes_allocated,samples[i].total_num_allocations,samples[i].total_bytes_allocated,samples[i].address);
+  
+  /* lets pprof map the return addresses back to modules */
+  if((maps = fopen("/proc/self/maps","r")))
+  {
+    fprintf(out,"\nMAPPED_LIBRARIES:\n");
+    while((num_bytes = fread(buffer,1,4096,maps)) > 0)
+      fwrite(buffer,1,num_bytes,out);
+    fclose(maps);
+  }
+  
+  fclose(out);
+  
+  if(LIBVALVE_SHARED_MEM->config.profile_diff && LIBVALVE_PREVIOUS_PROFILE)
+    libvalve_profile_write_diff(samples,num_samples,profile_num);
+  
+  free(LIBVALVE_PREVIOUS_PROFILE);
+  LIBVALVE_PREVIOUS_PROFILE = samples;
+  LIBVALVE_PREVIOUS_PROFILE_SIZE = num_samples;
+  
+  pthread_mutex_unlock(&LIBVALVE_PROFILE_LOCK);
+  
+  return profile_num;
+}
+
+int compare_growth(const void *g1,const void *g2)
+{
+  long int b1 = ((LibvalveGrowth*)g1)->bytes_difference;
+  long int b2 = ((LibvalveGrowth*)g2)->bytes_difference;
+  
+  return (b1 < b2) - (b1 > b2);
+}
+
+/* both sample arrays are sorted by address, so the sites that grew fall out of a single merge */
+
+void libvalve_profile_write_diff(AllocationPointSample *samples,unsigned long int num_samples,int profile_num)
+{
+  LibvalveGrowth *growth;
+  unsigned long int num_grown;
+  unsigned long int i,j;
+  unsigned long int previous_num,previous_bytes;
+  DwarfySymbol symbol;
+  char path[512];
+  FILE *out;
+  
+  growth = malloc((num_samples + 1) * sizeof(LibvalveGrowth));
+  num_grown = 0;
+  
+  for(i = 0, j = 0; i < num_samples; i++)
+  {
+    while(j < LIBVALVE_PREVIOUS_PROFILE_SIZE && LIBVALVE_PREVIOUS_PROFILE[j].address < samples[i].address)
+      j++;
+    
+    previous_num = previous_bytes = 0;
+    if(j < LIBVALVE_PREVIOUS_PROFILE_SIZE && LIBVALVE_PREVIOUS_PROFILE[j].address == samples[i].address)
+    {
+      previous_num = LIBVALVE_PREVIOUS_PROFILE[j].current_num_allocations;
+      previous_bytes = LIBVALVE_PREVIOUS_PROFILE[j].current_bytes_allocated;
+    }
+    
+    if(samples[i].current_bytes_allocated > previous_bytes)
+    {
+      growth[num_grown].sample = &samples[i];
+      growth[num_grown].bytes_difference = samples[i].current_bytes_allocated - previous_bytes;
+      growth[num_grown].num_difference = samples[i].current_num_allocations - previous_num;
+      num_grown++;
+    }
+  }
+  
+  qsort(growth,num_grown,sizeof(LibvalveGrowth),compare_growth);
+  
+  snprintf(path,512,"%s/valve.%d.%04d.diff",LIBVALVE_SHARED_MEM->config.output_directory,(int)getpid(),profile_num);
+  
+  if((out = fopen(path,"w")))
+  {
+    fprintf(out,"[libvalve] Growth since valve.%d.%04d.heap:\n",(int)getpid(),profile_num - 1);
+    
+    for(i = 0; i < num_grown; i++)
+    {
+      if(libvalve_symbolize(growth[i].sample->address - 1,&symbol))
+        fprintf(out,"[libvalve] %s:%u [in function %s(...)]: ",symbol.file_name,symbol.line_number,symbol.function_name);
+      else
+        fprintf(out,"[libvalve] 0x%lx [in unknown function]: ",growth[i].sample->address);
+      
+      fprintf(out,"+%ld bytes in %+ld block(s) (%lu bytes live in %lu block(s))\n",growth[i].bytes_difference,growth[i].num_difference,growth[i].sample->current_bytes_allocated,growth[i].sample->current_num_allocations);
+    }
+    
+    if(num_grown == 0)
+      fprintf(out,"[libvalve] No allocation point grew.\n");
+    
+    fclose(out);
+  }
+  
+  free(growth);
+}
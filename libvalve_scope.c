@@ -0,0 +1,124 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* scoped leak checks: each scope keeps a list of the blocks its thread allocated in it that are still live,
+   so ending a scope costs time in proportion to what it leaked, not to the size of the heap */
+
+__thread LibvalveScope *LIBVALVE_SCOPE __attribute__((tls_model("initial-exec")));
+unsigned long int LIBVALVE_SCOPE_EPOCH;
+
+long int libvalve_scope_begin(const char *name)
+{
+  LibvalveScope *scope;
+  
+  scope = malloc(sizeof(LibvalveScope));
+  memset(scope,0,sizeof(LibvalveScope));
+  strncpy(scope->name,name ? name : "",63);
+  LIST_INIT(&scope->memory_blocks);
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  scope->epoch = ++LIBVALVE_SCOPE_EPOCH;
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  scope->parent = LIBVALVE_SCOPE;
+  LIBVALVE_SCOPE = scope;
+  
+  return scope->epoch;
+}
+
+/* called with LIBVALVE_LOCK held when a block is freed, by whichever thread frees it */
+
+void libvalve_scope_forget(MemoryBlock *memory_block)
+{
+  if(memory_block->scope)
+  {
+    LIST_REMOVE(memory_block,ScopeLinks);
+    memory_block->scope = 0;
+  }
+}
+
+long int libvalve_scope_end()
+{
+  LibvalveScope *scope = LIBVALVE_SCOPE;
+  MemoryBlock *memory_block;
+  MemoryBlock **memory_blocks;
+  unsigned long int num_blocks;
+  unsigned long int num_bytes;
+  unsigned long int i;
+  
+  if(scope == 0)
+  {
+    fprintf(stderr,"[libvalve] Warning: VALVE_SCOPE_END() without VALVE_SCOPE_BEGIN().\n");
+    return 0;
+  }
+  
+  LIBVALVE_SCOPE = scope->parent;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  num_blocks = 0;
+  LIST_FOREACH(memory_block,&scope->memory_blocks,ScopeLinks)
+    num_blocks++;
+  
+  if(num_blocks)
+  {
+    memory_blocks = malloc(num_blocks * sizeof(MemoryBlock*));
+    
+    num_bytes = 0;
+    i = 0;
+    LIST_FOREACH(memory_block,&scope->memory_blocks,ScopeLinks)
+    {
+      memory_blocks[i++] = memory_block;
+      num_bytes += memory_block->size;
+    }
+    
+    fprintf(stderr,"[libvalve] Scope \"%s\" (#%lu): %lu bytes leaked in %lu of %lu block(s)\n",scope->name,scope->epoch,num_bytes,num_blocks,scope->num_allocations);
+    libvalve_report_memory_blocks(stderr,memory_blocks,num_blocks);
+    
+    /* the survivors are reported once, here; they do not count against an enclosing scope */
+    for(i = 0; i < num_blocks; i++)
+      libvalve_scope_forget(memory_blocks[i]);
+    
+    free(memory_blocks);
+  }
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  free(scope);
+  
+  return num_blocks;
+}
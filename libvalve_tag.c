@@ -0,0 +1,120 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* allocation tags: a thread pushes a tag around work done for one subsystem, and every block it allocates meanwhile
+   is charged to that tag. the wrappers keep the per-tag totals as they go, so a breakdown costs one pass over the tags */
+
+LibvalveTag LIBVALVE_TAGS[LIBVALVE_MAX_NUM_TAGS] = {{.name = "untagged"}};
+int LIBVALVE_NUM_TAGS = 1;
+__thread int LIBVALVE_TAG_STACK[LIBVALVE_MAX_TAG_DEPTH] __attribute__((tls_model("initial-exec")));
+__thread int LIBVALVE_TAG_DEPTH __attribute__((tls_model("initial-exec")));
+
+/* returns the tag's ID, or 0 (untagged) if the table is full */
+
+int libvalve_tag_id(const char *name)
+{
+  int tag;
+  
+  if(name == 0)
+    return 0;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  for(tag = 1; tag < LIBVALVE_NUM_TAGS; tag++)
+  {
+    if(!strncmp(LIBVALVE_TAGS[tag].name,name,63))
+      break;
+  }
+  
+  if(tag == LIBVALVE_NUM_TAGS)
+  {
+    if(LIBVALVE_NUM_TAGS == LIBVALVE_MAX_NUM_TAGS)
+    {
+      fprintf(stderr,"[libvalve] Warning: too many tags; \"%s\" is counted as untagged.\n",name);
+      tag = 0;
+    }
+    else
+    {
+      strncpy(LIBVALVE_TAGS[tag].name,name,63);
+      LIBVALVE_NUM_TAGS++;
+    }
+  }
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  return tag;
+}
+
+int libvalve_tag_push(int tag)
+{
+  if(tag < 0 || tag >= LIBVALVE_NUM_TAGS)
+    tag = 0;
+  
+  if(LIBVALVE_TAG_DEPTH < LIBVALVE_MAX_TAG_DEPTH)
+    LIBVALVE_TAG_STACK[LIBVALVE_TAG_DEPTH] = tag;
+  LIBVALVE_TAG_DEPTH++;
+  
+  return LIBVALVE_TAG_DEPTH;
+}
+
+int libvalve_tag_pop()
+{
+  if(LIBVALVE_TAG_DEPTH == 0)
+  {
+    fprintf(stderr,"[libvalve] Warning: VALVE_TAG_POP() without VALVE_TAG_PUSH().\n");
+    return 0;
+  }
+  
+  return --LIBVALVE_TAG_DEPTH;
+}
+
+/* the caller holds LIBVALVE_LOCK */
+
+void libvalve_tag_report(FILE *out)
+{
+  int tag;
+  
+  fprintf(out,"[libvalve] Memory usage by tag:\n");
+  fprintf(out,"[libvalve] %-24s %14s %12s %14s %12s\n","tag","live bytes","live blocks","total bytes","total blocks");
+  
+  for(tag = 0; tag < LIBVALVE_NUM_TAGS; tag++)
+  {
+    fprintf(out,"[libvalve] %-24s %14lu %12lu %14lu %12lu\n",LIBVALVE_TAGS[tag].name,LIBVALVE_TAGS[tag].current_bytes_allocated,
+            LIBVALVE_TAGS[tag].current_num_allocations,LIBVALVE_TAGS[tag].total_bytes_allocated,LIBVALVE_TAGS[tag].total_num_allocations);
+  }
+  fprintf(out,"\n");
+}
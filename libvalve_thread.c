@@ -0,0 +1,230 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef LINUX
+#include <sys/syscall.h>
+#elif defined(FREEBSD)
+#include <pthread_np.h>
+#endif
+#include "dwarfy.h"
+#include "valve.h"
+#include "libvalve.h"
+
+/* per-thread accounting. each thread gets a counter block the first time it allocates; the counters are updated with
+   atomic adds, those for releases after the wrappers drop LIBVALVE_LOCK.
+   a pthread key destructor reports what a thread leaves live when it exits */
+
+__thread LibvalveThread *LIBVALVE_THREAD __attribute__((tls_model("initial-exec")));
+LibvalveThread *LIBVALVE_THREADS; /* pushed onto without a lock, never removed from */
+unsigned long int LIBVALVE_NUM_THREADS;
+pthread_key_t LIBVALVE_THREAD_KEY;
+
+void libvalve_thread_exit(void *arg);
+
+void libvalve_thread_init()
+{
+  LIBVALVE_THREADS = 0;
+  LIBVALVE_NUM_THREADS = 0;
+  pthread_key_create(&LIBVALVE_THREAD_KEY,libvalve_thread_exit);
+}
+
+LibvalveThread *libvalve_current_thread()
+{
+  LibvalveThread *thread;
+  
+  if((thread = LIBVALVE_THREAD))
+    return thread;
+  
+  thread = calloc(1,sizeof(LibvalveThread));
+  thread->thread_num = __atomic_add_fetch(&LIBVALVE_NUM_THREADS,1,__ATOMIC_RELAXED);
+#ifdef LINUX
+  thread->thread_id = syscall(SYS_gettid);
+#elif defined(FREEBSD)
+  thread->thread_id = pthread_getthreadid_np();
+#endif
+  LIST_INIT(&thread->memory_blocks);
+  
+  thread->next = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&LIBVALVE_THREADS,&thread->next,thread,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+  
+  LIBVALVE_THREAD = thread;
+  pthread_setspecific(LIBVALVE_THREAD_KEY,thread);
+  
+  return thread;
+}
+
+/* called with LIBVALVE_LOCK held, which guards the block lists. the adds are made here, before the block can be
+   freed, so that a release (counted after the lock is dropped) never finds the counters short */
+
+void libvalve_thread_allocate(MemoryBlock *memory_block)
+{
+  LibvalveThread *thread = libvalve_current_thread();
+  
+  memory_block->thread = thread;
+  __atomic_add_fetch(&thread->current_num_allocations,1,__ATOMIC_RELAXED);
+  __atomic_add_fetch(&thread->current_bytes_allocated,memory_block->size,__ATOMIC_RELAXED);
+  __atomic_add_fetch(&thread->total_num_allocations,1,__ATOMIC_RELAXED);
+  __atomic_add_fetch(&thread->total_bytes_allocated,memory_block->size,__ATOMIC_RELAXED);
+  LIST_INSERT_HEAD(&thread->memory_blocks,memory_block,ThreadLinks);
+}
+
+/* the block is being freed or reallocated, possibly by another thread than the one that allocated it; returns that
+   thread, to be handed to libvalve_thread_count_release() once the lock is released */
+
+LibvalveThread *libvalve_thread_release(MemoryBlock *memory_block)
+{
+  LibvalveThread *thread = memory_block->thread;
+  
+  if(thread == 0)
+    return 0;
+  
+  LIST_REMOVE(memory_block,ThreadLinks);
+  memory_block->thread = 0;
+  
+  return thread;
+}
+
+/* called without LIBVALVE_LOCK */
+
+void libvalve_thread_count_release(LibvalveThread *thread,size_t size)
+{
+  if(thread == 0)
+    return;
+  
+  __atomic_sub_fetch(&thread->current_num_allocations,1,__ATOMIC_RELAXED);
+  __atomic_sub_fetch(&thread->current_bytes_allocated,size,__ATOMIC_RELAXED);
+}
+
+void libvalve_thread_count_free()
+{
+  __atomic_add_fetch(&libvalve_current_thread()->num_frees,1,__ATOMIC_RELAXED);
+}
+
+/* zero the running totals (but not what is live), e.g. to measure from a point in a long-running program */
+
+void libvalve_thread_reset()
+{
+  LibvalveThread *thread;
+  
+  for(thread = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_ACQUIRE); thread; thread = thread->next)
+  {
+    __atomic_store_n(&thread->total_num_allocations,__atomic_load_n(&thread->current_num_allocations,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+    __atomic_store_n(&thread->total_bytes_allocated,__atomic_load_n(&thread->current_bytes_allocated,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+    __atomic_store_n(&thread->num_frees,0,__ATOMIC_RELAXED);
+  }
+}
+
+/* the key destructor: runs in the exiting thread (but not for the main thread, whose blocks are in the leak report).
+   the blocks are copied under the lock and symbolized after it is released, so that threads leaving a pool do not
+   hold up the threads still allocating */
+
+void libvalve_thread_exit(void *arg)
+{
+  LibvalveThread *thread = arg;
+  MemoryBlock *memory_block;
+  MemoryBlock *block_copies;
+  MemoryBlock **memory_blocks;
+  unsigned long int num_blocks;
+  unsigned long int num_bytes;
+  unsigned long int i;
+  
+  pthread_mutex_lock(&LIBVALVE_LOCK);
+  
+  thread->exited = 1;
+  num_blocks = 0;
+  LIST_FOREACH(memory_block,&thread->memory_blocks,ThreadLinks)
+    num_blocks++;
+  
+  block_copies = 0;
+  num_bytes = 0;
+  if(num_blocks)
+  {
+    block_copies = malloc(num_blocks * sizeof(MemoryBlock));
+    i = 0;
+    LIST_FOREACH(memory_block,&thread->memory_blocks,ThreadLinks)
+    {
+      block_copies[i++] = *memory_block;
+      num_bytes += memory_block->size;
+    }
+  }
+  
+  pthread_mutex_unlock(&LIBVALVE_LOCK);
+  
+  if(num_blocks == 0)
+    return;
+  
+  /* allocation points are never freed, so the copies' pointers to them stay good */
+  memory_blocks = malloc(num_blocks * sizeof(MemoryBlock*));
+  for(i = 0; i < num_blocks; i++)
+    memory_blocks[i] = &block_copies[i];
+  
+  fprintf(stderr,"[libvalve] Thread %lu (id %ld) exited leaving %lu bytes live in %lu block(s) it allocated:\n",
+          thread->thread_num,thread->thread_id,num_bytes,num_blocks);
+  libvalve_report_memory_blocks(stderr,memory_blocks,num_blocks);
+  
+  free(memory_blocks);
+  free(block_copies);
+}
+
+void libvalve_thread_report(FILE *out)
+{
+  LibvalveThread *thread;
+  LibvalveThread **threads;
+  unsigned long int num_threads;
+  unsigned long int i;
+  
+  /* the list is newest first; print in the order the threads first allocated */
+  num_threads = 0;
+  for(thread = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_ACQUIRE); thread; thread = thread->next)
+    num_threads++;
+  threads = malloc(num_threads * sizeof(LibvalveThread*));
+  i = num_threads;
+  for(thread = __atomic_load_n(&LIBVALVE_THREADS,__ATOMIC_ACQUIRE); thread && i; thread = thread->next)
+    threads[--i] = thread;
+  
+  fprintf(out,"[libvalve] Memory usage by thread:\n");
+  fprintf(out,"[libvalve] %6s %8s %14s %12s %14s %12s %10s\n","thread","id","live bytes","live blocks","total bytes","total blocks","frees");
+  
+  for(i = 0; i < num_threads; i++)
+  {
+    thread = threads[i];
+    fprintf(out,"[libvalve] %6lu %8ld %14lu %12lu %14lu %12lu %10lu%s\n",thread->thread_num,thread->thread_id,
+            __atomic_load_n(&thread->current_bytes_allocated,__ATOMIC_RELAXED),__atomic_load_n(&thread->current_num_allocations,__ATOMIC_RELAXED),
+            __atomic_load_n(&thread->total_bytes_allocated,__ATOMIC_RELAXED),__atomic_load_n(&thread->total_num_allocations,__ATOMIC_RELAXED),
+            __atomic_load_n(&thread->num_frees,__ATOMIC_RELAXED),thread->exited ? " (exited)" : "");
+  }
+  fprintf(out,"\n");
+  free(threads);
+}
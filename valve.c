@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/wait.h>
 #include <sys/shm.h>
 #include <sys/ptrace.h>
@@ -48,6 +49,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "valve_util.h"
 #include "valve.h"
 #include "dwarfy.h"
+#include "valve_diff.h"
 
 #ifdef FREEBSD
 #define PTRACE_TRACEME PT_TRACE_ME
@@ -60,6 +62,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define r_
 #endif
 
+#define VALVE_OPTION_FLAME 256
+#define VALVE_OPTION_CONTROL 257
+#define VALVE_OPTION_METRICS 258
+#define VALVE_OPTION_METRICS_INTERVAL 259
+
 extern char **environ;
 LibvalveSharedMem *LIBVALVE_SHARED_MEM;
 char LIBVALVE_PATCHED_LIB_NAMES[LIBVALVE_MAX_NUM_LIBRARIES][256];
@@ -244,16 +251,42 @@ int main(int argc,char **argv)
   Library *target,*libvalve;
   int opt = 0;
   int i,j;
+  struct option long_options[] =
+  {
+    {"flame",required_argument,0,VALVE_OPTION_FLAME},
+    {"control",optional_argument,0,VALVE_OPTION_CONTROL},
+    {"metrics",required_argument,0,VALVE_OPTION_METRICS},
+    {"metrics-interval",required_argument,0,VALVE_OPTION_METRICS_INTERVAL},
+    {0,0,0,0}
+  };
   
-  shmid = shmget(ftok("/usr/local/lib/libvalve.so",1),sizeof(LibvalveSharedMem),IPC_CREAT | 0666);
+  if(argc > 1 && !strcmp(argv[1],"diff"))
+    return valve_diff(argc - 1,argv + 1);
+  
+  if(-1 == (shmid = shmget(ftok("/usr/local/lib/libvalve.so",1),sizeof(LibvalveSharedMem),IPC_CREAT | 0666)))
+  {
+    /* a segment left behind by an older valve may be too small for the current shared memory layout */
+    shmctl(shmget(ftok("/usr/local/lib/libvalve.so",1),0,0666),IPC_RMID,0);
+    shmid = shmget(ftok("/usr/local/lib/libvalve.so",1),sizeof(LibvalveSharedMem),IPC_CREAT | 0666);
+  }
   LIBVALVE_SHARED_MEM = shmat(shmid,0,0);
  
   memset(LIBVALVE_SHARED_MEM,0,sizeof(LibvalveSharedMem));
   
   LIBVALVE_NUM_PATCHED_LIBS = 0;
   LIBVALVE_SHARED_MEM->config.context_num_lines = 1;
+  LIBVALVE_SHARED_MEM->config.snapshot_signal = 0;
+  strcpy(LIBVALVE_SHARED_MEM->config.output_directory,".");
+  LIBVALVE_SHARED_MEM->config.profile_interval_bytes = 0;
+  LIBVALVE_SHARED_MEM->config.profile_interval_seconds = 0;
+  LIBVALVE_SHARED_MEM->config.profile_diff = 0;
+  LIBVALVE_SHARED_MEM->config.growth_epoch_seconds = 0;
+  LIBVALVE_SHARED_MEM->config.growth_num_epochs = 5;
+  LIBVALVE_SHARED_MEM->config.report_format = LIBVALVE_REPORT_TEXT;
+  LIBVALVE_SHARED_MEM->config.flame_mode = LIBVALVE_FLAME_NONE;
+  LIBVALVE_SHARED_MEM->config.metrics_interval_seconds = 10;
   
-  while((opt = getopt(argc,argv,":p:c:")) != -1)
+  while((opt = getopt_long(argc,argv,":p:c:s:d:i:t:ge:k:f:o:j:",long_options,0)) != -1)
   {
       switch(opt)
       {
@@ -270,6 +303,112 @@ int main(int argc,char **argv)
           LIBVALVE_SHARED_MEM->config.context_num_lines = num_lines;
           break;
         }
+        case 's':
+        {
+          int signal_number;
+          sscanf(optarg,"%d",&signal_number);
+          LIBVALVE_SHARED_MEM->config.snapshot_signal = signal_number;
+          break;
+        }
+        case 'd':
+        {
+          strncpy(LIBVALVE_SHARED_MEM->config.output_directory,optarg,255);
+          break;
+        }
+        case 'i':
+        {
+          unsigned long int num_bytes;
+          sscanf(optarg,"%lu",&num_bytes);
+          LIBVALVE_SHARED_MEM->config.profile_interval_bytes = num_bytes;
+          break;
+        }
+        case 't':
+        {
+          unsigned int num_seconds;
+          sscanf(optarg,"%u",&num_seconds);
+          LIBVALVE_SHARED_MEM->config.profile_interval_seconds = num_seconds;
+          break;
+        }
+        case 'g':
+        {
+          LIBVALVE_SHARED_MEM->config.profile_diff = 1;
+          break;
+        }
+        case 'e':
+        {
+          unsigned int num_seconds;
+          sscanf(optarg,"%u",&num_seconds);
+          LIBVALVE_SHARED_MEM->config.growth_epoch_seconds = num_seconds;
+          break;
+        }
+        case 'k':
+        {
+          unsigned int num_epochs;
+          sscanf(optarg,"%u",&num_epochs);
+          LIBVALVE_SHARED_MEM->config.growth_num_epochs = num_epochs ? num_epochs : 1;
+          break;
+        }
+        case 'f':
+        {
+          if(!strcmp(optarg,"text"))
+            LIBVALVE_SHARED_MEM->config.report_format = LIBVALVE_REPORT_TEXT;
+          else if(!strcmp(optarg,"pprof"))
+            LIBVALVE_SHARED_MEM->config.report_format = LIBVALVE_REPORT_PPROF;
+          else if(!strcmp(optarg,"json"))
+            LIBVALVE_SHARED_MEM->config.report_format = LIBVALVE_REPORT_JSON;
+          else if(!strcmp(optarg,"snap"))
+            LIBVALVE_SHARED_MEM->config.report_format = LIBVALVE_REPORT_SNAPSHOT;
+          else
+          {
+            fprintf(stderr,"[libvalve] Error: unknown report format \"%s\".\n",optarg);
+            exit(1);
+          }
+          break;
+        }
+        case 'o':
+        {
+          strncpy(LIBVALVE_SHARED_MEM->config.output_path,optarg,255);
+          break;
+        }
+        case 'j':
+        {
+          int num_threads;
+          sscanf(optarg,"%d",&num_threads);
+          LIBVALVE_SHARED_MEM->config.num_load_threads = num_threads > 0 ? num_threads : 1;
+          break;
+        }
+        case VALVE_OPTION_FLAME:
+        {
+          if(!strcmp(optarg,"alloc"))
+            LIBVALVE_SHARED_MEM->config.flame_mode = LIBVALVE_FLAME_ALLOC;
+          else if(!strcmp(optarg,"live"))
+            LIBVALVE_SHARED_MEM->config.flame_mode = LIBVALVE_FLAME_LIVE;
+          else
+          {
+            fprintf(stderr,"[libvalve] Error: --flame must be \"alloc\" or \"live\".\n");
+            exit(1);
+          }
+          break;
+        }
+        case VALVE_OPTION_CONTROL:
+        {
+          LIBVALVE_SHARED_MEM->config.control = 1;
+          if(optarg)
+            strncpy(LIBVALVE_SHARED_MEM->config.control_path,optarg,255);
+          break;
+        }
+        case VALVE_OPTION_METRICS:
+        {
+          strncpy(LIBVALVE_SHARED_MEM->config.metrics_path,optarg,255);
+          break;
+        }
+        case VALVE_OPTION_METRICS_INTERVAL:
+        {
+          unsigned int num_seconds;
+          sscanf(optarg,"%u",&num_seconds);
+          LIBVALVE_SHARED_MEM->config.metrics_interval_seconds = num_seconds ? num_seconds : 1;
+          break;
+        }
         case ':':
         {
           exit(1);
@@ -351,13 +490,20 @@ int main(int argc,char **argv)
         
           if(WIFSTOPPED(status))
           {
-            ptrace(PTRACE_CONT,pid,(caddr_t)1,0);  
+            /* pass signals on to the target so that its own handlers (and libvalve's snapshot trigger) see them */
+            ptrace(PTRACE_CONT,pid,(caddr_t)1,WSTOPSIG(status) == SIGTRAP ? 0 : WSTOPSIG(status));  
           }
           else if(WIFEXITED(status))
           {
             result = WEXITSTATUS(status);
             break;
           }
+          else if(WIFSIGNALED(status))
+          {
+            fprintf(stderr,"[libvalve] Program killed by signal %d.\n",WTERMSIG(status));
+            result = 128 + WTERMSIG(status);
+            break;
+          }
        }
      }
   }
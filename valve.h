@@ -37,6 +37,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define LIBVALVE_MAX_NUM_REGIONS 4096
 #define LIBVALVE_MAX_NUM_LIBRARIES 1024
 
+#define LIBVALVE_REPORT_TEXT 0
+#define LIBVALVE_REPORT_PPROF 1
+#define LIBVALVE_REPORT_JSON 2
+#define LIBVALVE_REPORT_SNAPSHOT 3
+
+#define LIBVALVE_FLAME_NONE 0
+#define LIBVALVE_FLAME_ALLOC 1
+#define LIBVALVE_FLAME_LIVE 2
+
 typedef struct
 {
     char name[256];
@@ -48,6 +57,21 @@ typedef struct
 typedef struct
 {
   unsigned int context_num_lines;
+  int snapshot_signal;
+  char output_directory[256];
+  unsigned long int profile_interval_bytes;
+  unsigned int profile_interval_seconds;
+  int profile_diff;
+  unsigned int growth_epoch_seconds;
+  unsigned int growth_num_epochs;
+  int report_format;
+  int flame_mode;
+  char output_path[256];
+  int control;
+  char control_path[256];
+  char metrics_path[256];
+  unsigned int metrics_interval_seconds;
+  int num_load_threads; /* 0: one per CPU */
 } LibvalveConfig; 
 
 typedef struct
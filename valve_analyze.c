@@ -0,0 +1,306 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "dwarfy.h"
+#include "valve_util.h"
+#include "valve_snapshot.h"
+
+/* valve-analyze: symbolize, sort, filter and diff the binary snapshots written by valve -f snap */
+
+#define VALVE_ANALYZE_SORT_LIVE_BYTES 0
+#define VALVE_ANALYZE_SORT_LIVE_BLOCKS 1
+#define VALVE_ANALYZE_SORT_TOTAL_BYTES 2
+#define VALVE_ANALYZE_SORT_TOTAL_BLOCKS 3
+
+typedef struct
+{
+  char *module_name;
+  uint64_t offset; /* from the module's base address, so that sites match across runs */
+  long int live_bytes;
+  long int live_blocks;
+  long int total_bytes;
+  long int total_blocks;
+  ValveSnapshotSite *site; /* in the newest snapshot, or 0 */
+  char location[512];
+} ValveAnalyzeRow;
+
+ValveSnapshot VALVE_ANALYZE_SNAPSHOT;
+DWARF_DATA **VALVE_ANALYZE_DWARF;
+int VALVE_ANALYZE_SORT_KEY = VALVE_ANALYZE_SORT_LIVE_BYTES;
+
+long int valve_analyze_sort_value(ValveAnalyzeRow *row)
+{
+  switch(VALVE_ANALYZE_SORT_KEY)
+  {
+    case VALVE_ANALYZE_SORT_LIVE_BLOCKS: return row->live_blocks;
+    case VALVE_ANALYZE_SORT_TOTAL_BYTES: return row->total_bytes;
+    case VALVE_ANALYZE_SORT_TOTAL_BLOCKS: return row->total_blocks;
+    default: return row->live_bytes;
+  }
+}
+
+int valve_analyze_compare_rows(const void *r1,const void *r2)
+{
+  long int v1 = valve_analyze_sort_value((ValveAnalyzeRow*)r1);
+  long int v2 = valve_analyze_sort_value((ValveAnalyzeRow*)r2);
+  
+  /* largest first; in a diff, largest change either way */
+  if(v1 < 0)
+    v1 = -v1;
+  if(v2 < 0)
+    v2 = -v2;
+  return (v1 < v2) - (v1 > v2);
+}
+
+int valve_analyze_compare_keys(const void *r1,const void *r2)
+{
+  const ValveAnalyzeRow *a = r1;
+  const ValveAnalyzeRow *b = r2;
+  int result;
+  
+  if((result = strcmp(a->module_name,b->module_name)))
+    return result;
+  return (a->offset > b->offset) - (a->offset < b->offset);
+}
+
+ValveAnalyzeRow *valve_analyze_load_rows(ValveSnapshot *snapshot,uint64_t *num_rows)
+{
+  ValveAnalyzeRow *rows;
+  ValveSnapshotSite *site;
+  uint64_t i;
+  
+  rows = calloc(snapshot->header->num_sites + 1,sizeof(ValveAnalyzeRow));
+  
+  for(i = 0; i < snapshot->header->num_sites; i++)
+  {
+    site = &snapshot->sites[i];
+    rows[i].module_name = valve_snapshot_module_name(snapshot,site->module);
+    rows[i].offset = valve_snapshot_site_offset(snapshot,site);
+    rows[i].live_bytes = site->current_bytes_allocated;
+    rows[i].live_blocks = site->current_num_allocations;
+    rows[i].total_bytes = site->total_bytes_allocated;
+    rows[i].total_blocks = site->total_num_allocations;
+    rows[i].site = site;
+  }
+  
+  *num_rows = snapshot->header->num_sites;
+  return rows;
+}
+
+/* subtract the old snapshot's rows from the new ones; sites that only exist in the old snapshot are appended */
+
+ValveAnalyzeRow *valve_analyze_diff_rows(ValveAnalyzeRow *rows,uint64_t *num_rows,ValveAnalyzeRow *old_rows,uint64_t num_old_rows)
+{
+  ValveAnalyzeRow *match;
+  uint64_t num_new_rows = *num_rows;
+  uint64_t i;
+  
+  rows = realloc(rows,(num_new_rows + num_old_rows + 1) * sizeof(ValveAnalyzeRow));
+  qsort(rows,num_new_rows,sizeof(ValveAnalyzeRow),valve_analyze_compare_keys);
+  
+  for(i = 0; i < num_old_rows; i++)
+  {
+    if((match = bsearch(&old_rows[i],rows,num_new_rows,sizeof(ValveAnalyzeRow),valve_analyze_compare_keys)))
+    {
+      match->live_bytes -= old_rows[i].live_bytes;
+      match->live_blocks -= old_rows[i].live_blocks;
+      match->total_bytes -= old_rows[i].total_bytes;
+      match->total_blocks -= old_rows[i].total_blocks;
+    }
+    else
+    {
+      rows[*num_rows] = old_rows[i];
+      rows[*num_rows].live_bytes = -old_rows[i].live_bytes;
+      rows[*num_rows].live_blocks = -old_rows[i].live_blocks;
+      rows[*num_rows].total_bytes = 0;
+      rows[*num_rows].total_blocks = 0;
+      rows[*num_rows].site = 0;
+      (*num_rows)++;
+    }
+  }
+  
+  return rows;
+}
+
+void valve_analyze_symbolize(ValveAnalyzeRow *row)
+{
+  DwarfySymbol symbol;
+  
+  if(valve_snapshot_symbolize(&VALVE_ANALYZE_SNAPSHOT,VALVE_ANALYZE_DWARF,row->module_name,row->offset,&symbol))
+    snprintf(row->location,512,"%s:%u [in function %s(...)]",symbol.file_name,symbol.line_number,symbol.function_name);
+  else
+    snprintf(row->location,512,"%s+0x%lx",row->module_name,(unsigned long int)row->offset);
+}
+
+void valve_analyze_usage()
+{
+  fprintf(stderr,"usage: valve-analyze [-d directory] [-s live|blocks|total|allocs] [-n num-sites] [-m module] [-F text] [-l] [-D old.snap] file.snap\n");
+  exit(1);
+}
+
+int main(int argc,char **argv)
+{
+  ValveSnapshot old_snapshot;
+  ValveAnalyzeRow *rows;
+  ValveAnalyzeRow *old_rows;
+  uint64_t num_rows;
+  uint64_t num_old_rows;
+  uint64_t num_printed;
+  uint64_t i,j;
+  char *directory = ".";
+  char *module_name = 0;
+  char *filter = 0;
+  char *old_path = 0;
+  unsigned long int max_num_sites = ~0UL;
+  int list_blocks = 0;
+  int opt;
+  
+  while((opt = getopt(argc,argv,"d:s:n:m:F:lD:")) != -1)
+  {
+    switch(opt)
+    {
+      case 'd':
+      {
+        directory = optarg;
+        break;
+      }
+      case 's':
+      {
+        if(!strcmp(optarg,"live"))
+          VALVE_ANALYZE_SORT_KEY = VALVE_ANALYZE_SORT_LIVE_BYTES;
+        else if(!strcmp(optarg,"blocks"))
+          VALVE_ANALYZE_SORT_KEY = VALVE_ANALYZE_SORT_LIVE_BLOCKS;
+        else if(!strcmp(optarg,"total"))
+          VALVE_ANALYZE_SORT_KEY = VALVE_ANALYZE_SORT_TOTAL_BYTES;
+        else if(!strcmp(optarg,"allocs"))
+          VALVE_ANALYZE_SORT_KEY = VALVE_ANALYZE_SORT_TOTAL_BLOCKS;
+        else
+          valve_analyze_usage();
+        break;
+      }
+      case 'n':
+      {
+        sscanf(optarg,"%lu",&max_num_sites);
+        break;
+      }
+      case 'm':
+      {
+        module_name = optarg;
+        break;
+      }
+      case 'F':
+      {
+        filter = optarg;
+        break;
+      }
+      case 'l':
+      {
+        list_blocks = 1;
+        break;
+      }
+      case 'D':
+      {
+        old_path = optarg;
+        break;
+      }
+      default:
+      {
+        valve_analyze_usage();
+      }
+    }
+  }
+  
+  if(optind != argc - 1)
+    valve_analyze_usage();
+  
+  if(valve_snapshot_open(argv[optind],&VALVE_ANALYZE_SNAPSHOT))
+  {
+    fprintf(stderr,"[valve-analyze] Error: \"%s\" is not a valve snapshot.\n",argv[optind]);
+    return 1;
+  }
+  
+  rows = valve_analyze_load_rows(&VALVE_ANALYZE_SNAPSHOT,&num_rows);
+  
+  if(old_path)
+  {
+    if(valve_snapshot_open(old_path,&old_snapshot))
+    {
+      fprintf(stderr,"[valve-analyze] Error: \"%s\" is not a valve snapshot.\n",old_path);
+      return 1;
+    }
+    old_rows = valve_analyze_load_rows(&old_snapshot,&num_old_rows);
+    rows = valve_analyze_diff_rows(rows,&num_rows,old_rows,num_old_rows);
+  }
+  
+  VALVE_ANALYZE_DWARF = valve_snapshot_load_dwarf(&VALVE_ANALYZE_SNAPSHOT,directory);
+  qsort(rows,num_rows,sizeof(ValveAnalyzeRow),valve_analyze_compare_rows);
+  
+  printf("Snapshot of process %lu: %lu block(s) allocated (malloc: %lu, calloc: %lu, realloc: %lu), %lu freed, %lu allocation point(s)\n",
+         (unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->pid,(unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_allocs,
+         (unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_mallocs,(unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_callocs,
+         (unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_reallocs,(unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_frees,
+         (unsigned long int)VALVE_ANALYZE_SNAPSHOT.header->num_sites);
+  if(old_path)
+    printf("Changes since %s\n",old_path);
+  printf("\n%14s %12s %14s %12s  %s\n","live bytes","live blocks","total bytes","total blocks","location");
+  
+  num_printed = 0;
+  for(i = 0; i < num_rows && num_printed < max_num_sites; i++)
+  {
+    if(old_path && rows[i].live_bytes == 0 && rows[i].live_blocks == 0 && rows[i].total_blocks == 0)
+      continue;
+    if(module_name && strcmp(module_name,rows[i].module_name))
+      continue;
+    
+    valve_analyze_symbolize(&rows[i]);
+    if(filter && !strstr(rows[i].location,filter))
+      continue;
+    
+    if(old_path)
+      printf("%+14ld %+12ld %+14ld %+12ld  %s\n",rows[i].live_bytes,rows[i].live_blocks,rows[i].total_bytes,rows[i].total_blocks,rows[i].location);
+    else
+      printf("%14ld %12ld %14ld %12ld  %s\n",rows[i].live_bytes,rows[i].live_blocks,rows[i].total_bytes,rows[i].total_blocks,rows[i].location);
+    
+    if(list_blocks && rows[i].site && rows[i].site->first_block + rows[i].site->num_blocks <= VALVE_ANALYZE_SNAPSHOT.header->num_blocks)
+    {
+      for(j = 0; j < rows[i].site->num_blocks; j++)
+        printf("%14s 0x%lx (%lu bytes)\n","",(unsigned long int)VALVE_ANALYZE_SNAPSHOT.blocks[rows[i].site->first_block + j].address,
+               (unsigned long int)VALVE_ANALYZE_SNAPSHOT.blocks[rows[i].site->first_block + j].size);
+    }
+    num_printed++;
+  }
+  
+  return 0;
+}
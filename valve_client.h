@@ -0,0 +1,89 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VALVE_CLIENT_H
+#define VALVE_CLIENT_H
+
+/* requests a program can make of libvalve while it runs. libvalve_client_request is a weak reference:
+   when the program is not running under valve it stays null and every macro below evaluates to 0.
+   (programs linked without -pie may need -Wl,-z,dynamic-undefined-weak for the reference to be resolved at run time) */
+
+#define VALVE_CLIENT_DO_LEAK_CHECK 1
+#define VALVE_CLIENT_SNAPSHOT 2
+#define VALVE_CLIENT_COUNT_LIVE 3
+#define VALVE_CLIENT_PHASE 4
+#define VALVE_CLIENT_SCOPE_BEGIN 5
+#define VALVE_CLIENT_SCOPE_END 6
+#define VALVE_CLIENT_TAG 7
+#define VALVE_CLIENT_TAG_PUSH 8
+#define VALVE_CLIENT_TAG_POP 9
+#define VALVE_CLIENT_TAG_REPORT 10
+#define VALVE_CLIENT_TAG_LIVE_BYTES 11
+
+#ifndef LIBVALVE_H
+extern long int libvalve_client_request(int request,const char *name,long int value) __attribute__((weak));
+#endif
+
+#define VALVE_CLIENT_REQUEST(request,name,value) (libvalve_client_request ? libvalve_client_request((request),(name),(value)) : 0L)
+
+/* print the leak report now; returns the number of live blocks */
+#define VALVE_DO_LEAK_CHECK() VALVE_CLIENT_REQUEST(VALVE_CLIENT_DO_LEAK_CHECK,0,0)
+
+/* write a snapshot in the report format given to valve, with name in its file name; returns the snapshot number */
+#define VALVE_SNAPSHOT(name) VALVE_CLIENT_REQUEST(VALVE_CLIENT_SNAPSHOT,(name),0)
+
+/* the number of blocks currently allocated */
+#define VALVE_COUNT_LIVE() VALVE_CLIENT_REQUEST(VALVE_CLIENT_COUNT_LIVE,0,0)
+
+/* end the current phase and start the one called name: logs what the finished phase allocated and writes a heap profile;
+   returns the number of allocations made during the finished phase */
+#define VALVE_PHASE(name) VALVE_CLIENT_REQUEST(VALVE_CLIENT_PHASE,(name),0)
+
+/* start a leak-check scope in the calling thread; scopes nest */
+#define VALVE_SCOPE_BEGIN(name) VALVE_CLIENT_REQUEST(VALVE_CLIENT_SCOPE_BEGIN,(name),0)
+
+/* end the innermost scope, reporting every block the thread allocated in it that is still live;
+   returns the number of such blocks */
+#define VALVE_SCOPE_END() VALVE_CLIENT_REQUEST(VALVE_CLIENT_SCOPE_END,0,0)
+
+/* the ID of the allocation tag called name, registering it if it is new; look it up once and keep it */
+#define VALVE_TAG(name) VALVE_CLIENT_REQUEST(VALVE_CLIENT_TAG,(name),0)
+
+/* make tag the calling thread's current tag, charged with everything the thread allocates until the matching pop */
+#define VALVE_TAG_PUSH(tag) VALVE_CLIENT_REQUEST(VALVE_CLIENT_TAG_PUSH,0,(tag))
+#define VALVE_TAG_POP() VALVE_CLIENT_REQUEST(VALVE_CLIENT_TAG_POP,0,0)
+
+/* print live and total bytes and blocks for every tag */
+#define VALVE_TAG_REPORT() VALVE_CLIENT_REQUEST(VALVE_CLIENT_TAG_REPORT,0,0)
+
+/* the bytes currently allocated under tag */
+#define VALVE_TAG_LIVE_BYTES(tag) VALVE_CLIENT_REQUEST(VALVE_CLIENT_TAG_LIVE_BYTES,0,(tag))
+
+#endif
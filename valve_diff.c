@@ -0,0 +1,286 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "dwarfy.h"
+#include "valve_util.h"
+#include "valve_snapshot.h"
+#include "valve_diff.h"
+
+/* valve diff: compare two binary snapshots, possibly from different builds, site by site.
+   sites are matched on their symbolized location, so moving code around does not break the match */
+
+#define VALVE_DIFF_OLD 0
+#define VALVE_DIFF_NEW 1
+
+typedef struct
+{
+  unsigned long int total_num_allocations[2];
+  unsigned long int total_bytes_allocated[2];
+  unsigned long int current_num_allocations[2];
+  int present[2];
+} ValveDiffSite;
+
+typedef struct
+{
+  unsigned long int index;
+  long int total_num_allocations;
+  long int total_bytes_allocated;
+  long int current_num_allocations;
+  int over_threshold;
+} ValveDiffChange;
+
+InternTable VALVE_DIFF_LOCATIONS;
+ValveDiffSite *VALVE_DIFF_SITES;
+unsigned long int VALVE_DIFF_MAX_NUM_SITES;
+
+/* fold one snapshot's sites into VALVE_DIFF_SITES, joining on the location string; returns the number of sites read, or -1 */
+
+long int valve_diff_add_snapshot(char *path,char *directory,int side)
+{
+  ValveSnapshot snapshot;
+  ValveSnapshotSite *site;
+  DWARF_DATA **dwarf;
+  DwarfySymbol symbol;
+  char *module_name;
+  char location[512];
+  unsigned long int index;
+  unsigned long int num_sites;
+  uint64_t offset;
+  uint64_t i;
+  
+  if(valve_snapshot_open(path,&snapshot))
+  {
+    fprintf(stderr,"[valve] Error: \"%s\" is not a valve snapshot.\n",path);
+    return -1;
+  }
+  
+  dwarf = valve_snapshot_load_dwarf(&snapshot,directory);
+  
+  for(i = 0; i < snapshot.header->num_sites; i++)
+  {
+    site = &snapshot.sites[i];
+    module_name = valve_snapshot_module_name(&snapshot,site->module);
+    offset = valve_snapshot_site_offset(&snapshot,site);
+    
+    if(valve_snapshot_symbolize(&snapshot,dwarf,module_name,offset,&symbol))
+      snprintf(location,512,"%s:%u [in function %s(...)]",symbol.file_name,symbol.line_number,symbol.function_name);
+    else
+      snprintf(location,512,"%s+0x%lx",module_name,(unsigned long int)offset);
+    
+    index = intern_string(&VALVE_DIFF_LOCATIONS,location);
+    
+    if(index >= VALVE_DIFF_MAX_NUM_SITES)
+    {
+      num_sites = 2 * index;
+      VALVE_DIFF_SITES = realloc(VALVE_DIFF_SITES,num_sites * sizeof(ValveDiffSite));
+      memset(VALVE_DIFF_SITES + VALVE_DIFF_MAX_NUM_SITES,0,(num_sites - VALVE_DIFF_MAX_NUM_SITES) * sizeof(ValveDiffSite));
+      VALVE_DIFF_MAX_NUM_SITES = num_sites;
+    }
+    
+    /* several call sites can share a line (and a line can be inlined into several places); sum them */
+    VALVE_DIFF_SITES[index].total_num_allocations[side] += site->total_num_allocations;
+    VALVE_DIFF_SITES[index].total_bytes_allocated[side] += site->total_bytes_allocated;
+    VALVE_DIFF_SITES[index].current_num_allocations[side] += site->current_num_allocations;
+    VALVE_DIFF_SITES[index].present[side] = 1;
+  }
+  
+  num_sites = snapshot.header->num_sites;
+  valve_snapshot_close(&snapshot);
+  free(dwarf);
+  
+  return num_sites;
+}
+
+int valve_diff_compare_changes(const void *c1,const void *c2)
+{
+  long int b1 = labs(((ValveDiffChange*)c1)->total_bytes_allocated);
+  long int b2 = labs(((ValveDiffChange*)c2)->total_bytes_allocated);
+  
+  return (b1 < b2) - (b1 > b2);
+}
+
+int valve_diff_over_threshold(ValveDiffSite *site,ValveDiffChange *change,ValveDiffThresholds *thresholds)
+{
+  if(thresholds->max_num_allocations >= 0 && change->total_num_allocations > thresholds->max_num_allocations)
+    return 1;
+  if(thresholds->max_bytes_allocated >= 0 && change->total_bytes_allocated > thresholds->max_bytes_allocated)
+    return 1;
+  if(thresholds->max_num_live_blocks >= 0 && change->current_num_allocations > thresholds->max_num_live_blocks)
+    return 1;
+  
+  /* a relative limit only means something for a site that exists in both builds */
+  if(thresholds->max_percent >= 0 && site->present[VALVE_DIFF_OLD] && site->present[VALVE_DIFF_NEW])
+  {
+    if(change->total_num_allocations > 0 && change->total_num_allocations * 100.0 > thresholds->max_percent * site->total_num_allocations[VALVE_DIFF_OLD])
+      return 1;
+    if(change->total_bytes_allocated > 0 && change->total_bytes_allocated * 100.0 > thresholds->max_percent * site->total_bytes_allocated[VALVE_DIFF_OLD])
+      return 1;
+  }
+  return 0;
+}
+
+void valve_diff_usage()
+{
+  fprintf(stderr,"usage: valve diff [-a allocs] [-b bytes] [-l live-blocks] [-r percent] [-o old-directory] [-n new-directory] [-q] old.snap new.snap\n");
+  exit(2);
+}
+
+/* returns 0 if no site grew past a threshold, 1 if one did and 2 on error */
+
+int valve_diff(int argc,char **argv)
+{
+  ValveDiffThresholds thresholds;
+  ValveDiffChange *changes;
+  ValveDiffSite *site;
+  struct timespec start,end;
+  char *old_directory = ".";
+  char *new_directory = ".";
+  long int num_old_sites,num_new_sites;
+  unsigned long int num_changes;
+  unsigned long int num_over_threshold;
+  unsigned long int i;
+  int quiet = 0;
+  int opt;
+  
+  thresholds.max_num_allocations = -1;
+  thresholds.max_bytes_allocated = -1;
+  thresholds.max_num_live_blocks = -1;
+  thresholds.max_percent = -1;
+  
+  while((opt = getopt(argc,argv,"a:b:l:r:o:n:q")) != -1)
+  {
+    switch(opt)
+    {
+      case 'a':
+      {
+        sscanf(optarg,"%ld",&thresholds.max_num_allocations);
+        break;
+      }
+      case 'b':
+      {
+        sscanf(optarg,"%ld",&thresholds.max_bytes_allocated);
+        break;
+      }
+      case 'l':
+      {
+        sscanf(optarg,"%ld",&thresholds.max_num_live_blocks);
+        break;
+      }
+      case 'r':
+      {
+        sscanf(optarg,"%lf",&thresholds.max_percent);
+        break;
+      }
+      case 'o':
+      {
+        old_directory = optarg;
+        break;
+      }
+      case 'n':
+      {
+        new_directory = optarg;
+        break;
+      }
+      case 'q':
+      {
+        quiet = 1;
+        break;
+      }
+      default:
+      {
+        valve_diff_usage();
+      }
+    }
+  }
+  
+  if(optind != argc - 2)
+    valve_diff_usage();
+  
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  
+  intern_table_init(&VALVE_DIFF_LOCATIONS);
+  VALVE_DIFF_MAX_NUM_SITES = 1024;
+  VALVE_DIFF_SITES = calloc(VALVE_DIFF_MAX_NUM_SITES,sizeof(ValveDiffSite));
+  
+  if(-1 == (num_old_sites = valve_diff_add_snapshot(argv[optind],old_directory,VALVE_DIFF_OLD)) ||
+     -1 == (num_new_sites = valve_diff_add_snapshot(argv[optind + 1],new_directory,VALVE_DIFF_NEW)))
+    return 2;
+  
+  changes = malloc(VALVE_DIFF_LOCATIONS.num_strings * sizeof(ValveDiffChange));
+  num_changes = 0;
+  num_over_threshold = 0;
+  
+  for(i = 1; i < VALVE_DIFF_LOCATIONS.num_strings; i++)
+  {
+    site = &VALVE_DIFF_SITES[i];
+    changes[num_changes].index = i;
+    changes[num_changes].total_num_allocations = site->total_num_allocations[VALVE_DIFF_NEW] - site->total_num_allocations[VALVE_DIFF_OLD];
+    changes[num_changes].total_bytes_allocated = site->total_bytes_allocated[VALVE_DIFF_NEW] - site->total_bytes_allocated[VALVE_DIFF_OLD];
+    changes[num_changes].current_num_allocations = site->current_num_allocations[VALVE_DIFF_NEW] - site->current_num_allocations[VALVE_DIFF_OLD];
+    
+    if(changes[num_changes].total_num_allocations == 0 && changes[num_changes].total_bytes_allocated == 0 && changes[num_changes].current_num_allocations == 0)
+      continue;
+    
+    if((changes[num_changes].over_threshold = valve_diff_over_threshold(site,&changes[num_changes],&thresholds)))
+      num_over_threshold++;
+    num_changes++;
+  }
+  
+  qsort(changes,num_changes,sizeof(ValveDiffChange),valve_diff_compare_changes);
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  
+  if(num_changes)
+    printf("%14s %14s %12s    %s\n","total allocs","total bytes","live blocks","location");
+  
+  for(i = 0; i < num_changes; i++)
+  {
+    if(quiet && !changes[i].over_threshold)
+      continue;
+    site = &VALVE_DIFF_SITES[changes[i].index];
+    printf("%+14ld %+14ld %+12ld %s%s%s\n",changes[i].total_num_allocations,changes[i].total_bytes_allocated,changes[i].current_num_allocations,
+           changes[i].over_threshold ? " ! " : "   ",VALVE_DIFF_LOCATIONS.strings[changes[i].index],
+           !site->present[VALVE_DIFF_OLD] ? " (new)" : !site->present[VALVE_DIFF_NEW] ? " (gone)" : "");
+  }
+  
+  fprintf(stderr,"[valve] %lu of %lu location(s) changed, %lu over threshold (%ld + %ld sites compared in %.3f ms)\n",
+          num_changes,VALVE_DIFF_LOCATIONS.num_strings - 1,num_over_threshold,num_old_sites,num_new_sites,
+          (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+  
+  free(changes);
+  free(VALVE_DIFF_SITES);
+  intern_table_free(&VALVE_DIFF_LOCATIONS);
+  
+  return num_over_threshold ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "valve_util.h"
+#include "elf_util.h"
+#include "valve_snapshot.h"
+
+int valve_snapshot_section_fits(ValveSnapshot *snapshot,uint64_t offset,uint64_t num_records,size_t record_size)
+{
+  if(offset > snapshot->size || num_records > (snapshot->size - offset) / record_size)
+    return 0;
+  return 1;
+}
+
+/* map a snapshot file read-only and check that its sections lie within it; returns 0 on success */
+
+int valve_snapshot_open(char *path,ValveSnapshot *snapshot)
+{
+  struct stat status;
+  ValveSnapshotHeader *header;
+  int fd;
+  
+  memset(snapshot,0,sizeof(ValveSnapshot));
+  
+  if(-1 == (fd = open(path,O_RDONLY)))
+    return -1;
+  
+  if(fstat(fd,&status) || status.st_size < (off_t)sizeof(ValveSnapshotHeader))
+  {
+    close(fd);
+    return -1;
+  }
+  
+  snapshot->size = status.st_size;
+  snapshot->data = mmap(0,snapshot->size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  
+  if(snapshot->data == MAP_FAILED)
+  {
+    snapshot->data = 0;
+    return -1;
+  }
+  
+  header = snapshot->header = (ValveSnapshotHeader*)snapshot->data;
+  
+  if(memcmp(header->magic,VALVE_SNAPSHOT_MAGIC,8) || header->version != VALVE_SNAPSHOT_VERSION ||
+     !valve_snapshot_section_fits(snapshot,header->modules_offset,header->num_modules,sizeof(ValveSnapshotModule)) ||
+     !valve_snapshot_section_fits(snapshot,header->sites_offset,header->num_sites,sizeof(ValveSnapshotSite)) ||
+     !valve_snapshot_section_fits(snapshot,header->blocks_offset,header->num_blocks,sizeof(ValveSnapshotBlock)) ||
+     !valve_snapshot_section_fits(snapshot,header->strings_offset,header->strings_size,1) ||
+     header->strings_size == 0 || snapshot->data[header->strings_offset + header->strings_size - 1] != 0)
+  {
+    valve_snapshot_close(snapshot);
+    return -1;
+  }
+  
+  snapshot->modules = (ValveSnapshotModule*)(snapshot->data + header->modules_offset);
+  snapshot->sites = (ValveSnapshotSite*)(snapshot->data + header->sites_offset);
+  snapshot->blocks = (ValveSnapshotBlock*)(snapshot->data + header->blocks_offset);
+  snapshot->strings = (char*)(snapshot->data + header->strings_offset);
+  
+  return 0;
+}
+
+void valve_snapshot_close(ValveSnapshot *snapshot)
+{
+  if(snapshot->data)
+    munmap(snapshot->data,snapshot->size);
+  memset(snapshot,0,sizeof(ValveSnapshot));
+}
+
+char *valve_snapshot_module_name(ValveSnapshot *snapshot,uint32_t module)
+{
+  uint32_t name_offset;
+  
+  if(module >= snapshot->header->num_modules)
+    return "??";
+  
+  name_offset = snapshot->modules[module].name_offset;
+  return name_offset < snapshot->header->strings_size ? snapshot->strings + name_offset : "??";
+}
+
+/* a site's address relative to its module's base address, which stays the same from run to run */
+
+uint64_t valve_snapshot_site_offset(ValveSnapshot *snapshot,ValveSnapshotSite *site)
+{
+  if(site->module < snapshot->header->num_modules)
+    return site->address - snapshot->modules[site->module].base_address;
+  return site->address;
+}
+
+/* load DWARF for each module of the snapshot, looking for the objects under directory as libvalve does. an object
+   whose build-id differs from the one recorded is not the one that ran (it was rebuilt, or this is another machine),
+   so its DWARF is not used and its sites are given as module+offset */
+
+DWARF_DATA **valve_snapshot_load_dwarf(ValveSnapshot *snapshot,char *directory)
+{
+  DWARF_DATA **dwarf;
+  DwarfyLoadRequest *requests;
+  unsigned char build_id[32];
+  uint64_t i;
+  
+  dwarf = calloc(snapshot->header->num_modules + 1,sizeof(DWARF_DATA*));
+  requests = calloc(snapshot->header->num_modules + 1,sizeof(DwarfyLoadRequest));
+  
+  for(i = 0; i < snapshot->header->num_modules; i++)
+  {
+    requests[i].file_name = find_file(valve_snapshot_module_name(snapshot,i),directory);
+    requests[i].runtime_address = snapshot->modules[i].base_address;
+  }
+  
+  load_dwarf_parallel(requests,snapshot->header->num_modules,dwarfy_num_cpus());
+  
+  for(i = 0; i < snapshot->header->num_modules; i++)
+  {
+    dwarf[i] = requests[i].dwarf;
+    if(dwarf[i] && snapshot->modules[i].build_id_size &&
+       ((uint32_t)get_elf_build_id(dwarf[i]->elf,build_id) != snapshot->modules[i].build_id_size ||
+        memcmp(build_id,snapshot->modules[i].build_id,snapshot->modules[i].build_id_size)))
+    {
+      fprintf(stderr,"Warning: \"%s\" does not have the build-id recorded in the snapshot; its sites are not symbolized.\n",requests[i].file_name);
+      dwarf[i] = 0;
+    }
+    free(requests[i].file_name);
+  }
+  free(requests);
+  
+  return dwarf;
+}
+
+int valve_snapshot_symbolize(ValveSnapshot *snapshot,DWARF_DATA **dwarf,char *module_name,uint64_t offset,DwarfySymbol *symbol)
+{
+  uint64_t i;
+  
+  for(i = 0; i < snapshot->header->num_modules; i++)
+  {
+    /* the return address points past the call; step back into it */
+    if(dwarf[i] && !strcmp(module_name,valve_snapshot_module_name(snapshot,i)))
+      return dwarfy_symbolize(dwarf[i],snapshot->modules[i].base_address + offset - 1,symbol);
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*
+
+BSD 2-Clause License
+
+Copyright (c) 2019, SanctaMaria1997
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice,
+  this list of conditions and the following disclaimer in the documentation
+  and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VALVE_SNAPSHOT_H
+#define VALVE_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dwarfy.h"
+
+/* binary heap snapshot: a header followed by the module, site, block and string sections at the offsets it gives.
+   every record is a multiple of 8 bytes, so a mapped file can be read in place */
+
+#define VALVE_SNAPSHOT_MAGIC "VALVSNAP"
+#define VALVE_SNAPSHOT_VERSION 1
+#define VALVE_SNAPSHOT_NO_MODULE 0xffffffff
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t pid;
+  uint64_t num_allocs;
+  uint64_t num_mallocs;
+  uint64_t num_callocs;
+  uint64_t num_reallocs;
+  uint64_t num_frees;
+  uint64_t modules_offset;
+  uint64_t num_modules;
+  uint64_t sites_offset;
+  uint64_t num_sites;
+  uint64_t blocks_offset;
+  uint64_t num_blocks;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+} ValveSnapshotHeader;
+
+typedef struct
+{
+  uint64_t base_address; /* the runtime address given to load_dwarf() */
+  uint64_t limit;
+  uint32_t name_offset; /* into the string section */
+  uint32_t build_id_size;
+  uint8_t build_id[32];
+} ValveSnapshotModule;
+
+typedef struct
+{
+  uint64_t address; /* the return address of the allocating call */
+  uint32_t module; /* index into the modules, or VALVE_SNAPSHOT_NO_MODULE */
+  uint32_t reserved;
+  uint64_t current_num_allocations;
+  uint64_t current_bytes_allocated;
+  uint64_t total_num_allocations;
+  uint64_t total_bytes_allocated;
+  uint64_t first_block; /* the site's live blocks are blocks[first_block .. first_block + num_blocks) */
+  uint64_t num_blocks;
+} ValveSnapshotSite;
+
+typedef struct
+{
+  uint64_t address;
+  uint64_t size;
+} ValveSnapshotBlock;
+
+typedef struct
+{
+  unsigned char *data;
+  size_t size;
+  ValveSnapshotHeader *header;
+  ValveSnapshotModule *modules;
+  ValveSnapshotSite *sites;
+  ValveSnapshotBlock *blocks;
+  char *strings;
+} ValveSnapshot; /* a snapshot file mapped into memory */
+
+int valve_snapshot_open(char *path,ValveSnapshot *snapshot);
+void valve_snapshot_close(ValveSnapshot *snapshot);
+char *valve_snapshot_module_name(ValveSnapshot *snapshot,uint32_t module);
+uint64_t valve_snapshot_site_offset(ValveSnapshot *snapshot,ValveSnapshotSite *site);
+DWARF_DATA **valve_snapshot_load_dwarf(ValveSnapshot *snapshot,char *directory);
+int valve_snapshot_symbolize(ValveSnapshot *snapshot,DWARF_DATA **dwarf,char *module_name,uint64_t offset,DwarfySymbol *symbol);
+
+#endif
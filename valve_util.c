@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ftw.h>
 #include <stdio.h>
 #include <string.h>
+#include "valve_util.h"
 
 char *REQUESTED_FILE_NAME;
 char *MATCHING_FILE_PATH;
@@ -79,3 +80,75 @@ char *find_file(char *file_name,char *directory)
   else
     return 0;
 }
+
+unsigned long int hash_string(char *string)
+{
+  unsigned long int hash = 14695981039346656037UL;
+  
+  while(*string)
+  {
+    hash ^= (unsigned char)*string++;
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+void intern_table_init(InternTable *table)
+{
+  table->max_num_strings = 1024;
+  table->strings = malloc(table->max_num_strings * sizeof(char*));
+  table->num_slots = 2048;
+  table->slots = calloc(table->num_slots,sizeof(unsigned long int));
+  table->strings[0] = strdup("");
+  table->num_strings = 1;
+}
+
+/* returns the index of string in the table, adding a copy of it if it is new */
+
+unsigned long int intern_string(InternTable *table,char *string)
+{
+  unsigned long int slot;
+  unsigned long int i;
+  
+  if(string == 0 || string[0] == 0)
+    return 0;
+  
+  for(slot = hash_string(string) & (table->num_slots - 1); table->slots[slot]; slot = (slot + 1) & (table->num_slots - 1))
+  {
+    if(!strcmp(table->strings[table->slots[slot] - 1],string))
+      return table->slots[slot] - 1;
+  }
+  
+  if(table->num_strings == table->max_num_strings)
+  {
+    table->max_num_strings *= 2;
+    table->strings = realloc(table->strings,table->max_num_strings * sizeof(char*));
+  }
+  table->strings[table->num_strings] = strdup(string);
+  table->slots[slot] = ++table->num_strings;
+  
+  /* keep the load factor at or below one half */
+  if(table->num_strings * 2 > table->num_slots)
+  {
+    free(table->slots);
+    table->num_slots *= 2;
+    table->slots = calloc(table->num_slots,sizeof(unsigned long int));
+    for(i = 1; i < table->num_strings; i++)
+    {
+      for(slot = hash_string(table->strings[i]) & (table->num_slots - 1); table->slots[slot]; slot = (slot + 1) & (table->num_slots - 1));
+      table->slots[slot] = i + 1;
+    }
+  }
+  
+  return table->num_strings - 1;
+}
+
+void intern_table_free(InternTable *table)
+{
+  unsigned long int i;
+  
+  for(i = 0; i < table->num_strings; i++)
+    free(table->strings[i]);
+  free(table->strings);
+  free(table->slots);
+}
@@ -31,7 +31,20 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef VALVE_UTIL_H
 #define VALVE_UTIL_H
 
+typedef struct
+{
+  char **strings;
+  unsigned long int num_strings;
+  unsigned long int max_num_strings;
+  unsigned long int *slots; /* index + 1 into strings, 0 if free */
+  unsigned long int num_slots;
+} InternTable; /* open-addressing string intern table; index 0 is always "" */
+
 char *file_part(char *path);
 char *find_file(char *file_name,char *directory);
+unsigned long int hash_string(char *string);
+void intern_table_init(InternTable *table);
+unsigned long int intern_string(InternTable *table,char *string);
+void intern_table_free(InternTable *table);
 
 #endif